@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// adpcm.h
+
+// This module decodes the canned bark audio from an IMA ADPCM image (4 bits per sample, so 1/4
+// the flash of raw PCM). The image is created by the adpcmenc host tool and is self-describing:
+// a header, a table of clips, and then the ADPCM data for each clip. Each clip is an independent
+// stream (with its own initial decoder state) so that playback can start at any clip, and the
+// samples are packed two to a byte, the earlier one in the low nibble. All fields are little-endian
+// and naturally aligned so that the image can be used right where it sits in flash.
+
+#ifndef ADPCM_H_
+#define ADPCM_H_
+
+#include <inttypes.h>
+
+#define ADPCM_IMAGE_MAGIC "eDgA"
+#define ADPCM_IMAGE_VERSION 1
+
+#define ADPCM_CLIP_SHORT_BARK   0x1     // the single short bark (for the one-bark mode)
+
+struct adpcm_clip {
+    uint32_t offset;                    // offset of the clip's ADPCM data from the start of the image
+    uint32_t num_samples;
+    int16_t predictor;                  // initial decoder state
+    uint8_t index, flags;
+};
+
+struct adpcm_image {
+    char magic [4];
+    uint16_t version, num_clips;
+    uint32_t sample_rate, image_bytes;
+    struct adpcm_clip clips [1];        // actually num_clips entries
+};
+
+#define ADPCM_IMAGE_HEADER_BYTES 16     // size of the image header before the clip table
+
+struct adpcm_stream {
+    const uint8_t *data;
+    int32_t predictor;
+    int index, nibble, num_samples;     // num_samples is the number remaining to decode
+};
+
+extern const int16_t adpcm_step_table [89];
+extern const int8_t adpcm_index_table [16];
+
+const struct adpcm_image *adpcm_image_check (const void *image);
+void adpcm_stream_init (struct adpcm_stream *stream, const struct adpcm_image *image, int clip);
+int adpcm_decode (struct adpcm_stream *stream, int16_t *buffer, int num_samples, int copies);
+
+#endif
@@ -0,0 +1,45 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// barkmix.h
+
+// This module is a small fixed-point mixer for playing the canned bark clips with some variety
+// so that the dog doesn't sound exactly the same every time. Each clip is played with a random
+// pitch/tempo variation (by resampling) and a random gain, and a bark session can chain several
+// clips, picked by weighted random choice, with each one crossfaded into the end of the previous
+// one using the second voice. Everything is done a block of stereo frames at a time.
+
+#ifndef BARKMIX_H_
+#define BARKMIX_H_
+
+#include <inttypes.h>
+
+#include "adpcm.h"
+
+#define BARKMIX_RANDOM -1               // pass as the clip to barkmix_start() for a weighted random choice
+
+// A clip is either raw PCM (samples is not NULL) or a clip in an ADPCM image. Clips with a zero
+// weight are never chosen at random (but can still be played explicitly).
+
+struct barkmix_clip {
+    const int16_t *samples;
+    const struct adpcm_image *image;
+    int adpcm_clip, num_samples, weight;
+};
+
+void barkmix_init (const struct barkmix_clip *clips, int num_clips, uint32_t seed);
+void barkmix_start (int clip, int chain, uint32_t entropy);
+int barkmix_render (int16_t *buffer, int num_frames);
+int barkmix_active (void);
+void barkmix_stop (void);
+
+#endif
@@ -0,0 +1,28 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// console.h
+
+// This module is a small line-oriented command interpreter on the debug port, so that the
+// scanner can be queried and adjusted on a running board (type "help" for the commands). The
+// characters are received into a ring by the USART interrupt (see serial.c) and everything
+// else (the echo, the line editing and the commands) is done here, in the main loop.
+
+#ifndef CONSOLE_H_
+#define CONSOLE_H_
+
+#include <stdint.h>
+
+void console_init (uint32_t profile_deadline);
+void console_poll (void);
+
+#endif
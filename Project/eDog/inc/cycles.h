@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// cycles.h
+
+// Access to a free-running 32-bit CPU cycle counter for timing and load accounting. On the board
+// this is the DWT cycle counter (which wraps every 25 seconds at 168 MHz, so only differences of
+// less than that are meaningful). In the host simulation it's a virtual counter maintained by
+// simboard.c that runs at the same nominal rate: the host time spent processing is counted as
+// if it was spent on the board, and waiting for an interrupt moves it up to the next tick.
+
+#ifndef CYCLES_H_
+#define CYCLES_H_
+
+#include <stdint.h>
+
+#ifdef HOST_SIM
+
+#define CYCLES_PER_SECOND 168000000U
+
+uint32_t sim_cycles (void);
+
+static __inline void cycles_init (void) { }
+static __inline uint32_t cycles_now (void) { return sim_cycles (); }
+
+#else
+
+#include "stm32f4xx.h"
+
+#define CYCLES_PER_SECOND SystemCoreClock
+
+// the version of CMSIS we use (2.10) doesn't define the DWT registers
+
+#define CYCLES_DWT_CTRL (*(volatile uint32_t *) 0xE0001000)
+#define CYCLES_DWT_CYCCNT (*(volatile uint32_t *) 0xE0001004)
+#define CYCLES_DWT_CTRL_CYCCNTENA 0x00000001
+
+static __inline void cycles_init (void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    CYCLES_DWT_CYCCNT = 0;
+    CYCLES_DWT_CTRL |= CYCLES_DWT_CTRL_CYCCNTENA;
+}
+
+static __inline uint32_t cycles_now (void)
+{
+    return CYCLES_DWT_CYCCNT;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// diskcache.h
+
+// This module is a small write-back sector cache that sits between FatFs and the disk functions
+// (when _USE_DISKCACHE is set in ffconf.h, ff.c calls these instead of the disk_*() functions,
+// which are still provided by the driver). FatFs has just one sector window per volume, so when
+// it goes back and forth between the FAT, the directory and a file's partial sectors, the same
+// sectors get written and read again over and over, one sector per command. Here single sector
+// reads, and writes of a few sectors, are kept in a set-associative cache, and dirty sectors are
+// only written when they're evicted or when FatFs syncs (f_sync(), f_close() and so on, through
+// CTRL_SYNC). Either way, any dirty sectors adjacent to the one being written go along with it
+// in the same command. Multiple sector reads, and writes of DISKCACHE_MAX_RUN sectors or more
+// (the direct file data ones), go straight to the drive because they're already efficient.
+//
+// Only drive 0 with 512-byte sectors is cached (anything else is passed straight through), and
+// the cache is emptied (without writing) when the drive is initialized, because it might be a
+// different drive.
+
+#ifndef DISKCACHE_H_
+#define DISKCACHE_H_
+
+#include "diskio.h"
+
+#define DISKCACHE_SECTOR_SIZE 512
+#define DISKCACHE_WAYS 4                // sectors in each set (LRU replacement)
+#define DISKCACHE_SETS 4                // sets, selected by the low bits of the sector number
+#define DISKCACHE_MAX_RUN 8             // most sectors written in one command (the staging buffer)
+
+DSTATUS diskcache_initialize (BYTE drv);
+DSTATUS diskcache_status (BYTE drv);
+DRESULT diskcache_read (BYTE drv, BYTE *buff, DWORD sector, BYTE count);
+DRESULT diskcache_write (BYTE drv, const BYTE *buff, DWORD sector, BYTE count);
+DRESULT diskcache_ioctl (BYTE drv, BYTE ctrl, void *buff);
+
+// Turn the cache on (the default) or off (writing anything dirty first), for benchmarking.
+
+void diskcache_enable (int enable);
+
+#endif
@@ -0,0 +1,50 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// diskimg.h
+
+// This module is a FatFs disk driver (the disk_*() functions in diskio.h) for the host, over a
+// plain image file, so that the file system code used by the USB recorder (usbrec.c) can be run
+// and timed off the board (in simboard and fsbench). The image is a "superfloppy" (no partition
+// table) with 512-byte sectors, which is what f_mkfs() creates and what Linux can loop mount.
+//
+// A USB drive takes a while to respond to every command, so a latency can be injected for each
+// command and for each sector transferred. By default the latency is just added up in the stats
+// (so that a benchmark can add it to the time it measured), but if a wait function is supplied,
+// it's called with each command's latency instead (so simboard can run the audio meanwhile).
+// The commands and sectors are counted too, which shows how much of the writing is overhead
+// (FAT and directory updates) rather than file data.
+
+#ifndef DISKIMG_H_
+#define DISKIMG_H_
+
+#include <stdint.h>
+
+#define DISKIMG_SECTOR_SIZE 512
+
+struct diskimg_stats {
+    uint32_t reads, writes, syncs;              // disk commands
+    uint32_t sectors_read, sectors_written;
+    double latency_usecs;                       // total injected latency
+};
+
+// Open an existing image, or create a new (zeroed) one with the given number of sectors.
+// Returns nonzero on success. Only one image (drive 0) can be open at a time.
+
+int diskimg_open (const char *filename, uint32_t new_sectors);
+void diskimg_close (void);
+
+void diskimg_set_latency (uint32_t command_usecs, uint32_t sector_usecs, void (*wait) (uint32_t usecs));
+void diskimg_get_stats (struct diskimg_stats *stats);
+void diskimg_reset_stats (void);
+
+#endif
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// logfmt.h
+
+// Deferred (binary) debug logging. Instead of formatting a line of text with vsprintf() in the
+// audio loop, Dbg_log() just stores the message ID, a timestamp and the raw argument values in a
+// small record that goes out the debug port along with the regular text, and the formatting is
+// done later on the host (by logdecode, or right away by the simulation and scantest). Every
+// message is listed once below with its printf() format, and that one list generates both the
+// IDs used by the firmware and the format table used by the decoder, so they always match.
+//
+// Each message also has a signature with one character per argument, which is how the encoder
+// knows what to pull off the variable argument list: 'i' for an int, 'f' for a float (passed
+// as a double, like printf), and 't' for a time in samples (an int) that's displayed with a %s
+// as hh:mm:ss.sss. All arguments are stored as 32 bits (floats are stored as floats).
+//
+// Record layout (little-endian):
+//
+//   0x1E (ASCII record separator, which never appears in the text output)
+//   message ID (1 byte)
+//   argument bytes (1 byte, 4 * number of arguments)
+//   timestamp (4 bytes, cycle counter of the board)
+//   arguments (4 bytes each)
+//   checksum (1 byte, makes the sum of everything after the 0x1E zero modulo 256)
+
+#ifndef LOGFMT_H_
+#define LOGFMT_H_
+
+#include <stdint.h>
+
+#define LOG_MESSAGES \
+    LOGMSG (LOG_PEAK_ADDED, "tiif", \
+        "peak added, time = %s, height = %d, width = %d, filtered level = %.2f\n") \
+    LOGMSG (LOG_THRESHOLDS, "fff", \
+        "peak_threshold = %.2f base, %.2f actual (noise floor = %.2f)\n") \
+    LOGMSG (LOG_DISCARD_NEWEST, "i", \
+        "add_peak(): discarded newest peak (height = %d) because buffer was full!\n") \
+    LOGMSG (LOG_DISCARD_SMALLEST, "i", \
+        "add_peak(): discarded smallest peak (height = %d) because buffer was full!\n") \
+    LOGMSG (LOG_KNOCK_RETRACTED, "tff", \
+        "*** knock retracted, time = %s, spurious height = %.0f, min height = %.0f\n") \
+    LOGMSG (LOG_KNOCK_CONFIRMED, "tiff", \
+        "*** knock confirmed, time = %s, span = %d, ratio = %.3f, confidence = %.2f\n") \
+    LOGMSG (LOG_KNOCK_PROVISIONAL, "tiff", \
+        "*** knock provisional, time = %s, span = %d, ratio = %.3f, confidence = %.2f\n") \
+    LOGMSG (LOG_RING_DETECTED, "tfff", \
+        "*** ring detected, time = %s, delay = %.3f, pre level = %.2f, post level = %.2f\n") \
+    LOGMSG (LOG_KNOCK_DETECTED, "tifiiiiii", \
+        "*** knock detected, time = %s, span = %d, ratio = %.3f, heights = %d %d %d, widths = %d %d %d\n") \
+    LOGMSG (LOG_ALARM_DETECTED, "tiif", \
+        "*** alarm detected, time = %s, pattern = T%d, groups = %d, beep level = %.2f\n") \
+    LOGMSG (LOG_GLASS_DETECTED, "tfffi", \
+        "*** glass break detected, time = %s, impact = %.0f (%.1f x background), hf ratio = %.2f, hf windows = %d\n")
+
+#define LOGMSG(id, signature, format) id,
+enum { LOG_MESSAGES LOG_NUM_MESSAGES };
+#undef LOGMSG
+
+#define LOG_RECORD_START 0x1E
+#define LOG_MAX_ARGS 12
+#define LOG_HEADER_BYTES 7              // start, ID, argument bytes and timestamp
+#define LOG_MAX_RECORD (LOG_HEADER_BYTES + LOG_MAX_ARGS * 4 + 1)
+
+extern const char *const log_signatures [LOG_NUM_MESSAGES];
+extern const char *const log_formats [LOG_NUM_MESSAGES];
+
+void Dbg_log (int id, ...);
+
+// Supplied by the output side (serial.c on the board): queue a whole record or drop it.
+
+void Dbg_write (const void *data, int bytes);
+
+// Decoding is only done on the host. Returns the bytes used by the record at the start of the
+// data (writing the text and the timestamp), 0 if the record isn't complete yet, or -1 if it's
+// not a valid record (in which case the caller should skip the 0x1E and resync).
+
+#ifndef STM32F4XX
+int logfmt_decode (const uint8_t *data, int bytes, char *text, int text_size, uint32_t *timestamp);
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// pdmdec.h
+
+// Open PDM to PCM decimator that can be used in place of ST's binary PDM filter library (see
+// pdmdec.c for the details). It takes the same PDMFilter_InitStruct (Fs, LP_HZ and HP_HZ are
+// used, and only a single mic channel is supported), and the decimation function takes the
+// same arguments as PDM_Filter_64_LSB(): 1 millisecond of PDM data at 64 times Fs (so Fs/125
+// bytes, with the earliest bits in the first byte and the earliest bit of each byte in the
+// LSB) producing Fs/1000 PCM samples. With PDM_OPEN_DECIMATOR defined before this header is
+// included, calls to the library functions are redirected here.
+
+#ifndef PDMDEC_H_
+#define PDMDEC_H_
+
+#include <stdint.h>
+
+#include "pdm_filter.h"
+
+#define PDMDEC_MAX_FILTERS 2            // number of filter instances available
+#define PDMDEC_MAX_FS 32000             // highest supported output sample rate
+
+void pdmdec_init (PDMFilter_InitStruct *Filter);
+int32_t pdmdec_64_lsb (uint8_t *data, uint16_t *dataOut, uint16_t MicGain, PDMFilter_InitStruct *Filter);
+
+#ifdef PDM_OPEN_DECIMATOR
+#define PDM_Filter_Init(Filter) pdmdec_init (Filter)
+#define PDM_Filter_64_LSB(data, dataOut, MicGain, Filter) pdmdec_64_lsb (data, dataOut, MicGain, Filter)
+#endif
+
+#endif
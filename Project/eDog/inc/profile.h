@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// profile.h
+
+// Execution time profiling of the stages of the audio loop with the cycle counter (cycles.h).
+// Each stage keeps the count, min, mean and max cycles and a histogram with a bucket for each
+// power of two, so the rare worst cases (which are what matter against the fill_buffer()
+// deadline) show up along with the typical times. The stages can nest (e.g., logging happens
+// inside the scan) and the times are inclusive. The dump goes to the debug port.
+//
+// The profiling is only compiled in for the board and the host simulation (which both have a
+// cycle counter); elsewhere (e.g., scantest) the calls are empty inlines and cost nothing.
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+
+enum {
+    PROFILE_FILL,                       // all of fill_buffer()
+    PROFILE_SCAN,                       // scanning the mic samples (scan_audio_detect())
+    PROFILE_PEAKS,                      // check_peaks() inside the scan
+    PROFILE_CANNED,                     // copying (or decoding or mixing) the canned audio
+    PROFILE_LOG,                        // formatting and queuing a debug log line
+    PROFILE_NUM_STAGES
+};
+
+#define PROFILE_BUCKETS 25              // bucket n is [2^(n-1), 2^n) cycles, the last one is everything above
+
+#if defined (HOST_SIM) || defined (STM32F4XX)
+
+#include "cycles.h"
+
+#define PROFILE_ENABLED
+
+void profile_add (int stage, uint32_t cycles);
+void profile_dump (uint32_t deadline);
+void profile_reset (void);
+
+static __inline uint32_t profile_begin (void)
+{
+    return cycles_now ();
+}
+
+static __inline void profile_end (int stage, uint32_t start)
+{
+    profile_add (stage, cycles_now () - start);
+}
+
+#else
+
+static __inline uint32_t profile_begin (void) { return 0; }
+static __inline void profile_end (int stage, uint32_t start) { }
+static __inline void profile_dump (uint32_t deadline) { }
+static __inline void profile_reset (void) { }
+
+#endif
+
+#endif
@@ -0,0 +1,143 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// ring.h
+
+// This is a lock-free ring buffer of 16-bit samples for exactly one producer (e.g., an interrupt
+// handler) and one consumer (e.g., the main loop). The size must be a power of two so that the
+// head and tail can be free-running 32-bit counters; the number of samples in the ring is simply
+// head - tail (even across wrapping) and the buffer index is the counter masked by size - 1.
+// Only the producer writes the head and only the consumer writes the tail, and each publishes
+// its counter with release semantics after touching the data (and reads the other's counter
+// with acquire semantics) so that this is also safe between threads on a multicore host.
+//
+// The producer never overwrites unread data; samples that don't fit are dropped and counted as
+// overruns. A consumer that can't get all the samples it needs counts that as an underrun (once
+// per read, with ring_underrun(), however many peeks the read took).
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdint.h>
+
+#define RING_SIZE(bits) (1 << (bits))
+
+struct ring {
+    int16_t *buffer;
+    uint32_t mask;
+    volatile uint32_t head, tail;           // free-running sample counters
+    volatile uint32_t overruns, underruns;  // samples dropped, short reads
+};
+
+// On the Cortex-M4 a DMB orders the data accesses against the counter accesses (strictly it's
+// only required with multiple bus masters, but it's cheap and keeps the compiler from moving
+// things). On the host we use the compiler's atomic builtins.
+
+#if !defined (HOST_SIM) && (defined (__CC_ARM) || defined (__arm__))
+
+static __inline uint32_t ring_load_acquire (volatile uint32_t *counter)
+{
+    uint32_t value = *counter;
+    __DMB ();
+    return value;
+}
+
+static __inline void ring_store_release (volatile uint32_t *counter, uint32_t value)
+{
+    __DMB ();
+    *counter = value;
+}
+
+#else
+
+static __inline uint32_t ring_load_acquire (volatile uint32_t *counter)
+{
+    return __atomic_load_n (counter, __ATOMIC_ACQUIRE);
+}
+
+static __inline void ring_store_release (volatile uint32_t *counter, uint32_t value)
+{
+    __atomic_store_n (counter, value, __ATOMIC_RELEASE);
+}
+
+#endif
+
+// initialize a ring on the specified buffer (the size must be a power of two)
+
+static __inline void ring_init (struct ring *ring, int16_t *buffer, int size)
+{
+    ring->buffer = buffer;
+    ring->mask = size - 1;
+    ring->head = ring->tail = 0;
+    ring->overruns = ring->underruns = 0;
+}
+
+// number of samples available to the consumer (may be called from either side)
+
+static __inline int ring_count (struct ring *ring)
+{
+    return ring_load_acquire (&ring->head) - ring_load_acquire (&ring->tail);
+}
+
+// Producer: write up to num_samples into the ring and return the number actually written. Any
+// samples that don't fit are dropped (the newest ones) and added to the overrun count.
+
+static __inline int ring_write (struct ring *ring, const int16_t *samples, int num_samples)
+{
+    uint32_t head = ring->head, space = ring->mask + 1 - (head - ring_load_acquire (&ring->tail));
+    int i;
+
+    if ((uint32_t) num_samples > space) {
+        ring->overruns += num_samples - space;
+        num_samples = space;
+    }
+
+    for (i = 0; i < num_samples; ++i)
+        ring->buffer [(head + i) & ring->mask] = samples [i];
+
+    ring_store_release (&ring->head, head + num_samples);
+    return num_samples;
+}
+
+// Consumer: get a pointer to the next unread samples without copying them, and return how many
+// may be read there (at most wanted, and stopping at the end of the buffer, so the caller must
+// loop to get wrapped data, and a short count doesn't mean the ring is empty). The samples stay
+// valid until ring_advance() is called to release them to the producer.
+
+static __inline int ring_peek (struct ring *ring, int16_t **samples, int wanted)
+{
+    uint32_t tail = ring->tail, count = ring_load_acquire (&ring->head) - tail;
+    uint32_t index = tail & ring->mask;
+
+    if ((uint32_t) wanted > count)
+        wanted = count;
+
+    if (index + wanted > ring->mask + 1)
+        wanted = ring->mask + 1 - index;
+
+    *samples = ring->buffer + index;
+    return wanted;
+}
+
+static __inline void ring_advance (struct ring *ring, int num_samples)
+{
+    ring_store_release (&ring->tail, ring->tail + num_samples);
+}
+
+// Consumer: count a read that ran out of samples before it got all it needed.
+
+static __inline void ring_underrun (struct ring *ring)
+{
+    ring->underruns++;
+}
+
+#endif
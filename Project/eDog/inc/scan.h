@@ -25,6 +25,10 @@
 
 #define SCAN_KNOCK_DETECTED     0x1
 #define SCAN_BELL_DETECTED      0x2
+#define SCAN_KNOCK_PROVISIONAL  0x4     // early decision: knock pending confirmation
+#define SCAN_KNOCK_RETRACTED    0x8     // early decision: pending knock was withdrawn
+#define SCAN_ALARM_DETECTED     0x10    // smoke (T3) or CO (T4) alarm pattern
+#define SCAN_GLASS_DETECTED     0x20    // glass breaking (impact followed by high-frequency ringing)
 
 #define SCAN_HIGH_SENSITIVITY   0x1     // select higher sensitivity mode
 
@@ -39,7 +43,52 @@
 #define SCAN_OUTP_FILTER_AUDIO  0x100   // output biquad-filtered audio
 #define SCAN_OUTP_FILTER_LEVEL  0x200   // output biquad-filtered audio level (decaying average)
 
+#define SCAN_EARLY_DECISION     0x400   // report provisional knocks as soon as the third knock lands
+#define SCAN_FLOOR_THRESHOLD    0x800   // use the noise floor tracker instead of the adaptive peak threshold
+#define SCAN_DETECT_ALARM       0x1000  // enable the smoke/CO alarm pattern detector
+#define SCAN_DETECT_GLASS       0x2000  // enable the glass-break detector
+
+// Each detection (including the early-decision events) can be described by one of these records, which
+// scan_audio_detect() writes into an array supplied by the caller so that nothing is allocated while scanning.
+
+struct scan_detection {
+    int type;                   // one of the SCAN_*_DETECTED (or SCAN_KNOCK_*) bits above
+    int time;                   // sample index of the event (first knock or bell transient)
+    int span;                   // knock span, or delay from bell transient to detection (in samples)
+    float ratio;                // knock spacing ratio (1.0 is perfectly even), or glass impact high-frequency ratio
+    int min_height, max_height; // smallest and largest heights of the involved peaks (glass: final and impact levels)
+    float spurious_margin;      // how far the largest competing peak was below the rejection level (0 to 1)
+    float filter_excess;        // ratio of the bell (or alarm) filter level to its trigger level
+    int bell_id;                // which bell filter triggered
+    int pattern;                // alarm temporal pattern (3 for smoke, 4 for CO)
+    float confidence;           // overall confidence in the detection (0 to 1)
+    int latency;                // samples from the third knock to the decision (zero for bells)
+};
+
+// Running counts of peaks and detections since scan_audio_init(), plus the current time (for display)
+
+struct scan_stats {
+    int time;                   // current sample index (wraps every 24 hours)
+    int peaks;                  // peaks that exceeded the threshold (and went into the peak buffer)
+    int knocks, provisional_knocks, retracted_knocks;
+    int bells, alarms, glass_breaks;
+};
+
+// A copy of one entry in the scanner's peak buffer (see scan_get_peaks())
+
+struct scan_peak {
+    int time, height, width, filter_hits;
+    float filtered_level;
+};
+
 void scan_audio_init (void);
 int scan_audio (int16_t *in_samples, int num_samples, int16_t *out_samples, int flags);
+int scan_audio_detect (int16_t *in_samples, int num_samples, int16_t *out_samples, int flags,
+    struct scan_detection *records, int *num_records);
+void scan_thresholds (float *adaptive_threshold, float *noise_floor_threshold);
+void scan_get_stats (struct scan_stats *scan_stats);
+int scan_get_peaks (struct scan_peak *peaks, int max_peaks);
+int scan_select_bell (int id);
+int scan_bell_frequency (int id);
 
 #endif /* SCAN_H_ */
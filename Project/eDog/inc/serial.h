@@ -19,11 +19,15 @@
 #ifndef __SERIAL_H
 #define __SERIAL_H
 
+#include <stdint.h>
+
 /* Exported functions ------------------------------------------------------- */
 
 void Dbg_puts (const char *s);
 void Dbg_printf (const char *format, ...);
 void Dbg_dumpmem (char *memory, int bcount);
+int Dbg_getc (void);
+uint32_t Dbg_dropped (void);
 void Dbg_init (void);
 
 #endif /* __SERIAL_H */
@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// simboard.h
+
+// This header takes the place of main.h when the firmware modules are compiled on the host
+// with HOST_SIM defined (see simboard.c). It supplies just the parts of the STM32 peripheral
+// library, the Discovery board support and the audio codec driver that the audio loop uses.
+
+#ifndef SIMBOARD_H_
+#define SIMBOARD_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "serial.h"
+#include "waverecorder.h"
+
+typedef uint16_t u16;
+
+// Cortex-M4 byte reverse of each halfword (used for the bulk PDM byte swap)
+
+static __inline uint32_t __REV16 (uint32_t value)
+{
+    return ((value << 8) & 0xff00ff00) | ((value >> 8) & 0x00ff00ff);
+}
+
+// There are no real interrupts in the simulation, so masking them only holds off the simulated
+// PendSV (which runs WavePlayerService() when the USB recorder is enabled, see waveplayer.c).
+
+void __disable_irq (void);
+void __enable_irq (void);
+void sim_pend_sv (void);
+
+// LED controller commands (these match stm32f4xx_it.h, which can't be included on the host)
+
+#define LED_CTRL_RED_OFF       0x01
+#define LED_CTRL_RED_ON        0x02
+#define LED_CTRL_RED_TOGGLE    0x03
+
+#define LED_CTRL_ORANGE_OFF    0x04
+#define LED_CTRL_ORANGE_ON     0x08
+#define LED_CTRL_ORANGE_TOGGLE 0x0C
+
+#define LED_CTRL_GREEN_OFF     0x10
+#define LED_CTRL_GREEN_ON      0x20
+#define LED_CTRL_GREEN_TOGGLE  0x30
+
+#define LED_CTRL_BLUE_OFF      0x40
+#define LED_CTRL_BLUE_ON       0x80
+#define LED_CTRL_BLUE_TOGGLE   0xC0
+
+typedef enum {
+  LED4 = 0,
+  LED3 = 1,
+  LED5 = 2,
+  LED6 = 3
+} Led_TypeDef;
+
+void STM_EVAL_LEDInit(Led_TypeDef Led);
+void STM_EVAL_LEDOn(Led_TypeDef Led);
+void STM_EVAL_LEDOff(Led_TypeDef Led);
+void STM_EVAL_LEDToggle(Led_TypeDef Led);
+
+#define AUDIO_INTERFACE_I2S           1
+#define OUTPUT_DEVICE_AUTO            4
+#define CODEC_PDWN_SW                 2
+
+// The simulated codec DMA behaves like the driver configured in stm32f4_discovery_audio_codec.h
+// (circular mode with the half transfer interrupt) unless SIM_AUDIO_MAL_MODE_NORMAL is defined.
+
+#ifdef SIM_AUDIO_MAL_MODE_NORMAL
+#define AUDIO_MAL_MODE_NORMAL
+#else
+#define AUDIO_MAL_MODE_CIRCULAR
+#endif
+
+void EVAL_AUDIO_SetAudioInterface(uint32_t Interface);
+uint32_t EVAL_AUDIO_Init(uint16_t OutputDevice, uint8_t Volume, uint32_t AudioFreq);
+uint32_t EVAL_AUDIO_PauseResume(uint32_t Cmd);
+uint32_t EVAL_AUDIO_Stop(uint32_t CodecPowerDown_Mode);
+uint32_t EVAL_AUDIO_VolumeCtl(uint8_t Volume);
+void Audio_MAL_Play(uint32_t Addr, uint32_t Size);
+
+void EVAL_AUDIO_TransferComplete_CallBack(uint32_t pBuffer, uint32_t Size);
+void EVAL_AUDIO_HalfTransfer_CallBack(uint32_t pBuffer, uint32_t Size);
+void EVAL_AUDIO_Error_CallBack(void* pData);
+uint16_t EVAL_AUDIO_GetSampleCallBack(void);
+uint32_t Codec_TIMEOUT_UserCallback(void);
+
+// the recorder's output normally goes to WaveRecorderCallback(), but can be redirected
+
+extern void (*sim_recorder_callback) (int16_t *buffer, int num_samples);
+
+void WavePlayBack(uint32_t AudioFreq);
+int WavePlayerInit(uint32_t AudioFreq);
+void WavePlayerStop(void);
+void WavePlayerPauseResume(uint8_t state);
+uint8_t WaveplayerCtrlVolume(uint8_t volume);
+uint8_t WavePlayerVolume(void);
+void WavePlayerMicStats(uint32_t *overruns, uint32_t *underruns);
+void WavePlayerCpuLoad(uint16_t *load, uint16_t *max_load);
+void WavePlayerService(void);
+
+// The canned bark audio lives in flash on the board; in the simulation it is loaded from
+// the same binary image (bin/dog-30secs.bin) that gets flashed.
+
+extern int16_t *sim_canned_audio;
+#define CANNED_AUDIO_START sim_canned_audio
+
+// On the board the main loop sleeps (WFI) until an interrupt wakes it. In the simulation
+// this call is what advances the virtual sample clock and generates those "interrupts".
+// It also advances the virtual cycle counter (see cycles.h) to the end of the tick.
+
+void sim_wait_for_interrupt (void);
+
+#endif
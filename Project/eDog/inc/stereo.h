@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// stereo.h
+
+// Block fill functions for the stereo output buffers: silence, and the expansion of a block of
+// mono samples into stereo frames (which is how all our audio gets to the codec). The output
+// buffer must be word aligned (the ones in waveplayer.c are declared that way). On the Cortex-M4
+// two mono samples are read with one 32-bit load and packed into two frames with the PKHBT and
+// PKHTB instructions. On the host SSE2 or NEON is used when available, and otherwise each sample
+// is duplicated into a frame with a single 32-bit store, which is also the portable reference.
+
+#ifndef STEREO_H_
+#define STEREO_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if !defined (HOST_SIM) && (defined (__CC_ARM) || defined (__arm__))
+#define STEREO_EXPAND_PKH
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#define STEREO_EXPAND_SSE2
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define STEREO_EXPAND_NEON
+#endif
+
+static __inline void stereo_silence (int16_t *buffer, int num_frames)
+{
+    memset (buffer, 0, num_frames * 2 * sizeof (int16_t));
+}
+
+static __inline void stereo_expand_generic (int16_t *buffer, const int16_t *samples, int num_frames)
+{
+    uint32_t *frames = (uint32_t *) buffer;
+
+    while (num_frames--)
+        *frames++ = (uint16_t) *samples++ * 0x10001U;
+}
+
+static __inline void stereo_expand (int16_t *buffer, const int16_t *samples, int num_frames)
+{
+#if defined (STEREO_EXPAND_PKH)
+    uint32_t *frames = (uint32_t *) buffer;
+    const uint32_t *pairs;
+
+    // get the mono samples word aligned first (the M4 can do unaligned loads, but slowly)
+
+    if (((uint32_t) samples & 2) && num_frames) {
+        *frames++ = (uint16_t) *samples++ * 0x10001U;
+        num_frames--;
+    }
+
+    for (pairs = (const uint32_t *) samples; num_frames >= 2; num_frames -= 2) {
+        uint32_t pair = *pairs++;
+
+        *frames++ = __PKHBT (pair, pair, 16);
+        *frames++ = __PKHTB (pair, pair, 16);
+    }
+
+    if (num_frames)
+        *frames = (uint16_t) *(const int16_t *) pairs * 0x10001U;
+#elif defined (STEREO_EXPAND_SSE2)
+    for (; num_frames >= 8; num_frames -= 8, samples += 8, buffer += 16) {
+        __m128i mono = _mm_loadu_si128 ((const __m128i *) samples);
+
+        _mm_storeu_si128 ((__m128i *) buffer, _mm_unpacklo_epi16 (mono, mono));
+        _mm_storeu_si128 ((__m128i *) (buffer + 8), _mm_unpackhi_epi16 (mono, mono));
+    }
+
+    stereo_expand_generic (buffer, samples, num_frames);
+#elif defined (STEREO_EXPAND_NEON)
+    for (; num_frames >= 8; num_frames -= 8, samples += 8, buffer += 16) {
+        int16x8_t mono = vld1q_s16 (samples);
+        int16x8x2_t frames = { { mono, mono } };
+
+        vst2q_s16 (buffer, frames);     // interleaving store
+    }
+
+    stereo_expand_generic (buffer, samples, num_frames);
+#else
+    stereo_expand_generic (buffer, samples, num_frames);
+#endif
+}
+
+#endif
@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// usbrec.h
+
+// This module records every detection to a USB drive (through FatFs) so that false triggers can
+// be reviewed later: a line in EVENTS.TXT with the time (since power-up) and the details, and a
+// WAV clip of the microphone audio around the event (CLIPnnnn.WAV).
+//
+// Writing to a USB stick can stall for tens of milliseconds, so the audio side never touches the
+// file system. It just copies the scanned microphone audio into a history ring and queues the
+// detection records (both of which take no time and never wait), and usbrec_service() does all
+// the writing from the main loop, when there's nothing else to do. For this to work, the audio
+// processing must be able to preempt the main loop (see USB_RECORDER in waveplayer.c). If the
+// writing falls too far behind, events that don't fit in the queue and clips whose audio has been
+// overwritten in the history ring are dropped (and counted), but the audio is never held up.
+
+#ifndef USBREC_H_
+#define USBREC_H_
+
+#include <stdint.h>
+
+#include "scan.h"
+
+struct usbrec_stats {
+    int attached, mounted;          // drive is present, and file system is mounted
+    uint32_t events_logged, events_dropped;
+    uint32_t clips_written, clips_dropped;
+    uint32_t write_errors;
+};
+
+// called once at startup (this also starts the USB host on the board)
+
+void usbrec_init (void);
+
+// Called from the audio processing (the producer side): every scanned block of microphone audio,
+// and then every detection record from that block, in order.
+
+void usbrec_audio (const int16_t *samples, int num_samples);
+void usbrec_detection (const struct scan_detection *record);
+
+// Called from the main loop (the consumer side): does the next bit of writing, if any (this can
+// take a while if the drive stalls) and returns nonzero if there might be more to do right away.
+
+int usbrec_service (void);
+
+// Called when a drive is attached or detached (by the USB host callbacks, see usbh_usr.c).
+
+void usbrec_attach (int attached);
+
+void usbrec_get_stats (struct usbrec_stats *stats);
+
+#endif
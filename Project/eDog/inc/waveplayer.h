@@ -35,6 +35,10 @@ int WavePlayerInit(uint32_t AudioFreq);
 void WavePlayerStop(void);
 void WavePlayerPauseResume(uint8_t state);
 uint8_t WaveplayerCtrlVolume(uint8_t volume);
+uint8_t WavePlayerVolume(void);
+void WavePlayerMicStats(uint32_t *overruns, uint32_t *underruns);
+void WavePlayerCpuLoad(uint16_t *load, uint16_t *max_load);
+void WavePlayerService(void);
 
 #endif /* __WAVE_PLAYER_H */
 
@@ -24,12 +24,18 @@
 #define __I2S_AUDIO_H
 
 /* Includes ------------------------------------------------------------------*/
+#ifndef HOST_SIM
 #include "stm32f4xx.h"
 #include "main.h"
+#endif
 
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported Defines ----------------------------------------------------------*/
+/* PDM words (at 1.024 MHz, 16 bits each) per half of the DMA capture double
+   buffer; must be a multiple of 64 (the PDM filter block size) */
+#define AUDIO_REC_DMA_HALF_WORDS          256
+
 /* Exported constants --------------------------------------------------------*/
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
@@ -38,6 +44,9 @@ uint32_t WaveRecorderInit(uint32_t AudioFreq, uint32_t BitRes, uint32_t ChnlNbr)
 uint8_t WaveRecorderStart(uint16_t* pbuf, uint32_t size);
 uint32_t WaveRecorderStop(void);
 void WaveRecorderBeginSampling (void);
+void WaveRecorder_PutWord(uint16_t Word);
+void WaveRecorder_ProcessHalf(uint32_t *pHalf);
+void WaveRecorderCallback (int16_t *buffer, int num_samples);
 
 #endif /* __WAVE_RECORDER_H */
 
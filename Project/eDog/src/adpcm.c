@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// adpcm.c
+
+#include <string.h>
+
+#include "adpcm.h"
+
+// This is the standard IMA ADPCM decoder (the tables are shared with the adpcmenc encoder). It
+// costs a table lookup and a handful of adds and shifts per sample, so even decoding directly
+// into the stereo output buffer it's a small fraction of the fill_buffer() budget.
+
+const int16_t adpcm_step_table [89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int8_t adpcm_index_table [16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// Check that the specified memory holds a valid ADPCM image, and if so return it as such
+// (otherwise NULL). Every clip must lie entirely within the image.
+
+const struct adpcm_image *adpcm_image_check (const void *image)
+{
+    const struct adpcm_image *adpcm_image = image;
+    int i;
+
+    if (memcmp (adpcm_image->magic, ADPCM_IMAGE_MAGIC, sizeof (adpcm_image->magic)) ||
+        adpcm_image->version != ADPCM_IMAGE_VERSION || !adpcm_image->num_clips ||
+        adpcm_image->image_bytes < ADPCM_IMAGE_HEADER_BYTES + adpcm_image->num_clips * sizeof (struct adpcm_clip))
+            return NULL;
+
+    for (i = 0; i < adpcm_image->num_clips; ++i) {
+        const struct adpcm_clip *clip = adpcm_image->clips + i;
+
+        if (clip->offset > adpcm_image->image_bytes || (clip->num_samples + 1) / 2 > adpcm_image->image_bytes - clip->offset ||
+            clip->index > 88)
+                return NULL;
+    }
+
+    return adpcm_image;
+}
+
+// Initialize a stream to decode the specified clip from the beginning.
+
+void adpcm_stream_init (struct adpcm_stream *stream, const struct adpcm_image *image, int clip)
+{
+    stream->data = (const uint8_t *) image + image->clips [clip].offset;
+    stream->num_samples = image->clips [clip].num_samples;
+    stream->predictor = image->clips [clip].predictor;
+    stream->index = image->clips [clip].index;
+    stream->nibble = 0;
+}
+
+// Decode up to num_samples samples from the stream into the buffer, writing each sample the
+// specified number of times (so 2 fills stereo frames from the mono clip). Returns the number of
+// samples decoded, which is less than requested only at the end of the clip.
+
+int adpcm_decode (struct adpcm_stream *stream, int16_t *buffer, int num_samples, int copies)
+{
+    int32_t predictor = stream->predictor;
+    int index = stream->index, nibble = stream->nibble, i;
+    const uint8_t *data = stream->data;
+
+    if (num_samples > stream->num_samples)
+        num_samples = stream->num_samples;
+
+    for (i = 0; i < num_samples; ++i) {
+        int code = nibble ? *data++ >> 4 : *data & 0xf, step = adpcm_step_table [index];
+        int32_t delta = step >> 3;
+
+        if (code & 4) delta += step;
+        if (code & 2) delta += step >> 1;
+        if (code & 1) delta += step >> 2;
+
+        if (code & 8) {
+            if ((predictor -= delta) < -32768)
+                predictor = -32768;
+        }
+        else if ((predictor += delta) > 32767)
+            predictor = 32767;
+
+        if ((index += adpcm_index_table [code]) < 0)
+            index = 0;
+        else if (index > 88)
+            index = 88;
+
+        nibble ^= 1;
+
+        if (copies == 2) {
+            *buffer++ = predictor;
+            *buffer++ = predictor;
+        }
+        else {
+            int j;
+
+            for (j = 0; j < copies; ++j)
+                *buffer++ = predictor;
+        }
+    }
+
+    stream->predictor = predictor;
+    stream->index = index;
+    stream->nibble = nibble;
+    stream->data = data;
+    stream->num_samples -= num_samples;
+    return num_samples;
+}
@@ -0,0 +1,357 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// adpcmenc.c
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "adpcm.h"
+
+// This is a command-line program that builds the IMA ADPCM canned audio image (see adpcm.h) from
+// raw PCM audio (16-bit mono, 16 kHz) and a list of clips, each specified as start:count in
+// samples. If no clips are given, the default eDog clips from dog-30secs.bin are used (the same
+// ones that waveplayer.c plays from the raw PCM), and the short bark for the one-bark mode can
+// be specified with -b. Each clip is encoded with the standard IMA quantizer, starting from the
+// step size index that gives the least error for that clip. The image is then decoded with the
+// firmware's decoder (adpcm.c) to check it and to report the quality and the decoding speed.
+//
+// Build right here on Cygwin or Linux:  gcc -O2 -I../inc adpcmenc.c adpcm.c -o adpcmenc -lm
+
+#define SAMPLE_RATE 16000
+#define MAX_CLIPS 64
+#define BENCHMARK_BLOCK 64              // same as fill_buffer() (one output buffer of stereo frames)
+
+static const char *usage =
+" Usage:   adpcmenc [-options] infile.pcm outfile.bin [start:count ...]\n\n"
+" Options: -b  = next argument is the short bark clip (start:count)\n"
+"          -q  = quiet (no statistics)\n\n"
+" Without clips, the default dog-30secs.bin clips and short bark are used.\n\n";
+
+static struct { int start, count, flags; } clips [MAX_CLIPS], default_clips [] = {
+    { 3840, 78080 }, { 81920, 94080 }, { 176000, 78400 }, { 254400, 52640 },
+    { 307040, 99360 }, { 406400, 48000 }, { 68464, 8000, ADPCM_CLIP_SHORT_BARK }
+};
+
+static int num_clips;
+
+static int parse_clip (const char *arg, int flags);
+static double encode_clip (const int16_t *samples, int num_samples, uint8_t *data, int index);
+static void put_clip (uint8_t *entry, uint32_t offset, uint32_t num_samples, int16_t predictor, int index, int flags);
+
+int main (argc, argv) int argc; char **argv;
+{
+    int error_count = 0, quiet = 0, total_samples, alloc_samples = SAMPLE_RATE * 60, image_bytes, i;
+    FILE *infile = NULL, *outfile = NULL;
+    const struct adpcm_image *image;
+    int16_t *samples, *decoded;
+    uint8_t *image_data;
+    clock_t start;
+
+    // loop through command-line arguments
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+
+                    case 'B': case 'b':
+                        if (argc > 1) {
+                            error_count += parse_clip (*++argv, ADPCM_CLIP_SHORT_BARK);
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-b requires a clip (start:count) !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'Q': case 'q':
+                        quiet = 1;
+                        break;
+
+                    default:
+                        fprintf (stderr, "illegal option: %c !\n", **argv);
+                        ++error_count;
+                }
+        else if (!infile) {
+            infile = fopen (*argv, "rb");
+
+            if (!infile) {
+                fprintf (stderr, "can't open file for reading: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else if (!outfile) {
+            outfile = fopen (*argv, "wb");
+
+            if (!outfile) {
+                fprintf (stderr, "can't open file for writing: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else
+            error_count += parse_clip (*argv, 0);
+    }
+
+    // check for various command-line argument problems
+
+    if (!infile || !outfile) {
+        fputs (usage, stderr);
+        return 1;
+    }
+
+    if (error_count)
+        return 1;
+
+    if (!num_clips || (num_clips == 1 && clips [0].flags)) {
+        if (num_clips) {
+            fprintf (stderr, "a short bark needs other clips to go with it !\n");
+            return 1;
+        }
+
+        num_clips = sizeof (default_clips) / sizeof (default_clips [0]);
+        memcpy (clips, default_clips, sizeof (default_clips));
+    }
+
+    // read all the audio and check that the clips are within it
+
+    samples = malloc (alloc_samples * sizeof (int16_t));
+    total_samples = 0;
+
+    while ((i = fread (samples + total_samples, sizeof (int16_t), alloc_samples - total_samples, infile)) > 0)
+        if ((total_samples += i) == alloc_samples)
+            samples = realloc (samples, (alloc_samples *= 2) * sizeof (int16_t));
+
+    fclose (infile);
+
+    for (i = 0; i < num_clips; ++i)
+        if (clips [i].start + clips [i].count > total_samples) {
+            fprintf (stderr, "clip %d (%d:%d) extends past the end of the audio (%d samples) !\n",
+                i + 1, clips [i].start, clips [i].count, total_samples);
+            return 1;
+        }
+
+    // build the image (the clip data starts after the clip table)
+
+    image_bytes = ADPCM_IMAGE_HEADER_BYTES + num_clips * sizeof (struct adpcm_clip);
+
+    for (i = 0; i < num_clips; ++i)
+        image_bytes += ((clips [i].count + 1) / 2 + 3) & ~3;
+
+    image_data = calloc (image_bytes, 1);
+    memcpy (image_data, ADPCM_IMAGE_MAGIC, 4);
+    image_data [4] = ADPCM_IMAGE_VERSION;
+    image_data [6] = num_clips;
+    image_data [8] = SAMPLE_RATE & 0xff;
+    image_data [9] = SAMPLE_RATE >> 8;
+    image_data [12] = image_bytes;
+    image_data [13] = image_bytes >> 8;
+    image_data [14] = image_bytes >> 16;
+    image_bytes = ADPCM_IMAGE_HEADER_BYTES + num_clips * sizeof (struct adpcm_clip);
+
+    for (i = 0; i < num_clips; ++i) {
+        const int16_t *clip_samples = samples + clips [i].start;
+        int index, best_index = 0;
+        double best_error = 0.0;
+
+        // find the best starting step size (by trying them all)
+
+        for (index = 0; index <= 88; ++index) {
+            double error = encode_clip (clip_samples, clips [i].count, image_data + image_bytes, index);
+
+            if (!index || error < best_error) {
+                best_error = error;
+                best_index = index;
+            }
+        }
+
+        encode_clip (clip_samples, clips [i].count, image_data + image_bytes, best_index);
+        put_clip (image_data + ADPCM_IMAGE_HEADER_BYTES + i * sizeof (struct adpcm_clip),
+            image_bytes, clips [i].count, clip_samples [0], best_index, clips [i].flags);
+        image_bytes += ((clips [i].count + 1) / 2 + 3) & ~3;
+    }
+
+    // check the image with the real decoder and display the statistics
+
+    image = adpcm_image_check (image_data);
+
+    if (!image) {
+        fprintf (stderr, "internal error: generated image is not valid !\n");
+        return 1;
+    }
+
+    decoded = malloc (total_samples * sizeof (int16_t));
+
+    if (!quiet)
+        printf ("adpcmenc: %d clips from %d samples (%d bytes raw):\n\n", num_clips, total_samples, total_samples * 2);
+
+    for (i = 0; i < num_clips; ++i) {
+        double signal = 0.0, noise = 0.0;
+        struct adpcm_stream stream;
+        int j;
+
+        adpcm_stream_init (&stream, image, i);
+
+        if (adpcm_decode (&stream, decoded, clips [i].count, 1) != clips [i].count) {
+            fprintf (stderr, "internal error: clip %d decoded short !\n", i + 1);
+            return 1;
+        }
+
+        for (j = 0; j < clips [i].count; ++j) {
+            double sample = samples [clips [i].start + j], error = decoded [j] - sample;
+
+            signal += sample * sample;
+            noise += error * error;
+        }
+
+        if (!quiet)
+            printf ("  clip %d: %6d:%-6d %5.2f seconds, start index %2d, SNR = %.1f dB%s\n", i + 1,
+                clips [i].start, clips [i].count, clips [i].count / (double) SAMPLE_RATE, image->clips [i].index,
+                noise > 0.0 ? 10.0 * log10 (signal / noise) : 99.9, (clips [i].flags & ADPCM_CLIP_SHORT_BARK) ? " (short bark)" : "");
+    }
+
+    // time decoding all the clips, one output buffer at a time, into stereo frames
+
+    if (!quiet) {
+        int16_t buffer [BENCHMARK_BLOCK * 2];
+        int passes = 0, decoded_samples = 0;
+        double seconds;
+
+        start = clock ();
+
+        do {
+            for (i = 0; i < num_clips; ++i) {
+                struct adpcm_stream stream;
+                int count;
+
+                adpcm_stream_init (&stream, image, i);
+
+                while ((count = adpcm_decode (&stream, buffer, BENCHMARK_BLOCK, 2)) != 0)
+                    decoded_samples += count;
+            }
+
+            passes++;
+        } while ((seconds = (double) (clock () - start) / CLOCKS_PER_SEC) < 1.0);
+
+        printf ("\nadpcmenc: image is %d bytes (%.1f%% of raw), decoding takes %.2f nsecs per sample (%.0fx real time)\n",
+            image_bytes, image_bytes * 100.0 / (total_samples * 2), seconds * 1e9 / decoded_samples,
+            decoded_samples / (double) SAMPLE_RATE / seconds);
+    }
+
+    if (fwrite (image_data, 1, image_bytes, outfile) != image_bytes) {
+        fprintf (stderr, "can't write output file !\n");
+        return 1;
+    }
+
+    fclose (outfile);
+    free (decoded);
+    free (image_data);
+    free (samples);
+    return 0;
+}
+
+// parse a clip argument (start:count) into the clip table
+
+static int parse_clip (const char *arg, int flags)
+{
+    int start, count, i;
+
+    if (sscanf (arg, "%d:%d", &start, &count) != 2 || start < 0 || count <= 0) {
+        fprintf (stderr, "bad clip: %s (must be start:count) !\n", arg);
+        return 1;
+    }
+
+    if (num_clips == MAX_CLIPS) {
+        fprintf (stderr, "too many clips (max is %d) !\n", MAX_CLIPS);
+        return 1;
+    }
+
+    if (flags)
+        for (i = 0; i < num_clips; ++i)
+            if (clips [i].flags & flags) {
+                fprintf (stderr, "only one short bark is allowed !\n");
+                return 1;
+            }
+
+    clips [num_clips].start = start;
+    clips [num_clips].count = count;
+    clips [num_clips++].flags = flags;
+    return 0;
+}
+
+// Encode the samples of one clip starting with the specified step index (and the first sample
+// as the initial predictor) and return the total squared error.
+
+static double encode_clip (const int16_t *samples, int num_samples, uint8_t *data, int index)
+{
+    int32_t predictor = samples [0];
+    double error = 0.0;
+    int i;
+
+    for (i = 0; i < num_samples; ++i) {
+        int step = adpcm_step_table [index], diff = samples [i] - predictor, code = 0;
+        int32_t delta = step >> 3;
+
+        if (diff < 0) {
+            code = 8;
+            diff = -diff;
+        }
+
+        if (diff >= step) { code |= 4; diff -= step; delta += step; }
+        if (diff >= step >> 1) { code |= 2; diff -= step >> 1; delta += step >> 1; }
+        if (diff >= step >> 2) { code |= 1; delta += step >> 2; }
+
+        if (code & 8) {
+            if ((predictor -= delta) < -32768)
+                predictor = -32768;
+        }
+        else if ((predictor += delta) > 32767)
+            predictor = 32767;
+
+        if ((index += adpcm_index_table [code]) < 0)
+            index = 0;
+        else if (index > 88)
+            index = 88;
+
+        if (i & 1)
+            data [i >> 1] |= code << 4;
+        else
+            data [i >> 1] = code;
+
+        error += (double) (samples [i] - predictor) * (samples [i] - predictor);
+    }
+
+    return error;
+}
+
+// store a clip table entry (little-endian, as described in adpcm.h)
+
+static void put_clip (uint8_t *entry, uint32_t offset, uint32_t num_samples, int16_t predictor, int index, int flags)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        entry [i] = offset >> (i * 8);
+        entry [i + 4] = num_samples >> (i * 8);
+    }
+
+    entry [8] = predictor;
+    entry [9] = (uint16_t) predictor >> 8;
+    entry [10] = index;
+    entry [11] = flags;
+}
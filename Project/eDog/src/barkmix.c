@@ -0,0 +1,318 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// barkmix.c
+
+#include <string.h>
+
+#include "barkmix.h"
+
+// There are two voices. Each one pulls its clip's samples (copied from flash or decoded from
+// ADPCM) into a small buffer, and then resamples from there with linear interpolation at a
+// 16.16 fixed-point rate, which shifts the pitch and the tempo together by up to 2 semitones
+// either way (that's enough to sound like a different bark, but not like a different dog). The
+// gain is Q15 scaled up by 256 so that it can ramp smoothly, and every gain change is a ramp:
+// a short fade-in at the start of a clip (the clips start right at a bark onset, so it must be
+// short), and a 100 ms crossfade when the next clip of a session is started on the other voice
+// before the end of the current one. The voices are mixed in 32 bits and saturated to 16 bits.
+// Work is done in chunks of at most CHUNK_FRAMES so the voice buffers always have enough data.
+
+#define VOICE_BUFFER 256                // source samples buffered per voice
+#define CHUNK_FRAMES 64                 // max output frames rendered per pass
+
+#define MIN_RATE 58386                  // 0.891 (-2 semitones) in 16.16
+#define MAX_RATE 73562                  // 1.122 (+2 semitones)
+#define MIN_GAIN 16423                  // -6 dB in Q15
+#define MAX_GAIN 32767                  // 0 dB
+
+#define FADE_IN_FRAMES 32               // 2 ms
+#define XFADE_FRAMES 1600               // 100 ms
+
+struct voice {
+    const struct barkmix_clip *clip;
+    struct adpcm_stream stream;         // source for ADPCM clips
+    const int16_t *source;              // source for raw PCM clips
+    int source_remaining, padded;       // samples not yet buffered, end padding added
+    int16_t buffer [VOICE_BUFFER];
+    int buffered;
+    uint32_t position, rate;            // position in buffer and step per output frame (16.16)
+    int32_t gain, gain_step;            // Q15 << 8
+    int ramp_frames, fading_out;
+};
+
+static const struct barkmix_clip *mix_clips;
+static int mix_num_clips, last_clip = -1, chain_remaining;
+static struct voice voices [2], *current_voice;
+static uint32_t random_state = 1;
+
+static uint32_t next_random (void);
+static int choose_clip (void);
+static void start_voice (struct voice *voice, int clip, int fade_frames);
+static int voice_frames_left (struct voice *voice);
+static void fill_voice (struct voice *voice, int num_frames);
+static int render_voice (struct voice *voice, int32_t *mix, int num_frames);
+
+// Initialize the mixer with a table of clips (which must stay valid) and a random seed.
+
+void barkmix_init (const struct barkmix_clip *clips, int num_clips, uint32_t seed)
+{
+    mix_clips = clips;
+    mix_num_clips = num_clips;
+    random_state = seed ? seed : 1;
+    barkmix_stop ();
+}
+
+// Start a bark session with the specified clip (or BARKMIX_RANDOM) followed by up to "chain"
+// more randomly chosen clips (the actual number is random too). The entropy is mixed into the
+// random state so that the sequence doesn't repeat from power-up (e.g., pass a timestamp). If
+// a session is already playing, it's crossfaded into the new one.
+
+void barkmix_start (int clip, int chain, uint32_t entropy)
+{
+    struct voice *voice;
+
+    random_state ^= entropy * 2654435761U;
+
+    if (!random_state)
+        random_state = 1;
+
+    if (clip == BARKMIX_RANDOM)
+        clip = choose_clip ();
+
+    if (clip < 0 || clip >= mix_num_clips)
+        return;
+
+    chain_remaining = chain > 0 ? next_random () % (chain + 1) : 0;
+
+    if (current_voice && current_voice->clip) {
+        voice = (current_voice == voices) ? voices + 1 : voices;
+        current_voice->gain_step = -current_voice->gain / XFADE_FRAMES;
+        current_voice->ramp_frames = XFADE_FRAMES;
+        current_voice->fading_out = 1;
+        start_voice (voice, clip, XFADE_FRAMES);
+    }
+    else {
+        voice = voices;
+        start_voice (voice, clip, FADE_IN_FRAMES);
+    }
+
+    current_voice = voice;
+}
+
+// Render the specified number of stereo frames into the buffer (the mono mix is written to both
+// channels, and silence when nothing is playing). Returns TRUE if the session is still playing.
+
+int barkmix_render (int16_t *buffer, int num_frames)
+{
+    int32_t mix [CHUNK_FRAMES];
+    int i;
+
+    while (num_frames) {
+        int frames = num_frames < CHUNK_FRAMES ? num_frames : CHUNK_FRAMES;
+
+        // time to crossfade into the next clip of the session?
+
+        if (current_voice && current_voice->clip && !current_voice->fading_out && chain_remaining) {
+            int frames_left = voice_frames_left (current_voice);
+
+            if (frames_left <= XFADE_FRAMES) {
+                struct voice *next = (current_voice == voices) ? voices + 1 : voices;
+                int clip = choose_clip ();
+
+                if (clip >= 0) {
+                    current_voice->gain_step = -current_voice->gain / (frames_left ? frames_left : 1);
+                    current_voice->ramp_frames = frames_left;
+                    current_voice->fading_out = 1;
+                    start_voice (next, clip, frames_left > FADE_IN_FRAMES ? frames_left : FADE_IN_FRAMES);
+                    current_voice = next;
+                }
+
+                chain_remaining--;
+            }
+        }
+
+        memset (mix, 0, frames * sizeof (int32_t));
+
+        for (i = 0; i < 2; ++i)
+            if (voices [i].clip && !render_voice (voices + i, mix, frames))
+                voices [i].clip = NULL;
+
+        for (i = 0; i < frames; ++i) {
+            int32_t sample = mix [i] > 32767 ? 32767 : mix [i] < -32768 ? -32768 : mix [i];
+
+            *buffer++ = sample;
+            *buffer++ = sample;
+        }
+
+        num_frames -= frames;
+    }
+
+    return barkmix_active ();
+}
+
+int barkmix_active (void)
+{
+    return voices [0].clip || voices [1].clip;
+}
+
+void barkmix_stop (void)
+{
+    voices [0].clip = voices [1].clip = NULL;
+    current_voice = NULL;
+    chain_remaining = 0;
+}
+
+// xorshift32 random number generator
+
+static uint32_t next_random (void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// Choose a clip at random according to the weights, but don't repeat the last one (unless it's
+// the only one with any weight). Returns -1 if no clips have weight.
+
+static int choose_clip (void)
+{
+    int total = 0, pick, i;
+
+    for (i = 0; i < mix_num_clips; ++i)
+        if (i != last_clip)
+            total += mix_clips [i].weight;
+
+    if (!total)
+        return (last_clip >= 0 && mix_clips [last_clip].weight) ? last_clip : -1;
+
+    pick = next_random () % total;
+
+    for (i = 0; i < mix_num_clips; ++i)
+        if (i != last_clip && (pick -= mix_clips [i].weight) < 0)
+            break;
+
+    return i;
+}
+
+// Start a clip on a voice with a random rate and gain, fading in over the specified frames.
+
+static void start_voice (struct voice *voice, int clip, int fade_frames)
+{
+    int32_t gain = (MIN_GAIN + next_random () % (MAX_GAIN - MIN_GAIN + 1)) << 8;
+
+    voice->clip = mix_clips + clip;
+    voice->source = voice->clip->samples;
+
+    if (!voice->source)
+        adpcm_stream_init (&voice->stream, voice->clip->image, voice->clip->adpcm_clip);
+
+    voice->source_remaining = voice->clip->num_samples;
+    voice->buffered = voice->padded = 0;
+    voice->position = 0;
+    voice->rate = MIN_RATE + next_random () % (MAX_RATE - MIN_RATE + 1);
+    voice->gain = 0;
+    voice->gain_step = gain / fade_frames;
+    voice->ramp_frames = fade_frames;
+    voice->fading_out = 0;
+    last_clip = clip;
+}
+
+// number of output frames left in the clip playing on a voice
+
+static int voice_frames_left (struct voice *voice)
+{
+    uint32_t samples_left = voice->source_remaining + voice->buffered - (voice->position >> 16);
+
+    return (int) (((uint64_t) samples_left << 16) / voice->rate);
+}
+
+// Make sure the voice buffer has all the source samples that the next num_frames output frames
+// will need (plus one more for the interpolation). At the end of the clip a zero is added so
+// that the last sample can be interpolated into.
+
+static void fill_voice (struct voice *voice, int num_frames)
+{
+    int needed = ((voice->position + voice->rate * num_frames) >> 16) + 2, consumed, count;
+
+    if (needed <= voice->buffered || voice->padded)
+        return;
+
+    consumed = voice->position >> 16;
+
+    if (consumed) {
+        memmove (voice->buffer, voice->buffer + consumed, (voice->buffered - consumed) * sizeof (int16_t));
+        voice->buffered -= consumed;
+        voice->position &= 0xffff;
+    }
+
+    count = VOICE_BUFFER - voice->buffered;
+
+    if (count > voice->source_remaining)
+        count = voice->source_remaining;
+
+    if (voice->source) {
+        memcpy (voice->buffer + voice->buffered, voice->source, count * sizeof (int16_t));
+        voice->source += count;
+    }
+    else
+        count = adpcm_decode (&voice->stream, voice->buffer + voice->buffered, count, 1);
+
+    voice->buffered += count;
+    voice->source_remaining -= count;
+
+    if (!voice->source_remaining && voice->buffered < VOICE_BUFFER) {
+        voice->buffer [voice->buffered++] = 0;
+        voice->padded = 1;
+    }
+}
+
+// Resample a voice with linear interpolation and add it into the mix, applying the gain ramp.
+// Returns FALSE once the voice has finished (its clip has run out or it has faded out).
+
+static int render_voice (struct voice *voice, int32_t *mix, int num_frames)
+{
+    uint32_t position, rate = voice->rate;
+    int32_t gain, gain_step;
+    int ramp_frames, i;
+
+    fill_voice (voice, num_frames);
+    position = voice->position;
+    gain = voice->gain;
+    gain_step = voice->gain_step;
+    ramp_frames = voice->ramp_frames;
+
+    for (i = 0; i < num_frames; ++i) {
+        int index = position >> 16;
+        int32_t sample;
+
+        if (index + 1 >= voice->buffered)
+            return 0;
+
+        sample = voice->buffer [index];
+        sample += ((voice->buffer [index + 1] - sample) * (int32_t) ((position & 0xffff) >> 1)) >> 15;
+        mix [i] += (sample * (gain >> 8)) >> 15;
+        position += rate;
+
+        if (ramp_frames) {
+            gain += gain_step;
+
+            if (!--ramp_frames && voice->fading_out)
+                return 0;
+        }
+    }
+
+    voice->position = position;
+    voice->gain = gain;
+    voice->ramp_frames = ramp_frames;
+    return 1;
+}
@@ -0,0 +1,309 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// console.c
+
+// This is the debug console (see console.h). The received characters are taken from the serial
+// receive ring in the main loop, echoed, and collected into a line (with backspace handling), and
+// when the line is complete it's split into words and the first one is looked up in the command
+// table. To keep this from ever holding up the audio, console_poll() executes at most one command
+// per call (anything typed after it just waits in the ring), and all the output goes through the
+// debug port's transmit buffer, which drops whole messages rather than waiting if it fills.
+
+#ifdef HOST_SIM
+#include <simboard.h>
+#else
+#include <main.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "console.h"
+#include "profile.h"
+#include "scan.h"
+
+#ifdef USB_RECORDER
+#include "usbrec.h"
+#endif
+
+#define MAX_LINE_CHARS 64
+#define MAX_WORDS 4
+#define MAX_DUMP_PEAKS 16
+#define SAMPLING_RATE 16000
+
+extern volatile int user_mode;
+
+static char line [MAX_LINE_CHARS];
+static int line_length;
+static uint32_t deadline;
+
+static void cmd_help (int argc, char **argv);
+static void cmd_stats (int argc, char **argv);
+static void cmd_peaks (int argc, char **argv);
+static void cmd_sens (int argc, char **argv);
+static void cmd_bell (int argc, char **argv);
+static void cmd_vol (int argc, char **argv);
+static void cmd_prof (int argc, char **argv);
+
+static const struct command {
+    const char *name, *args, *help;
+    void (*handler) (int argc, char **argv);
+} commands [] = {
+    { "help",  "",             "list the commands", cmd_help },
+    { "stats", "",             "display the scanner counts, thresholds and system status", cmd_stats },
+    { "peaks", "",             "display the scanner's peak buffer", cmd_peaks },
+    { "sens",  "[low|high]",   "display or set the detection sensitivity", cmd_sens },
+    { "bell",  "[n]",          "list the bells or select the one that rings", cmd_bell },
+    { "vol",   "[0-100]",      "display or set the output volume", cmd_vol },
+    { "prof",  "[reset]",      "display (or reset) the execution time profile", cmd_prof },
+    { NULL, NULL, NULL, NULL }
+};
+
+static void execute_line (void);
+static void time_format (int time_in_samples, char *string);
+static int parse_number (const char *arg, int *value);
+
+// The deadline (in cycles) is the time it takes to play one output buffer, which is what the
+// execution time profile is compared against.
+
+void console_init (uint32_t profile_deadline)
+{
+    deadline = profile_deadline;
+    line_length = 0;
+}
+
+// Called from the main loop to handle the characters received since the last call. Control
+// characters other than backspace and the line endings are ignored, as are characters that
+// don't fit on the line.
+
+void console_poll (void)
+{
+    int c;
+
+    while ((c = Dbg_getc ()) != -1) {
+        char echo [2];
+
+        if (c == '\r' || c == '\n') {
+            if (line_length) {
+                Dbg_puts ("\n");
+                line [line_length] = 0;
+                execute_line ();
+                line_length = 0;
+                return;
+            }
+
+            continue;
+        }
+
+        if (c == '\b' || c == 0x7f) {
+            if (line_length) {
+                line_length--;
+                Dbg_puts ("\b \b");
+            }
+
+            continue;
+        }
+
+        if (c < ' ' || c > '~' || line_length == MAX_LINE_CHARS - 1)
+            continue;
+
+        line [line_length++] = echo [0] = c;
+        echo [1] = 0;
+        Dbg_puts (echo);
+    }
+}
+
+// Split the line into words (in place) and run the command named by the first one.
+
+static void execute_line (void)
+{
+    char *argv [MAX_WORDS], *cp = line;
+    const struct command *cmd;
+    int argc = 0;
+
+    while (argc < MAX_WORDS) {
+        while (*cp == ' ')
+            *cp++ = 0;
+
+        if (!*cp)
+            break;
+
+        argv [argc++] = cp;
+
+        while (*cp && *cp != ' ')
+            cp++;
+    }
+
+    if (!argc)
+        return;
+
+    for (cmd = commands; cmd->name; ++cmd)
+        if (!strcmp (argv [0], cmd->name)) {
+            cmd->handler (argc, argv);
+            return;
+        }
+
+    Dbg_printf ("unknown command: %s (type \"help\" for the list)\n", argv [0]);
+}
+
+static void cmd_help (int argc, char **argv)
+{
+    const struct command *cmd;
+
+    for (cmd = commands; cmd->name; ++cmd)
+        Dbg_printf ("  %-5s %-12s %s\n", cmd->name, cmd->args, cmd->help);
+}
+
+static void cmd_stats (int argc, char **argv)
+{
+    float adaptive_threshold, floor_threshold;
+    uint32_t overruns, underruns;
+    uint16_t load, max_load;
+    struct scan_stats stats;
+    char time_string [32];
+
+    scan_get_stats (&stats);
+    scan_thresholds (&adaptive_threshold, &floor_threshold);
+    WavePlayerMicStats (&overruns, &underruns);
+    WavePlayerCpuLoad (&load, &max_load);
+    time_format (stats.time, time_string);
+
+    Dbg_printf ("time = %s, peaks = %d, thresholds = %.2f adaptive, %.2f noise floor\n",
+        time_string, stats.peaks, adaptive_threshold, floor_threshold);
+    Dbg_printf ("knocks = %d (%d provisional, %d retracted), bells = %d, alarms = %d, glass breaks = %d\n",
+        stats.knocks, stats.provisional_knocks, stats.retracted_knocks, stats.bells, stats.alarms, stats.glass_breaks);
+    Dbg_printf ("sensitivity = %s, bell = %d Hz, volume = %d, user mode = %d\n",
+        (user_mode & 2) ? "high" : "low", scan_bell_frequency (-1), WavePlayerVolume (), user_mode);
+    Dbg_printf ("cpu load = %u.%u%% (peak %u.%u%%), mic ring = %u overruns, %u underruns, debug log = %u dropped\n",
+        load / 10, load % 10, max_load / 10, max_load % 10, overruns, underruns, Dbg_dropped ());
+
+#ifdef USB_RECORDER
+    {
+        struct usbrec_stats usb;
+
+        usbrec_get_stats (&usb);
+        Dbg_printf ("usb drive = %s, events = %u logged, %u dropped\n",
+            usb.mounted ? "mounted" : usb.attached ? "attached" : "none", usb.events_logged, usb.events_dropped);
+        Dbg_printf ("usb clips = %u written, %u dropped, write errors = %u\n",
+            usb.clips_written, usb.clips_dropped, usb.write_errors);
+    }
+#endif
+}
+
+static void cmd_peaks (int argc, char **argv)
+{
+    struct scan_peak peaks [MAX_DUMP_PEAKS];
+    int num_peaks = scan_get_peaks (peaks, MAX_DUMP_PEAKS), i;
+
+    Dbg_printf ("%d peaks in buffer\n", num_peaks);
+
+    for (i = 0; i < num_peaks; ++i) {
+        char time_string [32];
+
+        time_format (peaks [i].time, time_string);
+        Dbg_printf ("  %2d: time = %s, height = %d, width = %d, filtered level = %.2f, filter hits = %d\n",
+            i, time_string, peaks [i].height, peaks [i].width, peaks [i].filtered_level, peaks [i].filter_hits);
+    }
+}
+
+// The sensitivity is bit 1 of the user mode (which the user button also changes, and which
+// the LED toggling frequency follows), so it's changed with the interrupts disabled.
+
+static void cmd_sens (int argc, char **argv)
+{
+    if (argc > 1) {
+        if (strcmp (argv [1], "low") && strcmp (argv [1], "high")) {
+            Dbg_puts ("usage: sens [low|high]\n");
+            return;
+        }
+
+        __disable_irq ();
+
+        if (argv [1][0] == 'h')
+            user_mode |= 2;
+        else
+            user_mode &= ~2;
+
+        __enable_irq ();
+    }
+
+    Dbg_printf ("sensitivity = %s\n", (user_mode & 2) ? "high" : "low");
+}
+
+static void cmd_bell (int argc, char **argv)
+{
+    int bell, i;
+
+    if (argc > 1 && (!parse_number (argv [1], &bell) || !scan_select_bell (bell))) {
+        Dbg_printf ("no such bell: %s\n", argv [1]);
+        argc = 1;
+    }
+
+    if (argc == 1)
+        for (i = 0; scan_bell_frequency (i); ++i)
+            Dbg_printf ("  %d: %d Hz\n", i, scan_bell_frequency (i));
+
+    Dbg_printf ("bell = %d Hz\n", scan_bell_frequency (-1));
+}
+
+static void cmd_vol (int argc, char **argv)
+{
+    if (argc > 1) {
+        int vol;
+
+        if (!parse_number (argv [1], &vol) || vol < 0 || vol > 100) {
+            Dbg_puts ("usage: vol [0-100]\n");
+            return;
+        }
+
+        WaveplayerCtrlVolume (vol);
+    }
+
+    Dbg_printf ("volume = %d\n", WavePlayerVolume ());
+}
+
+static void cmd_prof (int argc, char **argv)
+{
+    if (argc > 1 && !strcmp (argv [1], "reset")) {
+        profile_reset ();
+        Dbg_puts ("profile: reset\n");
+    }
+    else
+        profile_dump (deadline);
+}
+
+// Format a time in samples as hh:mm:ss.sss (like the scanner's log messages).
+
+static void time_format (int time_in_samples, char *string)
+{
+    int hours = time_in_samples / (SAMPLING_RATE * 3600);
+    int minutes = (time_in_samples / (SAMPLING_RATE * 60)) - (hours * 60);
+    float seconds = (time_in_samples % (SAMPLING_RATE * 60)) / (float) SAMPLING_RATE;
+
+    sprintf (string, "%02d:%02d:%06.3f", hours, minutes, seconds);
+}
+
+// Parse a whole decimal number argument into *value. Returns zero (and leaves *value alone) if
+// there's anything else in it, or nothing at all (atoi() would quietly give zero for those).
+
+static int parse_number (const char *arg, int *value)
+{
+    char *end;
+    long number = strtol (arg, &end, 10);
+
+    if (end == arg || *end)
+        return 0;
+
+    *value = (int) number;
+    return 1;
+}
@@ -0,0 +1,247 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// diskcache.c
+
+// This is the write-back sector cache between FatFs and the disk driver (see diskcache.h). Each
+// line holds one sector and they're grouped into sets by the low bits of the sector number, so
+// a run of adjacent sectors is spread over all the sets. When a dirty sector has to be written,
+// the dirty sectors on either side of it are gathered into the staging buffer and written with
+// it in a single command.
+
+#include <string.h>
+
+#include "diskcache.h"
+
+struct line {
+    DWORD sector, last_used;
+    BYTE valid, dirty;
+};
+
+// the sector data is kept in words because the disk functions might need aligned buffers
+
+static struct line lines [DISKCACHE_SETS] [DISKCACHE_WAYS];
+static DWORD line_data [DISKCACHE_SETS] [DISKCACHE_WAYS] [DISKCACHE_SECTOR_SIZE / 4];
+static DWORD staging [DISKCACHE_MAX_RUN] [DISKCACHE_SECTOR_SIZE / 4];
+static DWORD use_count;
+static int enabled = 1, bypass = 1;
+
+#define LINE_DATA(l) ((BYTE *) line_data [0] [0] + ((l) - lines [0]) * DISKCACHE_SECTOR_SIZE)
+
+static struct line *find_line (DWORD sector);
+static struct line *get_line (DWORD sector);
+static DRESULT write_run (struct line *line);
+static DRESULT flush (void);
+
+DSTATUS diskcache_initialize (BYTE drv)
+{
+    DSTATUS status = disk_initialize (drv);
+    WORD sector_size = 0;
+
+    if (drv)
+        return status;
+
+    // it might be a different drive now, so anything cached (even if dirty) is gone
+
+    memset (lines, 0, sizeof (lines));
+
+    bypass = (status & STA_NOINIT) || disk_ioctl (drv, GET_SECTOR_SIZE, &sector_size) != RES_OK ||
+        sector_size != DISKCACHE_SECTOR_SIZE;
+
+    return status;
+}
+
+DSTATUS diskcache_status (BYTE drv)
+{
+    return disk_status (drv);
+}
+
+DRESULT diskcache_read (BYTE drv, BYTE *buff, DWORD sector, BYTE count)
+{
+    struct line *line;
+    DRESULT result;
+    int i;
+
+    if (drv || bypass || !enabled)
+        return disk_read (drv, buff, sector, count);
+
+    if (count == 1) {
+        if (!(line = find_line (sector))) {
+            if (!(line = get_line (sector)))
+                return RES_ERROR;
+
+            if ((result = disk_read (drv, LINE_DATA (line), sector, 1)) != RES_OK)
+                return result;
+
+            line->sector = sector;
+            line->valid = 1;
+        }
+
+        memcpy (buff, LINE_DATA (line), DISKCACHE_SECTOR_SIZE);
+        line->last_used = ++use_count;
+        return RES_OK;
+    }
+
+    // a multiple sector read goes to the drive, but the cache might have newer data for some
+
+    if ((result = disk_read (drv, buff, sector, count)) != RES_OK)
+        return result;
+
+    for (i = 0, line = lines [0]; i < DISKCACHE_SETS * DISKCACHE_WAYS; ++i, ++line)
+        if (line->valid && line->dirty && line->sector - sector < count)
+            memcpy (buff + (line->sector - sector) * DISKCACHE_SECTOR_SIZE, LINE_DATA (line), DISKCACHE_SECTOR_SIZE);
+
+    return RES_OK;
+}
+
+DRESULT diskcache_write (BYTE drv, const BYTE *buff, DWORD sector, BYTE count)
+{
+    struct line *line;
+    int i;
+
+    if (drv || bypass || !enabled)
+        return disk_write (drv, buff, sector, count);
+
+    // writes shorter than a full run are cached (to be combined with whatever comes next)
+
+    if (count < DISKCACHE_MAX_RUN) {
+        for (i = 0; i < count; ++i, ++sector, buff += DISKCACHE_SECTOR_SIZE) {
+            if (!(line = find_line (sector)) && !(line = get_line (sector)))
+                return RES_ERROR;
+
+            memcpy (LINE_DATA (line), buff, DISKCACHE_SECTOR_SIZE);
+            line->sector = sector;
+            line->valid = line->dirty = 1;
+            line->last_used = ++use_count;
+        }
+
+        return RES_OK;
+    }
+
+    // a long write goes to the drive, and replaces anything cached for those sectors
+
+    for (i = 0, line = lines [0]; i < DISKCACHE_SETS * DISKCACHE_WAYS; ++i, ++line)
+        if (line->valid && line->sector - sector < count)
+            line->valid = line->dirty = 0;
+
+    return disk_write (drv, buff, sector, count);
+}
+
+DRESULT diskcache_ioctl (BYTE drv, BYTE ctrl, void *buff)
+{
+    if (!drv && ctrl == CTRL_SYNC) {
+        DRESULT result = flush ();
+
+        if (result != RES_OK)
+            return result;
+    }
+
+    return disk_ioctl (drv, ctrl, buff);
+}
+
+void diskcache_enable (int enable)
+{
+    if (!enable)
+        flush ();
+
+    enabled = enable;
+}
+
+static struct line *find_line (DWORD sector)
+{
+    struct line *line = lines [sector % DISKCACHE_SETS];
+    int i;
+
+    for (i = 0; i < DISKCACHE_WAYS; ++i, ++line)
+        if (line->valid && line->sector == sector)
+            return line;
+
+    return NULL;
+}
+
+// Get a line for the sector (which isn't cached), an empty one if there is one in its set, or
+// else the least recently used one (writing it first if it's dirty). Returns NULL on a write
+// error (the line's data is lost, but it's still freed so the next call will work).
+
+static struct line *get_line (DWORD sector)
+{
+    struct line *line = lines [sector % DISKCACHE_SETS], *victim = line;
+    int i;
+
+    for (i = 0; i < DISKCACHE_WAYS; ++i, ++line)
+        if (!line->valid) {
+            victim = line;
+            break;
+        }
+        else if (line->last_used < victim->last_used)
+            victim = line;
+
+    if (victim->valid && victim->dirty && write_run (victim) != RES_OK)
+        return NULL;
+
+    victim->valid = 0;
+    return victim;
+}
+
+// Write the dirty sector in the line, along with any adjacent dirty sectors (up to a total of
+// DISKCACHE_MAX_RUN, so going back no further than that). All of them are clean afterward, even
+// if the write failed (there's no point trying again).
+
+static DRESULT write_run (struct line *line)
+{
+    struct line *run [DISKCACHE_MAX_RUN], *other;
+    DWORD first = line->sector;
+    DRESULT result;
+    int count, i;
+
+    while (line->sector - first < DISKCACHE_MAX_RUN - 1 && (other = find_line (first - 1)) && other->dirty)
+        first--;
+
+    for (count = 0; count < DISKCACHE_MAX_RUN && (other = find_line (first + count)) && other->dirty; ++count)
+        run [count] = other;
+
+    if (count == 1)
+        result = disk_write (0, LINE_DATA (run [0]), first, 1);
+    else {
+        for (i = 0; i < count; ++i)
+            memcpy (staging [i], LINE_DATA (run [i]), DISKCACHE_SECTOR_SIZE);
+
+        result = disk_write (0, (BYTE *) staging, first, count);
+    }
+
+    for (i = 0; i < count; ++i)
+        run [i]->dirty = 0;
+
+    return result;
+}
+
+// Write all the dirty sectors, lowest first (so each run is written whole).
+
+static DRESULT flush (void)
+{
+    DRESULT result = RES_OK;
+
+    while (1) {
+        struct line *line = lines [0], *lowest = NULL;
+        int i;
+
+        for (i = 0; i < DISKCACHE_SETS * DISKCACHE_WAYS; ++i, ++line)
+            if (line->valid && line->dirty && (!lowest || line->sector < lowest->sector))
+                lowest = line;
+
+        if (!lowest)
+            return result;
+
+        if (write_run (lowest) != RES_OK)
+            result = RES_ERROR;
+    }
+}
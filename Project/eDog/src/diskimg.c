@@ -0,0 +1,192 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// diskimg.c
+
+// This is the FatFs disk driver over an image file (see diskimg.h). It's only built on the host
+// (on the board the USB host's MSC class provides the disk functions, in usbh_msc_fatfs.c).
+// Images can be bigger than 2 GB (to hold a day of recording), so the file offsets are 64-bit
+// and new images are created sparse (just the last sector is written).
+
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "diskimg.h"
+#include "diskio.h"
+
+static FILE *image;
+static uint32_t image_sectors, command_latency, sector_latency;
+static void (*latency_wait) (uint32_t usecs);
+static struct diskimg_stats stats;
+
+static void command_done (int sectors);
+
+int diskimg_open (const char *filename, uint32_t new_sectors)
+{
+    diskimg_close ();
+
+    if (new_sectors) {
+        char zeros [DISKIMG_SECTOR_SIZE];
+
+        if (!(image = fopen (filename, "w+b")))
+            return 0;
+
+        memset (zeros, 0, sizeof (zeros));
+
+        if (fseeko (image, (off_t) (new_sectors - 1) * DISKIMG_SECTOR_SIZE, SEEK_SET) ||
+            fwrite (zeros, DISKIMG_SECTOR_SIZE, 1, image) != 1) {
+                diskimg_close ();
+                return 0;
+        }
+
+        image_sectors = new_sectors;
+    }
+    else {
+        if (!(image = fopen (filename, "r+b")))
+            return 0;
+
+        fseeko (image, 0, SEEK_END);
+        image_sectors = ftello (image) / DISKIMG_SECTOR_SIZE;
+    }
+
+    return 1;
+}
+
+void diskimg_close (void)
+{
+    if (image) {
+        fclose (image);
+        image = NULL;
+    }
+}
+
+// If no wait function is given, the latency is just accumulated in the stats.
+
+void diskimg_set_latency (uint32_t command_usecs, uint32_t sector_usecs, void (*wait) (uint32_t usecs))
+{
+    command_latency = command_usecs;
+    sector_latency = sector_usecs;
+    latency_wait = wait;
+}
+
+void diskimg_get_stats (struct diskimg_stats *s)
+{
+    *s = stats;
+}
+
+void diskimg_reset_stats (void)
+{
+    memset (&stats, 0, sizeof (stats));
+}
+
+DSTATUS disk_initialize (BYTE drv)
+{
+    return disk_status (drv);
+}
+
+DSTATUS disk_status (BYTE drv)
+{
+    return (drv || !image) ? STA_NOINIT | STA_NODISK : 0;
+}
+
+DRESULT disk_read (BYTE drv, BYTE *buff, DWORD sector, BYTE count)
+{
+    if (drv || !image)
+        return RES_NOTRDY;
+
+    if (!count || sector + count > image_sectors)
+        return RES_PARERR;
+
+    if (fseeko (image, (off_t) sector * DISKIMG_SECTOR_SIZE, SEEK_SET) ||
+        fread (buff, DISKIMG_SECTOR_SIZE, count, image) != count)
+            return RES_ERROR;
+
+    stats.sectors_read += count;
+    stats.reads++;
+    command_done (count);
+    return RES_OK;
+}
+
+DRESULT disk_write (BYTE drv, const BYTE *buff, DWORD sector, BYTE count)
+{
+    if (drv || !image)
+        return RES_NOTRDY;
+
+    if (!count || sector + count > image_sectors)
+        return RES_PARERR;
+
+    if (fseeko (image, (off_t) sector * DISKIMG_SECTOR_SIZE, SEEK_SET) ||
+        fwrite (buff, DISKIMG_SECTOR_SIZE, count, image) != count)
+            return RES_ERROR;
+
+    stats.sectors_written += count;
+    stats.writes++;
+    command_done (count);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl (BYTE drv, BYTE ctrl, void *buff)
+{
+    if (drv || !image)
+        return RES_NOTRDY;
+
+    switch (ctrl) {
+        case CTRL_SYNC:
+            fflush (image);
+            stats.syncs++;
+            command_done (0);
+            return RES_OK;
+
+        case GET_SECTOR_COUNT:
+            *(DWORD *) buff = image_sectors;
+            return RES_OK;
+
+        case GET_SECTOR_SIZE:
+            *(WORD *) buff = DISKIMG_SECTOR_SIZE;
+            return RES_OK;
+
+        case GET_BLOCK_SIZE:
+            *(DWORD *) buff = 1;
+            return RES_OK;
+
+        default:
+            return RES_PARERR;
+    }
+}
+
+// The file timestamps are the host's local time.
+
+DWORD get_fattime (void)
+{
+    time_t now = time (NULL);
+    struct tm *tm = localtime (&now);
+
+    return ((DWORD) (tm->tm_year - 80) << 25) | ((DWORD) (tm->tm_mon + 1) << 21) | ((DWORD) tm->tm_mday << 16) |
+        ((DWORD) tm->tm_hour << 11) | ((DWORD) tm->tm_min << 5) | ((DWORD) tm->tm_sec >> 1);
+}
+
+static void command_done (int sectors)
+{
+    uint32_t latency = command_latency + sector_latency * sectors;
+
+    if (!latency)
+        return;
+
+    stats.latency_usecs += latency;
+
+    if (latency_wait)
+        latency_wait (latency);
+}
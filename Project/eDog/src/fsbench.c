@@ -0,0 +1,905 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// fsbench.c
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "diskcache.h"
+#include "diskimg.h"
+#include "ff.h"
+
+#if !_USE_DISKCACHE
+#error "FatFs must be built with the sector cache (-D_USE_DISKCACHE=1, see below)"
+#endif
+
+// This is a benchmark for FatFs (and a little utility for disk images) that runs on the host over
+// the image file driver in diskimg.c. It measures the writing patterns of the USB recorder (see
+// usbrec.c) at various write sizes:
+//
+// 1. streaming a large file (the throughput, and how many disk commands that takes)
+// 2. appending short lines to a log file with f_sync() after every line (or every few lines)
+// 3. writing many short WAV clips (a 44-byte header and then fixed size chunks)
+//
+// With -r it instead builds a long recording (a day, say, with an event clip every 10 minutes
+// breaking it into fragments) and times jumping to random event times in it and reading a second
+// of audio, first with the normal f_lseek() (which follows the FAT chain from the start, or from
+// the current cluster if it's ahead) and then with the cluster link map table (fast seek), which
+// is built once when the file is opened and then finds any cluster without reading the FAT. The
+// recording is grown with f_lseek() so the image only needs room for it (use -n 3000 for a day).
+//
+// With -t it instead runs several writer threads at once (FatFs is built reentrant, with a pthread
+// mutex per volume, see option/syncobj.c), each writing its own files with its own write size
+// (the smallest ones like a log, with f_sync() after every write). The same work is first done
+// by a single thread for comparison. Then the volume is checked: the data in every file, no
+// cluster used twice, every cluster chain the right length for its file, and all the clusters
+// accounted for (used plus free).
+//
+// FatFs goes through the write-back sector cache in diskcache.c, and -b turns that off so the
+// difference can be seen.
+//
+// The streaming and the clips are done twice, first growing the file as it's written, and then
+// with the whole file allocated up front as one contiguous block with f_expand(), which lets
+// f_write() send sector-aligned writes straight to the disk without touching the FAT (for the
+// clips, the first chunk is shortened by the header size so that the rest are sector-aligned).
+//
+// For each one it reports the time (the host time plus any injected disk latency, which is what
+// would dominate on a real USB drive), the disk commands, and the sectors written beyond the file
+// data itself, which is the FAT, directory and partial sector overhead. The same image can be
+// loop mounted on Linux, or used with simboard -u (which records to it), and then -d lists the
+// files on it and -x copies one out.
+//
+// Build right here on Cygwin or Linux:
+//
+//   gcc -O2 -pthread -D_USE_DISKCACHE=1 -I../inc -I../../../Utilities/Third_Party/fat_fs/inc
+//       fsbench.c diskimg.c diskcache.c ../../../Utilities/Third_Party/fat_fs/src/ff.c
+//       ../../../Utilities/Third_Party/fat_fs/src/option/syncobj.c -o fsbench
+
+#define DEFAULT_IMAGE_MBYTES 64
+
+#define STREAM_BYTES (4 * 1024 * 1024)
+#define LOG_LINES 1000
+#define CLIP_FILES 40
+#define CLIP_HEADER_BYTES 44
+#define CLIP_DATA_BYTES 80000                   // 2.5 seconds of 16 kHz mono
+#define CLIP_SECONDS 2.5
+
+#define RECORDING_BYTES_PER_SECOND 32000        // 16 kHz mono
+#define RECORDING_CLIP_MINUTES 10               // a clip is written this often (fragmenting the recording)
+#define SEEK_EVENTS 100
+#define LINK_MAP_ITEMS 4096
+
+#define MAX_WRITERS 16
+#define WRITER_FILES 8                          // files written by each writer
+#define WRITER_FILE_BYTES 200000
+#define WRITER_MAX_SIZE 30000
+
+static const char *usage =
+" Usage:   fsbench [-options] image.img\n\n"
+" Options: -n  = create and format a new image (next argument is its size in MB, default 64 with -n-)\n"
+"          -a  = next argument is the cluster size in bytes for -n (default is automatic)\n"
+"          -c  = next argument is the injected latency per disk command in usecs (default 0)\n"
+"          -s  = next argument is the injected latency per sector in usecs (default 0)\n"
+"          -b  = bypass the write-back sector cache\n"
+"          -r  = seek in a recording of the next argument hours (rather than write tests)\n"
+"          -t  = run the next argument number of writer threads at once (rather than write tests)\n"
+"          -d  = list the files on the image (rather than benchmarking)\n"
+"          -x  = next argument is a file on the image to copy to the current directory\n\n";
+
+static const int stream_sizes [] = { 16, 64, 256, 512, 1024, 4096, 16384, 65536, 0 };
+static const int log_sync_intervals [] = { 1, 8, 64, 0 };
+static const int clip_chunk_sizes [] = { 256, 1024, 4096, 0 };
+static const int writer_sizes [] = { 110, 1024, 4096, WRITER_MAX_SIZE };      // by writer number (mod 4)
+
+static uint8_t write_buffer [65536];
+static DWORD link_map [LINK_MAP_ITEMS];
+static FATFS fatfs;
+
+static void stream_test (int preallocate);
+static void log_test (void);
+static void clip_test (int preallocate);
+static void recording_test (int hours);
+static void seek_test (int minutes, int fast_seek);
+static void writers_test (int writers);
+static void *writer_thread (void *arg);
+static int check_volume (int writers);
+static int list_files (void);
+static int extract_file (const char *filename);
+static void start_test (void);
+static double end_test (struct diskimg_stats *stats);
+static double host_usecs (void);
+
+int main (argc, argv) int argc; char **argv;
+{
+    int error_count = 0, list = 0, bypass_cache = 0, new_mbytes = 0, cluster_bytes = 0, command_usecs = 0, sector_usecs = 0, hours = 0, writers = 0;
+    const char *image_filename = NULL, *extract_filename = NULL;
+
+    // loop through command-line arguments
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+
+                    case 'N': case 'n':
+                        if ((*argv)[1] == '-') {
+                            new_mbytes = DEFAULT_IMAGE_MBYTES;
+                            ++*argv;
+                        }
+                        else if (argc > 1) {
+                            new_mbytes = atoi (*++argv);
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-n requires the image size !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'A': case 'a':
+                        if (argc > 1) {
+                            cluster_bytes = atoi (*++argv);
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-a requires the cluster size !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'C': case 'c':
+                        if (argc > 1) {
+                            command_usecs = atoi (*++argv);
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-c requires the latency !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'S': case 's':
+                        if (argc > 1) {
+                            sector_usecs = atoi (*++argv);
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-s requires the latency !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'R': case 'r':
+                        if (argc > 1) {
+                            hours = atoi (*++argv);
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-r requires the recording length !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'T': case 't':
+                        if (argc > 1) {
+                            writers = atoi (*++argv);
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-t requires the number of threads !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'B': case 'b':
+                        bypass_cache = 1;
+                        break;
+
+                    case 'D': case 'd':
+                        list = 1;
+                        break;
+
+                    case 'X': case 'x':
+                        if (argc > 1) {
+                            extract_filename = *++argv;
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-x requires a filename !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    default:
+                        fprintf (stderr, "illegal option: %c !\n", **argv);
+                        ++error_count;
+                }
+        else if (!image_filename)
+            image_filename = *argv;
+        else {
+            fprintf (stderr, "extra argument: %s !\n", *argv);
+            ++error_count;
+        }
+    }
+
+    if (!image_filename) {
+        fputs (usage, stderr);
+        return 1;
+    }
+
+    if (writers < 0 || writers > MAX_WRITERS) {
+        fprintf (stderr, "-t must be 1 to %d threads !\n", MAX_WRITERS);
+        ++error_count;
+    }
+
+    if (error_count)
+        return 1;
+
+    if (!diskimg_open (image_filename, new_mbytes * (1024 * 1024 / DISKIMG_SECTOR_SIZE))) {
+        fprintf (stderr, "can't open image: %s !\n", image_filename);
+        return 1;
+    }
+
+    f_mount (0, &fatfs);
+
+    if (new_mbytes) {
+        FRESULT result = f_mkfs (0, 1, cluster_bytes);
+
+        if (result != FR_OK) {
+            fprintf (stderr, "format failed, error %d !\n", result);
+            return 1;
+        }
+
+        printf ("created %d MB image %s\n", new_mbytes, image_filename);
+    }
+
+    if (list || extract_filename) {
+        int result = list ? list_files () : 0;
+
+        if (extract_filename && !result)
+            result = extract_file (extract_filename);
+
+        f_mount (0, NULL);
+        diskimg_close ();
+        return result;
+    }
+
+    diskimg_set_latency (command_usecs, sector_usecs, NULL);
+
+    if (bypass_cache) {
+        diskcache_enable (0);
+        printf ("bypassing the write-back sector cache\n");
+    }
+
+    if (command_usecs || sector_usecs)
+        printf ("injected latency: %d usecs per command, %d usecs per sector\n", command_usecs, sector_usecs);
+
+    if (hours)
+        recording_test (hours);
+    else if (writers)
+        writers_test (writers);
+    else {
+        stream_test (0);
+        stream_test (1);
+        log_test ();
+        clip_test (0);
+        clip_test (1);
+    }
+
+    f_mount (0, NULL);
+    diskimg_close ();
+    return 0;
+}
+
+// Write a large file at each write size and report the throughput and overhead.
+
+static void stream_test (int preallocate)
+{
+    int i;
+
+    printf ("\nstreaming %d KB per file (f_open, %sf_write, f_close):\n", STREAM_BYTES / 1024,
+        preallocate ? "f_expand, " : "");
+    printf ("   size     KB/sec   writes   reads   sectors written   overhead\n");
+
+    for (i = 0; stream_sizes [i]; ++i) {
+        int size = stream_sizes [i], written = 0;
+        struct diskimg_stats stats;
+        double usecs;
+        FIL file;
+        UINT bw;
+
+        start_test ();
+
+        if (f_open (&file, "STREAM.DAT", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+            printf ("   can't create file!\n");
+            return;
+        }
+
+        if (preallocate && f_expand (&file, STREAM_BYTES, 1) != FR_OK) {
+            printf ("   can't allocate contiguous file!\n");
+            f_close (&file);
+            f_unlink ("STREAM.DAT");
+            return;
+        }
+
+        while (written < STREAM_BYTES && f_write (&file, write_buffer, size, &bw) == FR_OK && bw == size)
+            written += size;
+
+        f_close (&file);
+        usecs = end_test (&stats);
+
+        printf ("  %5d %10.0f %8u %7u %17u %10u\n", size, written / 1024.0 / (usecs / 1000000.0),
+            stats.writes, stats.reads, stats.sectors_written,
+            stats.sectors_written - (written + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE);
+
+        f_unlink ("STREAM.DAT");
+    }
+}
+
+// Append log lines like the USB recorder's (about 110 bytes) and sync every so many lines.
+
+static void log_test (void)
+{
+    int i;
+
+    printf ("\nappending %d log lines to an open file:\n", LOG_LINES);
+    printf ("   sync every   usecs/line   writes/line   sectors/line   reads/line\n");
+
+    for (i = 0; log_sync_intervals [i]; ++i) {
+        int interval = log_sync_intervals [i], line_count;
+        struct diskimg_stats stats;
+        double usecs;
+        FIL file;
+        UINT bw;
+
+        start_test ();
+
+        if (f_open (&file, "EVENTS.TXT", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+            printf ("   can't create file!\n");
+            return;
+        }
+
+        for (line_count = 0; line_count < LOG_LINES; ++line_count) {
+            char line [160];
+            int length = sprintf (line, "%03d:%02d:%06.3f knock detected, span = %d, ratio = %.3f, heights = %d-%d, "
+                "confidence = %.2f, CLIP%04d.WAV\r\n", line_count / 3600, line_count / 60 % 60, (line_count % 60) + 0.25,
+                8000 + line_count, 1.0 + line_count / 10000.0, 100 + line_count % 50, 200 + line_count % 70, 0.9, line_count % 9999 + 1);
+
+            f_write (&file, line, length, &bw);
+
+            if ((line_count + 1) % interval == 0)
+                f_sync (&file);
+        }
+
+        f_close (&file);
+        usecs = end_test (&stats);
+
+        printf ("  %11d %12.1f %13.2f %14.2f %12.2f\n", interval, usecs / LOG_LINES,
+            (double) stats.writes / LOG_LINES, (double) stats.sectors_written / LOG_LINES,
+            (double) stats.reads / LOG_LINES);
+
+        f_unlink ("EVENTS.TXT");
+    }
+}
+
+// Write WAV clips like the USB recorder's: the header, and then the audio in fixed size chunks.
+
+static void clip_test (int preallocate)
+{
+    int i, j;
+
+    printf ("\nwriting %d clips of %d bytes (a %d-byte header and then the audio%s):\n",
+        CLIP_FILES, CLIP_HEADER_BYTES + CLIP_DATA_BYTES, CLIP_HEADER_BYTES, preallocate ? ", f_expand first" : "");
+    printf ("   chunk    msecs/clip   x real time   writes/clip   sectors/clip   overhead/clip\n");
+
+    for (i = 0; clip_chunk_sizes [i]; ++i) {
+        int chunk = clip_chunk_sizes [i];
+        struct diskimg_stats stats;
+        char filename [16];
+        double usecs;
+        FIL file;
+        UINT bw;
+
+        start_test ();
+
+        for (j = 0; j < CLIP_FILES; ++j) {
+            int written = 0;
+
+            sprintf (filename, "CLIP%04d.WAV", j + 1);
+
+            if (f_open (&file, filename, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+                printf ("   can't create file!\n");
+                return;
+            }
+
+            if (preallocate && f_expand (&file, CLIP_HEADER_BYTES + CLIP_DATA_BYTES, 1) != FR_OK) {
+                printf ("   can't allocate contiguous file!\n");
+                f_close (&file);
+                return;
+            }
+
+            f_write (&file, write_buffer, CLIP_HEADER_BYTES, &bw);
+
+            while (written < CLIP_DATA_BYTES) {
+                int count = CLIP_DATA_BYTES - written < chunk ? CLIP_DATA_BYTES - written : chunk;
+
+                if (preallocate && !written && chunk > CLIP_HEADER_BYTES)
+                    count = chunk - CLIP_HEADER_BYTES;
+
+                if (f_write (&file, write_buffer, count, &bw) != FR_OK || bw != count)
+                    break;
+
+                written += count;
+            }
+
+            f_close (&file);
+        }
+
+        usecs = end_test (&stats);
+
+        printf ("  %6d %13.2f %13.1f %13.1f %14.1f %15.1f\n", chunk, usecs / 1000.0 / CLIP_FILES,
+            CLIP_SECONDS * 1000000.0 * CLIP_FILES / usecs, (double) stats.writes / CLIP_FILES,
+            (double) stats.sectors_written / CLIP_FILES, (double) stats.sectors_written / CLIP_FILES -
+            (CLIP_HEADER_BYTES + CLIP_DATA_BYTES + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE);
+
+        for (j = 0; j < CLIP_FILES; ++j) {
+            sprintf (filename, "CLIP%04d.WAV", j + 1);
+            f_unlink (filename);
+        }
+    }
+}
+
+// Build a recording of the given length, with each minute starting with a tag ("M" and the minute
+// number) and a clip file written every so often, and then do the seek test both ways.
+
+static void recording_test (int hours)
+{
+    int minutes = hours * 60, clip_count = 0, i;
+    char tag [16], filename [24];
+    struct diskimg_stats stats;
+    double usecs;
+    FIL file, clip;
+    UINT bw;
+
+    printf ("\ncreating a %d hour recording (%u MB) with a clip every %d minutes...\n", hours,
+        (unsigned) ((double) minutes * 60 * RECORDING_BYTES_PER_SECOND / (1024 * 1024)), RECORDING_CLIP_MINUTES);
+
+    start_test ();
+
+    if (f_open (&file, "RECORD.DAT", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        printf ("   can't create file!\n");
+        return;
+    }
+
+    for (i = 0; i < minutes; ++i) {
+        sprintf (tag, "M%07d", i);
+
+        if (f_lseek (&file, (DWORD) i * 60 * RECORDING_BYTES_PER_SECOND) != FR_OK ||
+            file.fptr != (DWORD) i * 60 * RECORDING_BYTES_PER_SECOND ||
+            f_write (&file, tag, 8, &bw) != FR_OK || bw != 8) {
+                printf ("   drive full after %d minutes!\n", i);
+                break;
+        }
+
+        if (i % RECORDING_CLIP_MINUTES == RECORDING_CLIP_MINUTES - 1) {
+            sprintf (filename, "CLIP%04d.WAV", ++clip_count);
+
+            if (f_open (&clip, filename, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK) {
+                f_lseek (&clip, CLIP_HEADER_BYTES + CLIP_DATA_BYTES);
+                f_close (&clip);
+            }
+        }
+    }
+
+    minutes = i;
+    f_lseek (&file, (DWORD) minutes * 60 * RECORDING_BYTES_PER_SECOND);
+    f_close (&file);
+    usecs = end_test (&stats);
+    printf ("   took %.2f seconds, %u writes and %u reads\n", usecs / 1000000.0, stats.writes, stats.reads);
+
+    if (minutes) {
+        printf ("\njumping to %d random event times (reading the minute tag and then 1 second of audio):\n", SEEK_EVENTS);
+        printf ("   seek mode     msecs/event   reads/event   sectors/event   tag errors\n");
+        seek_test (minutes, 0);
+        seek_test (minutes, 1);
+    }
+
+    f_unlink ("RECORD.DAT");
+
+    for (i = 1; i <= clip_count; ++i) {
+        sprintf (filename, "CLIP%04d.WAV", i);
+        f_unlink (filename);
+    }
+}
+
+static void seek_test (int minutes, int fast_seek)
+{
+    int tag_errors = 0, i;
+    struct diskimg_stats stats;
+    double usecs;
+    char tag [16];
+    FIL file;
+    UINT br;
+
+    if (f_open (&file, "RECORD.DAT", FA_READ) != FR_OK) {
+        printf ("   can't open file!\n");
+        return;
+    }
+
+    if (fast_seek) {
+        FRESULT result;
+
+        start_test ();
+        file.cltbl = link_map;
+        link_map [0] = LINK_MAP_ITEMS;
+        result = f_lseek (&file, CREATE_LINKMAP);
+        usecs = end_test (&stats);
+
+        if (result != FR_OK) {
+            printf ("   link map needs %u items, only have %d!\n", link_map [0], LINK_MAP_ITEMS);
+            f_close (&file);
+            return;
+        }
+
+        printf ("   (link map of %u fragments built in %.2f msecs with %u reads)\n", (link_map [0] - 2) / 2,
+            usecs / 1000.0, stats.reads);
+    }
+
+    srand (1);
+    start_test ();
+
+    for (i = 0; i < SEEK_EVENTS; ++i) {
+        int minute = rand () % minutes, second = rand () % 60;
+
+        sprintf (tag, "M%07d", minute);
+
+        if (f_lseek (&file, (DWORD) minute * 60 * RECORDING_BYTES_PER_SECOND) != FR_OK ||
+            f_read (&file, write_buffer, 8, &br) != FR_OK || br != 8 || memcmp (write_buffer, tag, 8))
+                tag_errors++;
+
+        if (f_lseek (&file, ((DWORD) minute * 60 + second) * RECORDING_BYTES_PER_SECOND) != FR_OK ||
+            f_read (&file, write_buffer, RECORDING_BYTES_PER_SECOND, &br) != FR_OK)
+                tag_errors++;
+    }
+
+    usecs = end_test (&stats);
+    f_close (&file);
+
+    printf ("   %-10s %14.2f %13.1f %15.1f %12d\n", fast_seek ? "link map" : "FAT chain", usecs / 1000.0 / SEEK_EVENTS,
+        (double) stats.reads / SEEK_EVENTS, (double) stats.sectors_read / SEEK_EVENTS, tag_errors);
+}
+
+// Run the writers, first all in one thread and then each in its own thread, and then check the
+// volume (the files are left in place for that).
+
+struct writer {
+    pthread_t thread;
+    int first, count;                           // writer numbers done by this thread
+    int errors;
+};
+
+static uint8_t writer_pattern (int writer, int file, DWORD offset)
+{
+    return writer * 37 + file * 11 + offset * 7 + offset / 509;
+}
+
+static void writers_test (int writers)
+{
+    struct writer threads [MAX_WRITERS];
+    int pass, i;
+
+    printf ("\n%d writers, each writing %d files of %d bytes (%d, %d, %d or %d bytes at a time, the first synced):\n",
+        writers, WRITER_FILES, WRITER_FILE_BYTES, writer_sizes [0], writer_sizes [1], writer_sizes [2], writer_sizes [3]);
+    printf ("   threads     msecs     KB/sec   writes    reads   errors\n");
+
+    for (pass = 0; pass < 2; ++pass) {
+        int thread_count = pass ? writers : 1, errors = 0;
+        struct diskimg_stats stats;
+        double usecs;
+
+        start_test ();
+
+        for (i = 0; i < thread_count; ++i) {
+            threads [i].first = pass ? i : 0;
+            threads [i].count = pass ? 1 : writers;
+            threads [i].errors = 0;
+
+            if (pthread_create (&threads [i].thread, NULL, writer_thread, threads + i)) {
+                printf ("   can't create thread!\n");
+                thread_count = i;
+                errors++;
+                break;
+            }
+        }
+
+        for (i = 0; i < thread_count; ++i) {
+            pthread_join (threads [i].thread, NULL);
+            errors += threads [i].errors;
+        }
+
+        usecs = end_test (&stats);
+
+        printf ("  %8d %9.1f %10.0f %8u %8u %8d\n", thread_count, usecs / 1000.0,
+            (double) writers * WRITER_FILES * WRITER_FILE_BYTES / 1024.0 / (usecs / 1000000.0),
+            stats.writes, stats.reads, errors);
+    }
+
+    check_volume (writers);
+}
+
+static void *writer_thread (void *arg)
+{
+    struct writer *writer = arg;
+    uint8_t buffer [WRITER_MAX_SIZE];
+    char filename [24];
+    int w, f, i;
+
+    for (w = writer->first; w < writer->first + writer->count; ++w)
+        for (f = 0; f < WRITER_FILES; ++f) {
+            int size = writer_sizes [w % 4], sync = (w % 4 == 0);
+            DWORD written = 0;
+            FIL file;
+            UINT bw;
+
+            sprintf (filename, "W%02dF%03d.DAT", w, f);
+
+            if (f_open (&file, filename, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+                writer->errors++;
+                continue;
+            }
+
+            while (written < WRITER_FILE_BYTES) {
+                int count = WRITER_FILE_BYTES - written < size ? WRITER_FILE_BYTES - written : size;
+
+                for (i = 0; i < count; ++i)
+                    buffer [i] = writer_pattern (w, f, written + i);
+
+                if (f_write (&file, buffer, count, &bw) != FR_OK || bw != count ||
+                    (sync && f_sync (&file) != FR_OK)) {
+                        writer->errors++;
+                        break;
+                }
+
+                written += count;
+            }
+
+            if (f_close (&file) != FR_OK)
+                writer->errors++;
+        }
+
+    return NULL;
+}
+
+// Check the volume after the writers: read back every writer file, and get the clusters of every
+// file in the root directory (from the link map, see seek_test()) and of the directory itself, to
+// check that none are out of range or used twice, that each chain is the right length, and that
+// those plus the free clusters are all of them. The free clusters are counted from the FAT itself
+// after remounting; on FAT32 the mount takes the free count from the FSInfo sector, which was
+// written from the same count being checked, so that is thrown away first (and must match too).
+// The writer files are deleted afterward. Returns the number of problems found.
+
+static int check_volume (int writers)
+{
+    int file_count = 0, data_errors = 0, cross_links = 0, bad_clusters = 0, length_errors = 0;
+    int problems, w, f, i;
+    DWORD cluster_bytes = (DWORD) fatfs.csize * DISKIMG_SECTOR_SIZE, total_clusters = fatfs.max_clust - 2;
+    DWORD used_clusters = 0, free_clusters = 0, fsinfo_clusters = 0, dir_cluster = 0;
+    uint8_t *in_use = calloc (fatfs.max_clust, 1);
+    char filename [24];
+    FILINFO info;
+    FATFS *fs;
+    DIR dir;
+
+    if (!in_use || f_opendir (&dir, "") != FR_OK) {
+        printf ("   can't check the volume!\n");
+        free (in_use);
+        return 1;
+    }
+
+    while (1) {
+        DWORD *fragment;
+        FIL file;
+
+        if (dir.clust != dir_cluster) {         // the root directory's own clusters (FAT32)
+            dir_cluster = dir.clust;
+
+            if (dir_cluster < 2 || dir_cluster >= fatfs.max_clust)
+                bad_clusters++;
+            else if (in_use [dir_cluster]++)
+                cross_links++;
+
+            used_clusters++;
+        }
+
+        if (f_readdir (&dir, &info) != FR_OK || !info.fname [0])
+            break;
+
+        if (info.fattrib & AM_DIR)              // subdirectories aren't followed
+            continue;
+
+        file_count++;
+
+        if (f_open (&file, info.fname, FA_READ) != FR_OK) {
+            length_errors++;
+            continue;
+        }
+
+        file.cltbl = link_map;
+        link_map [0] = LINK_MAP_ITEMS;
+
+        if (f_lseek (&file, CREATE_LINKMAP) != FR_OK) {
+            length_errors++;
+            f_close (&file);
+            continue;
+        }
+
+        for (i = 0, fragment = link_map + 1; fragment [0]; fragment += 2)
+            for (w = 0; w < (int) fragment [0]; ++w, ++i)
+                if (fragment [1] + w < 2 || fragment [1] + w >= fatfs.max_clust)
+                    bad_clusters++;
+                else if (in_use [fragment [1] + w]++)
+                    cross_links++;
+
+        used_clusters += i;
+
+        if (i != (int) ((info.fsize + cluster_bytes - 1) / cluster_bytes))
+            length_errors++;
+
+        f_close (&file);
+    }
+
+    for (w = 0; w < writers; ++w)
+        for (f = 0; f < WRITER_FILES; ++f) {
+            DWORD offset = 0;
+            FIL file;
+            UINT br;
+
+            sprintf (filename, "W%02dF%03d.DAT", w, f);
+
+            if (f_open (&file, filename, FA_READ) != FR_OK || file.fsize != WRITER_FILE_BYTES) {
+                data_errors++;
+                continue;
+            }
+
+            while (f_read (&file, write_buffer, sizeof (write_buffer), &br) == FR_OK && br) {
+                for (i = 0; i < (int) br; ++i)
+                    if (write_buffer [i] != writer_pattern (w, f, offset + i)) {
+                        data_errors++;
+                        break;
+                    }
+
+                offset += br;
+            }
+
+            if (offset != WRITER_FILE_BYTES)
+                data_errors++;
+
+            f_close (&file);
+        }
+
+    f_mount (0, NULL);
+    f_mount (0, &fatfs);
+    f_getfree ("", &fsinfo_clusters, &fs);     // mounts, free count from FSInfo on FAT32
+    fatfs.free_clust = 0xFFFFFFFF;              // now force f_getfree() to count the FAT
+    f_getfree ("", &free_clusters, &fs);
+
+    problems = data_errors + cross_links + bad_clusters + length_errors +
+        (used_clusters + free_clusters != total_clusters) + (fsinfo_clusters != free_clusters);
+    printf ("\nvolume check: %d files, %d data errors, %d cross-linked clusters, %d bad cluster numbers,\n",
+        file_count, data_errors, cross_links, bad_clusters);
+    printf ("   %d chain length errors\n", length_errors);
+    printf ("   %u used + %u free clusters = %u of %u clusters, %s\n", used_clusters, free_clusters,
+        used_clusters + free_clusters, total_clusters, problems ? "PROBLEMS FOUND!" : "ok");
+
+    if (fsinfo_clusters != free_clusters)
+        printf ("   free count at mount was %u, not %u!\n", fsinfo_clusters, free_clusters);
+
+    for (w = 0; w < writers; ++w)
+        for (f = 0; f < WRITER_FILES; ++f) {
+            sprintf (filename, "W%02dF%03d.DAT", w, f);
+            f_unlink (filename);
+        }
+
+    free (in_use);
+    return problems;
+}
+
+static int list_files (void)
+{
+    DWORD free_clusters;
+    FILINFO info;
+    FATFS *fs;
+    DIR dir;
+
+    if (f_opendir (&dir, "") != FR_OK) {
+        fprintf (stderr, "can't read the root directory (not formatted?) !\n");
+        return 1;
+    }
+
+    while (f_readdir (&dir, &info) == FR_OK && info.fname [0])
+        printf ("%-12s %10lu  %04d-%02d-%02d %02d:%02d\n", info.fname, (unsigned long) info.fsize,
+            (info.fdate >> 9) + 1980, (info.fdate >> 5) & 15, info.fdate & 31, info.ftime >> 11, (info.ftime >> 5) & 63);
+
+    if (f_getfree ("", &free_clusters, &fs) == FR_OK)
+        printf ("%lu KB free\n", (unsigned long) free_clusters * fs->csize * DISKIMG_SECTOR_SIZE / 1024);
+
+    return 0;
+}
+
+static int extract_file (const char *filename)
+{
+    FILE *outfile;
+    FIL file;
+    UINT br;
+
+    if (f_open (&file, filename, FA_READ) != FR_OK) {
+        fprintf (stderr, "can't find %s on the image !\n", filename);
+        return 1;
+    }
+
+    if (!(outfile = fopen (filename, "wb"))) {
+        fprintf (stderr, "can't open file for writing: %s !\n", filename);
+        f_close (&file);
+        return 1;
+    }
+
+    while (f_read (&file, write_buffer, sizeof (write_buffer), &br) == FR_OK && br)
+        fwrite (write_buffer, 1, br, outfile);
+
+    fclose (outfile);
+    f_close (&file);
+    return 0;
+}
+
+// The test time is the host time plus the injected latency (which isn't actually waited for).
+
+static double test_start;
+
+static void start_test (void)
+{
+    diskimg_reset_stats ();
+    test_start = host_usecs ();
+}
+
+static double end_test (struct diskimg_stats *stats)
+{
+    double usecs = host_usecs () - test_start;
+
+    diskimg_get_stats (stats);
+    return usecs + stats->latency_usecs;
+}
+
+static double host_usecs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
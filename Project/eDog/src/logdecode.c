@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// logdecode.c
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "logfmt.h"
+
+// This is a command-line program that turns a capture of the eDog's debug port back into text.
+// The regular text output is passed through (without the carriage returns) and the binary log
+// records (see logfmt.h) are formatted using the same message table the firmware was built with,
+// optionally with their timestamps (as seconds since the first record, from the cycle counter,
+// which is assumed to not wrap more than once between records, i.e. about 25 seconds). Records
+// that are corrupt (e.g., a serial error) are skipped and counted.
+//
+// The -b option benchmarks the binary logging (Dbg_log()) against formatting the same messages
+// with vsprintf() like Dbg_printf() does, and compares the number of bytes that have to go out
+// the serial port, which is what limits the number of messages per second.
+//
+// Build right here on Cygwin or Linux:  gcc -O2 -I../inc logdecode.c logfmt.c -o logdecode
+
+#define CYCLES_PER_SECOND 168000000.0
+#define SERIAL_BYTES_PER_SECOND (921600 / 10)
+#define BENCHMARK_MESSAGES 1000000
+
+static const char *usage =
+" Usage:   logdecode [-options] capture.bin\n"
+"          logdecode -b\n\n"
+" Options: -t  = display the timestamps of the binary log records\n"
+"          -b  = benchmark binary logging against vsprintf() formatting\n\n";
+
+static uint8_t *capture;
+static int capture_bytes, capture_size;
+
+static int decode_file (FILE *infile, int timestamps);
+static int benchmark (void);
+
+int main (argc, argv) int argc; char **argv;
+{
+    int error_count = 0, timestamps = 0, run_bench = 0;
+    FILE *infile = NULL;
+
+    // loop through command-line arguments
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+
+                    case 'T': case 't':
+                        timestamps = 1;
+                        break;
+
+                    case 'B': case 'b':
+                        run_bench = 1;
+                        break;
+
+                    default:
+                        fprintf (stderr, "illegal option: %c !\n", **argv);
+                        ++error_count;
+                }
+        else if (!infile) {
+            infile = fopen (*argv, "rb");
+
+            if (!infile) {
+                fprintf (stderr, "can't open file for reading: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else {
+            fprintf (stderr, "extra argument: %s !\n", *argv);
+            ++error_count;
+        }
+    }
+
+    if (error_count)
+        return 1;
+
+    if (run_bench && !infile)
+        return benchmark ();
+
+    if (!infile) {
+        fputs (usage, stderr);
+        return 1;
+    }
+
+    return decode_file (infile, timestamps);
+}
+
+// Decode the whole capture, which is read a block at a time (a record can straddle blocks).
+
+static int decode_file (FILE *infile, int timestamps)
+{
+    uint32_t last_timestamp = 0;
+    int bytes = 0, records = 0, bad_records = 0, count;
+    double seconds = 0.0;
+    uint8_t buffer [4096];
+
+    while ((count = fread (buffer + bytes, 1, sizeof (buffer) - bytes, infile)) > 0 || bytes) {
+        int eof = count <= 0, index = 0;
+
+        bytes += eof ? 0 : count;
+
+        while (index < bytes) {
+            char text [256];
+            uint32_t timestamp;
+            int used;
+
+            if (buffer [index] != LOG_RECORD_START) {
+                if (buffer [index] != '\r')
+                    putchar (buffer [index]);
+
+                index++;
+                continue;
+            }
+
+            used = logfmt_decode (buffer + index, bytes - index, text, sizeof (text), &timestamp);
+
+            if (!used && !eof)
+                break;          // need the rest of the record
+
+            if (used <= 0) {
+                bad_records++;
+                index++;
+                continue;
+            }
+
+            if (timestamps) {
+                if (!records++)
+                    last_timestamp = timestamp;
+
+                seconds += (uint32_t) (timestamp - last_timestamp) / CYCLES_PER_SECOND;
+                last_timestamp = timestamp;
+                printf ("[%12.6f] ", seconds);
+            }
+            else
+                records++;
+
+            fputs (text, stdout);
+            index += used;
+        }
+
+        memmove (buffer, buffer + index, bytes - index);
+        bytes -= index;
+
+        if (eof)
+            break;
+    }
+
+    fclose (infile);
+    fprintf (stderr, "logdecode: %d records decoded, %d bad records skipped\n", records, bad_records);
+    return bad_records ? 1 : 0;
+}
+
+// For the benchmark, the records are captured here instead of going out the serial port.
+
+void Dbg_write (const void *data, int bytes)
+{
+    if (capture_bytes + bytes > capture_size)
+        capture = realloc (capture, capture_size = (capture_size + bytes) * 2);
+
+    memcpy (capture + capture_bytes, data, bytes);
+    capture_bytes += bytes;
+}
+
+// this is what Dbg_printf() and the scanner's time_format() did for every message
+
+static int text_printf (char *pstring, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    va_start (args, format);
+    length = vsprintf (pstring, format, args);
+    va_end (args);
+    return length;
+}
+
+static char *text_time (int time_in_samples)
+{
+    int hours = time_in_samples / (16000 * 3600);
+    int minutes = (time_in_samples / (16000 * 60)) - (hours * 60);
+    float seconds = (time_in_samples % (16000 * 60)) / (float) 16000;
+    static char string [32];
+
+    sprintf (string, "%02d:%02d:%06.3f", hours, minutes, seconds);
+    return string;
+}
+
+// Log the two most common messages (the peaks and the knock detections) alternately with values
+// that vary, both ways, and check a sample of the decoded records against the text.
+
+static int benchmark (void)
+{
+    double text_seconds, log_seconds;
+    int text_bytes = 0, mismatches = 0, peak_bytes, knock_bytes, i;
+    char pstring [128];
+    clock_t start;
+
+    start = clock ();
+
+    for (i = 0; i < BENCHMARK_MESSAGES; ++i)
+        if (i & 1)
+            text_bytes += text_printf (pstring, log_formats [LOG_KNOCK_DETECTED], text_time (i * 17), i & 0x3fff,
+                1.0F + (i & 0xff) / 1024.0F, i & 0x7ff, (i >> 3) & 0x7ff, (i >> 5) & 0x7ff, i & 0x3f, (i >> 2) & 0x3f, (i >> 4) & 0x3f);
+        else
+            text_bytes += text_printf (pstring, log_formats [LOG_PEAK_ADDED], text_time (i * 17), i & 0x7ff,
+                i & 0x3f, (i & 0xffff) / 100.0F);
+
+    text_seconds = (double) (clock () - start) / CLOCKS_PER_SEC;
+    capture_bytes = 0;
+    start = clock ();
+
+    for (i = 0; i < BENCHMARK_MESSAGES; ++i)
+        if (i & 1)
+            Dbg_log (LOG_KNOCK_DETECTED, i * 17, i & 0x3fff,
+                1.0F + (i & 0xff) / 1024.0F, i & 0x7ff, (i >> 3) & 0x7ff, (i >> 5) & 0x7ff, i & 0x3f, (i >> 2) & 0x3f, (i >> 4) & 0x3f);
+        else
+            Dbg_log (LOG_PEAK_ADDED, i * 17, i & 0x7ff, i & 0x3f, (i & 0xffff) / 100.0F);
+
+    log_seconds = (double) (clock () - start) / CLOCKS_PER_SEC;
+
+    // the text also has a carriage return added per line on the board
+
+    text_bytes += BENCHMARK_MESSAGES;
+
+    peak_bytes = LOG_HEADER_BYTES + strlen (log_signatures [LOG_PEAK_ADDED]) * 4 + 1;
+    knock_bytes = LOG_HEADER_BYTES + strlen (log_signatures [LOG_KNOCK_DETECTED]) * 4 + 1;
+
+    for (i = 0; i < BENCHMARK_MESSAGES; i += 997) {
+        int offset = (i >> 1) * (peak_bytes + knock_bytes) + (i & 1) * peak_bytes;
+        char text [256];
+
+        if (i & 1)
+            text_printf (pstring, log_formats [LOG_KNOCK_DETECTED], text_time (i * 17), i & 0x3fff,
+                1.0F + (i & 0xff) / 1024.0F, i & 0x7ff, (i >> 3) & 0x7ff, (i >> 5) & 0x7ff, i & 0x3f, (i >> 2) & 0x3f, (i >> 4) & 0x3f);
+        else
+            text_printf (pstring, log_formats [LOG_PEAK_ADDED], text_time (i * 17), i & 0x7ff, i & 0x3f, (i & 0xffff) / 100.0F);
+
+        if (logfmt_decode (capture + offset, capture_bytes - offset, text, sizeof (text), NULL) <= 0 || strcmp (text, pstring))
+            mismatches++;
+    }
+
+    printf ("logdecode: %d messages, text = %.1f nsecs and %.1f bytes per message, binary = %.1f nsecs and %.1f bytes per message\n",
+        BENCHMARK_MESSAGES, text_seconds * 1e9 / BENCHMARK_MESSAGES, (double) text_bytes / BENCHMARK_MESSAGES,
+        log_seconds * 1e9 / BENCHMARK_MESSAGES, (double) capture_bytes / BENCHMARK_MESSAGES);
+    printf ("logdecode: logging is %.1fx faster, and the serial port can carry %.0f messages/sec (vs. %.0f as text)\n",
+        text_seconds / log_seconds, SERIAL_BYTES_PER_SECOND / ((double) capture_bytes / BENCHMARK_MESSAGES),
+        SERIAL_BYTES_PER_SECOND / ((double) text_bytes / BENCHMARK_MESSAGES));
+    printf ("logdecode: %s\n", mismatches ? "FAILED, decoded records don't match the text" : "decoded records match the text");
+
+    free (capture);
+    return mismatches ? 1 : 0;
+}
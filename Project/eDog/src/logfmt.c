@@ -0,0 +1,188 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// logfmt.c
+
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "logfmt.h"
+#include "profile.h"
+
+// The message tables, generated from the list in logfmt.h
+
+#define LOGMSG(id, signature, format) signature,
+const char *const log_signatures [LOG_NUM_MESSAGES] = { LOG_MESSAGES };
+#undef LOGMSG
+
+#define LOGMSG(id, signature, format) format,
+const char *const log_formats [LOG_NUM_MESSAGES] = { LOG_MESSAGES };
+#undef LOGMSG
+
+// The timestamp is the cycle counter where there is one (the board and the host simulation).
+
+#ifdef PROFILE_ENABLED
+#define LOG_TIMESTAMP() cycles_now ()
+#else
+#define LOG_TIMESTAMP() 0
+#endif
+
+static __inline void put_le32 (uint8_t *dst, uint32_t value)
+{
+    dst [0] = value;
+    dst [1] = value >> 8;
+    dst [2] = value >> 16;
+    dst [3] = value >> 24;
+}
+
+static __inline uint32_t get_le32 (const uint8_t *src)
+{
+    return src [0] | (src [1] << 8) | ((uint32_t) src [2] << 16) | ((uint32_t) src [3] << 24);
+}
+
+// Log a message from the table in logfmt.h with its arguments (which must match its signature).
+// This just packs them into a record and hands it to Dbg_write(), so it's profiled as logging.
+
+void Dbg_log (int id, ...)
+{
+    uint32_t start = profile_begin ();
+    uint8_t record [LOG_MAX_RECORD], *dst = record + LOG_HEADER_BYTES, sum = 0;
+    const char *signature = log_signatures [id];
+    va_list args;
+    int i;
+
+    va_start (args, id);
+
+    while (*signature)
+        if (*signature++ == 'f') {
+            float value = (float) va_arg (args, double);
+            uint32_t bits;
+
+            memcpy (&bits, &value, sizeof (bits));
+            put_le32 (dst, bits);
+            dst += 4;
+        }
+        else {
+            put_le32 (dst, va_arg (args, int));
+            dst += 4;
+        }
+
+    va_end (args);
+
+    record [0] = LOG_RECORD_START;
+    record [1] = id;
+    record [2] = dst - record - LOG_HEADER_BYTES;
+    put_le32 (record + 3, LOG_TIMESTAMP ());
+
+    for (i = 1; record + i < dst; ++i)
+        sum += record [i];
+
+    *dst++ = -sum;
+    Dbg_write (record, dst - record);
+    profile_end (PROFILE_LOG, start);
+}
+
+#ifndef STM32F4XX
+
+// Format a time in samples (at 16 kHz) as hh:mm:ss.sss (this is what scan.c used to do itself).
+
+static void time_format (int time_in_samples, char *string)
+{
+    int hours = time_in_samples / (16000 * 3600);
+    int minutes = (time_in_samples / (16000 * 60)) - (hours * 60);
+    float seconds = (time_in_samples % (16000 * 60)) / (float) 16000;
+
+    sprintf (string, "%02d:%02d:%06.3f", hours, minutes, seconds);
+}
+
+int logfmt_decode (const uint8_t *data, int bytes, char *text, int text_size, uint32_t *timestamp)
+{
+    const char *signature, *format;
+    int arg_bytes, length, used = 0, i;
+    const uint8_t *arg;
+    uint8_t sum = 0;
+
+    if (bytes < 3)
+        return 0;
+
+    if (data [0] != LOG_RECORD_START || data [1] >= LOG_NUM_MESSAGES ||
+        data [2] != strlen (log_signatures [data [1]]) * 4)
+            return -1;
+
+    arg_bytes = data [2];
+    length = LOG_HEADER_BYTES + arg_bytes + 1;
+
+    if (bytes < length)
+        return 0;
+
+    for (i = 1; i < length; ++i)
+        sum += data [i];
+
+    if (sum)
+        return -1;
+
+    if (timestamp)
+        *timestamp = get_le32 (data + 3);
+
+    // copy the format through, printing each conversion with the next argument
+
+    signature = log_signatures [data [1]];
+    format = log_formats [data [1]];
+    arg = data + LOG_HEADER_BYTES;
+    text [0] = 0;
+
+    while (*format && used < text_size - 1) {
+        char spec [16];
+        int spec_length;
+
+        if (*format != '%' || format [1] == '%') {
+            text [used++] = *format;
+            format += (*format == '%') ? 2 : 1;
+            text [used] = 0;
+            continue;
+        }
+
+        spec_length = strcspn (format + 1, "diuxXfegsc") + 2;
+
+        if (spec_length >= (int) sizeof (spec) || !*signature)
+            return -1;
+
+        memcpy (spec, format, spec_length);
+        spec [spec_length] = 0;
+        format += spec_length;
+
+        if (*signature == 'f') {
+            uint32_t bits = get_le32 (arg);
+            float value;
+
+            memcpy (&value, &bits, sizeof (value));
+            snprintf (text + used, text_size - used, spec, value);
+        }
+        else if (*signature == 't') {
+            char time_string [32];
+
+            time_format ((int32_t) get_le32 (arg), time_string);
+            snprintf (text + used, text_size - used, spec, time_string);
+        }
+        else
+            snprintf (text + used, text_size - used, spec, (int32_t) get_le32 (arg));
+
+        used += strlen (text + used);
+        signature++;
+        arg += 4;
+    }
+
+    return length;
+}
+
+#endif
@@ -0,0 +1,233 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// pdmdec.c
+
+#include <string.h>
+#include <math.h>
+
+#include "pdmdec.h"
+
+// This module converts the 1-bit PDM output of the MP45DT02 microphone into PCM, decimating by
+// 64 (i.e., 1.024 MHz to 16 kHz). It's a replacement for ST's PDM filter library, which is only
+// available in binary form for ARM, and so can't be run on the host, profiled or tuned.
+//
+// The first stage is a third-order CIC (sinc^3) filter decimating by 16. Rather than running the
+// integrators and combs at the PDM rate, it's implemented as the equivalent 46-tap FIR (three
+// 16-sample boxcars convolved) evaluated only at the output rate, and because the input is just
+// bits the FIR is done 8 bits at a time with table lookups. Each of the 6 bytes that span the
+// filter has its own 256-entry table with the sum of the filter taps for every bit pattern, so
+// one output at 64 kHz costs 6 lookups and adds. The tables are built at init time (3K of RAM).
+// The CIC's images around 64 kHz that fold into 0 - 7 kHz are down at least 54 dB.
+//
+// The second stage is an 11-tap half-band FIR decimating by 2 to 32 kHz. It's there for the
+// images around 32 kHz (25 kHz would fold to 7 kHz), which a sinc^3 decimating all the way to
+// 32 kHz only attenuates 33 dB. It's flat to 7 kHz (+/- 0.01 dB) and at least 63 dB down from
+// 25 kHz up, and because every other tap is zero it costs only 4 multiplies per output.
+//
+// The third stage is a 47-tap symmetric FIR decimating by 2 to 16 kHz. It was designed with a
+// weighted least-squares fit to be flat (+/- 0.06 dB) to 7 kHz including compensation for the
+// CIC droop (about 0.5 dB at 7 kHz), and to attenuate at least 60 dB from 9 kHz up. This is the
+// stage that does the job of the usual second half-band filter, but with the droop compensation
+// it can't have the half-band's zero taps, so we just take advantage of the symmetry instead.
+//
+// Finally there's a one-pole DC blocking highpass at HP_HZ and an optional one-pole lowpass at
+// LP_HZ (only if it's below Fs/2), and then the gain is applied (MicGain/64 of full scale).
+
+#define CIC_DECIMATION 16
+#define CIC_TAPS (CIC_DECIMATION * 3 - 2)       // 46 taps for sinc^3
+#define CIC_BYTES ((CIC_TAPS + 7) / 8)          // 6 bytes span the filter
+#define CIC_STEP_BYTES (CIC_DECIMATION / 8)     // 2 new bytes per CIC output
+#define CIC_HISTORY_BYTES (CIC_BYTES - CIC_STEP_BYTES)
+#define CIC_GAIN (CIC_DECIMATION * CIC_DECIMATION * CIC_DECIMATION)
+
+#define HB_TAPS 11
+
+static const float hb_coeffs [HB_TAPS / 4 + 1] = {      // the odd taps, outermost first
+    0.010759504F, -0.060091529F, 0.299661751F           // (the center tap is 0.5)
+};
+
+#define FIR_TAPS 47
+
+static const float fir_coeffs [FIR_TAPS / 2 + 1] = {
+    0.000338875F, 0.002668379F, 0.002452721F, -0.001986385F, -0.003596802F, 0.002735183F,
+    0.005831495F, -0.003529810F, -0.009020933F, 0.004334748F, 0.013409877F, -0.005110355F,
+    -0.019450214F, 0.005790637F, 0.027970232F, -0.006283051F, -0.040730497F, 0.006411427F,
+    0.062258582F, -0.005919228F, -0.109935931F, 0.000160569F, 0.321747393F, 0.504827213F
+};
+
+static int16_t cic_tables [CIC_BYTES] [256];
+static int cic_tables_built;
+
+static struct pdmdec_state {
+    uint8_t history [CIC_HISTORY_BYTES];
+    float hb_buffer [HB_TAPS * 2];              // each sample is stored twice so the taps are contiguous
+    float fir_buffer [FIR_TAPS * 2];
+    int hb_index, fir_index, out_samples;
+    float hp_coeff, hp_input, hp_output;
+    float lp_coeff, lp_output;
+} states [PDMDEC_MAX_FILTERS];
+
+static int num_states;
+
+static void build_cic_tables (void);
+
+// Initialize a filter instance. The instance state lives here, and a pointer to it is stored in
+// the InternalFilter field of the caller's structure. Calling this again for the same structure
+// resets the same instance. Once all PDMDEC_MAX_FILTERS instances are taken the pointer is set
+// to NULL instead, and pdmdec_64_lsb() fails for that structure.
+
+void pdmdec_init (PDMFilter_InitStruct *Filter)
+{
+    struct pdmdec_state *state;
+
+    memcpy (&state, Filter->InternalFilter, sizeof (state));
+
+    if (state < states || state >= states + num_states) {
+        state = num_states < PDMDEC_MAX_FILTERS ? states + num_states++ : NULL;
+        memcpy (Filter->InternalFilter, &state, sizeof (state));
+
+        if (!state)                             // out of instances, so pdmdec_64_lsb() returns 1
+            return;
+    }
+
+    if (!cic_tables_built)
+        build_cic_tables ();
+
+    memset (state, 0, sizeof (*state));
+    memset (state->history, 0x55, sizeof (state->history));    // "silence" is alternating bits
+    state->out_samples = Filter->Fs / 1000;
+
+    if (state->out_samples > PDMDEC_MAX_FS / 1000)
+        state->out_samples = PDMDEC_MAX_FS / 1000;
+
+    if (Filter->HP_HZ > 0.0F)
+        state->hp_coeff = expf (-6.2831853F * Filter->HP_HZ / Filter->Fs);
+
+    if (Filter->LP_HZ > 0.0F && Filter->LP_HZ < Filter->Fs / 2)
+        state->lp_coeff = 1.0F - expf (-6.2831853F * Filter->LP_HZ / Filter->Fs);
+}
+
+// Decimate 1 millisecond of PDM data (Fs/125 bytes) into Fs/1000 PCM samples. The MicGain is
+// 0 to 64 (full scale). Returns 0 (to match the library) or 1 if the filter isn't initialized.
+
+int32_t pdmdec_64_lsb (uint8_t *data, uint16_t *dataOut, uint16_t MicGain, PDMFilter_InitStruct *Filter)
+{
+    uint8_t bytes [CIC_HISTORY_BYTES + PDMDEC_MAX_FS / 125], *window = bytes;
+    float gain = MicGain * (32768.0F / 64.0F / CIC_GAIN);
+    struct pdmdec_state *state;
+    int count, i;
+
+    memcpy (&state, Filter->InternalFilter, sizeof (state));
+
+    if (state < states || state >= states + num_states)
+        return 1;
+
+    // the CIC windows span the previous call's data, so we work on history + new data
+
+    memcpy (bytes, state->history, CIC_HISTORY_BYTES);
+    memcpy (bytes + CIC_HISTORY_BYTES, data, state->out_samples * 8);
+
+    for (count = state->out_samples; count--;) {
+        float *taps, sum, sample;
+        int phase, hb_phase;
+
+        // two half-band outputs (at 32 kHz) go into the FIR for each output sample, and two CIC
+        // outputs (at 64 kHz) go into the half-band for each of those
+
+        for (phase = 0; phase < 2; ++phase) {
+            for (hb_phase = 0; hb_phase < 2; ++hb_phase) {
+                int32_t cic = 0;
+
+                for (i = 0; i < CIC_BYTES; ++i)
+                    cic += cic_tables [i] [window [i]];
+
+                state->hb_buffer [state->hb_index] = state->hb_buffer [state->hb_index + HB_TAPS] = (float) cic;
+
+                if (++state->hb_index == HB_TAPS)
+                    state->hb_index = 0;
+
+                window += CIC_STEP_BYTES;
+            }
+
+            taps = state->hb_buffer + state->hb_index;
+            sum = 0.5F * taps [HB_TAPS / 2];
+
+            for (i = 0; i < HB_TAPS / 2; i += 2)
+                sum += hb_coeffs [i / 2] * (taps [i] + taps [HB_TAPS - 1 - i]);
+
+            state->fir_buffer [state->fir_index] = state->fir_buffer [state->fir_index + FIR_TAPS] = sum;
+
+            if (++state->fir_index == FIR_TAPS)
+                state->fir_index = 0;
+        }
+
+        // the most recent FIR_TAPS samples are now contiguous starting at fir_index
+
+        taps = state->fir_buffer + state->fir_index;
+        sum = fir_coeffs [FIR_TAPS / 2] * taps [FIR_TAPS / 2];
+
+        for (i = 0; i < FIR_TAPS / 2; ++i)
+            sum += fir_coeffs [i] * (taps [i] + taps [FIR_TAPS - 1 - i]);
+
+        sample = sum * gain;
+
+        if (state->hp_coeff != 0.0F) {
+            state->hp_output = sample - state->hp_input + state->hp_coeff * state->hp_output;
+            state->hp_input = sample;
+            sample = state->hp_output;
+        }
+
+        if (state->lp_coeff != 0.0F)
+            sample = state->lp_output += (sample - state->lp_output) * state->lp_coeff;
+
+        if (sample > 32767.0F)
+            *dataOut++ = 32767;
+        else if (sample < -32768.0F)
+            *dataOut++ = (uint16_t) -32768;
+        else
+            *dataOut++ = (uint16_t)(int16_t) floorf (sample + 0.5F);
+    }
+
+    memcpy (state->history, window, CIC_HISTORY_BYTES);
+    return 0;
+}
+
+// Build the CIC lookup tables. The sinc^3 taps are generated by convolving three boxcars, and
+// then each table entry is the sum of the 8 taps for its byte, added for 1 bits and subtracted
+// for 0 bits. The first byte of the window is the oldest, and the LSB of each byte is its
+// oldest bit (the filter is symmetric, so really only the grouping matters).
+
+static void build_cic_tables (void)
+{
+    int16_t taps [CIC_BYTES * 8];
+    int i, j, k;
+
+    memset (taps, 0, sizeof (taps));
+
+    for (i = 0; i < CIC_DECIMATION; ++i)
+        for (j = 0; j < CIC_DECIMATION; ++j)
+            for (k = 0; k < CIC_DECIMATION; ++k)
+                taps [i + j + k]++;
+
+    for (i = 0; i < CIC_BYTES; ++i)
+        for (j = 0; j < 256; ++j) {
+            int sum = 0;
+
+            for (k = 0; k < 8; ++k)
+                sum += (j & (1 << k)) ? taps [i * 8 + k] : -taps [i * 8 + k];
+
+            cic_tables [i] [j] = sum;
+        }
+
+    cic_tables_built = 1;
+}
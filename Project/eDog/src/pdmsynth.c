@@ -0,0 +1,282 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// pdmsynth.c
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+// This is a command-line program that converts raw PCM audio (16-bit mono, 16 kHz, like the
+// scantest and simboard inputs) into the 1.024 MHz 1-bit PDM stream that the MP45DT02 microphone
+// would produce, so that the whole capture chain (waverecorder.c and the decimator) can be tested
+// on the host with "simboard -d" or pdmtest.
+//
+// The audio is first interpolated by 4 to 64 kHz with a windowed-sinc polyphase filter, and then
+// linearly interpolated by 16 to the PDM rate (the linear interpolation images are all near
+// multiples of 64 kHz, where the decimator's CIC stage has its nulls). The sigma-delta modulator
+// is 4th-order by default (like the microphone's) or optionally 2nd-order, and the integrators
+// are reset if the modulator ever goes unstable (which is counted and reported).
+//
+// The output is the sequence of 16-bit words as they would be read from the SPI2 data register
+// (stored little-endian). These are byte swapped by waverecorder.c before decimation, so the 8
+// earliest bits of each word are in its high byte, and within each byte the earliest bit is in
+// the LSB (the order that PDM_Filter_64_LSB() takes).
+//
+// Build right here on Cygwin or Linux:  gcc -O2 pdmsynth.c -o pdmsynth -lm
+
+#define PCM_RATE 16000
+#define UP_FIRST 4                      // windowed-sinc interpolation to 64 kHz
+#define UP_LINEAR 16                    // then linear interpolation to 1.024 MHz
+#define PDM_RATE (PCM_RATE * UP_FIRST * UP_LINEAR)
+
+#define SINC_TAPS 32                    // taps per phase of the first interpolator
+#define SINC_CUTOFF 7600.0              // passband edge (Hz)
+#define KAISER_BETA 8.0
+
+#define DEFAULT_LEVEL -6.0              // PCM full scale maps to this modulator input level (dB)
+#define UNSTABLE_LIMIT 1000.0           // integrator magnitude that's considered unstable
+
+#define BLOCK_SAMPLES 1024
+
+static const char *usage =
+" Usage:   pdmsynth [-options] infile.pcm outfile.pdm\n\n"
+" Options: -2  = use a 2nd-order sigma-delta modulator (default is 4th-order)\n"
+"          -gn = set the modulator level of PCM full scale in dB (default -6)\n"
+"          -q  = quiet (no statistics)\n\n";
+
+// The 4th-order modulator has a chain of integrators with distributed feedforward (CIFF). The
+// coefficients give a noise transfer function with all four zeros at DC and Butterworth poles
+// placed for a maximum out-of-band gain of 1.5 (the usual rule for a stable 1-bit modulator).
+
+static const double ciff_coeffs [4] = { 0.805636, 0.308928, 0.065113, 0.006265 };
+
+static double sinc_filter [UP_FIRST] [SINC_TAPS];
+static double integrators [4];
+static int order = 4, resets;
+
+static void init_sinc_filter (void);
+static double bessel_i0 (double x);
+static int modulate (double input);
+
+int main (argc, argv) int argc; char **argv;
+{
+    int error_count = 0, quiet = 0, bits = 0, num_samples, history_index = 0, i, j, k;
+    double level = DEFAULT_LEVEL, history [SINC_TAPS * 2], scale, previous = 0.0, seconds;
+    int16_t pcm [BLOCK_SAMPLES];
+    uint16_t *words = NULL;
+    FILE *infile = NULL, *outfile = NULL;
+    long total_samples = 0, total_words = 0, ones = 0;
+    uint32_t word = 0;
+    clock_t start;
+
+    // loop through command-line arguments
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+
+                    case '2':
+                        order = 2;
+                        break;
+
+                    case 'G': case 'g':
+                        level = strtod (++*argv, argv);
+                        --*argv;
+                        break;
+
+                    case 'Q': case 'q':
+                        quiet = 1;
+                        break;
+
+                    default:
+                        fprintf (stderr, "illegal option: %c !\n", **argv);
+                        ++error_count;
+                }
+        else if (!infile) {
+            infile = fopen (*argv, "rb");
+
+            if (!infile) {
+                fprintf (stderr, "can't open file for reading: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else if (!outfile) {
+            outfile = fopen (*argv, "wb");
+
+            if (!outfile) {
+                fprintf (stderr, "can't open file for writing: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else {
+            fprintf (stderr, "extra argument: %s !\n", *argv);
+            ++error_count;
+        }
+    }
+
+    // check for various command-line argument problems
+
+    if (!infile || !outfile) {
+        fputs (usage, stderr);
+        return 1;
+    }
+
+    if (error_count)
+        return 1;
+
+    if (level > 0.0) {
+        fprintf (stderr, "level can't be above 0 dB !\n");
+        return 1;
+    }
+
+    init_sinc_filter ();
+    memset (history, 0, sizeof (history));
+    scale = pow (10.0, level / 20.0) / 32768.0;
+    words = malloc (BLOCK_SAMPLES * UP_FIRST * UP_LINEAR / 16 * sizeof (uint16_t));
+    start = clock ();
+
+    while ((num_samples = fread (pcm, sizeof (int16_t), BLOCK_SAMPLES, infile)) > 0) {
+        int num_words = 0;
+
+        for (i = 0; i < num_samples; ++i) {
+
+            // the history is stored twice so that the most recent SINC_TAPS samples are contiguous
+
+            history [history_index] = history [history_index + SINC_TAPS] = pcm [i] * scale;
+
+            if (++history_index == SINC_TAPS)
+                history_index = 0;
+
+            for (j = 0; j < UP_FIRST; ++j) {
+                double *taps = history + history_index, sum = 0.0, step;
+
+                for (k = 0; k < SINC_TAPS; ++k)
+                    sum += sinc_filter [j] [k] * taps [k];
+
+                step = (sum - previous) / UP_LINEAR;
+
+                for (k = 1; k <= UP_LINEAR; ++k) {
+                    if (modulate (previous + step * k)) {
+                        word |= 1 << ((bits & 8 ? 0 : 8) + (bits & 7));
+                        ones++;
+                    }
+
+                    if (++bits == 16) {
+                        words [num_words++] = word;
+                        word = bits = 0;
+                    }
+                }
+
+                previous = sum;
+            }
+        }
+
+        fwrite (words, sizeof (uint16_t), num_words, outfile);
+        total_samples += num_samples;
+        total_words += num_words;
+    }
+
+    seconds = (double) (clock () - start) / CLOCKS_PER_SEC;
+
+    if (!quiet)
+        printf ("pdmsynth: %ld samples (%.2f seconds) to %ld PDM words with order %d modulator in %.2f seconds (%.1fx real time), %.2f%% ones, %d resets\n",
+            total_samples, total_samples / (double) PCM_RATE, total_words, order, seconds,
+            seconds > 0.0 ? total_samples / (double) PCM_RATE / seconds : 0.0,
+            total_words ? ones * 100.0 / (total_words * 16) : 0.0, resets);
+
+    fclose (infile);
+    fclose (outfile);
+    free (words);
+    return 0;
+}
+
+// Run one input sample through the sigma-delta modulator and return the output bit.
+
+static int modulate (double input)
+{
+    double feedback;
+    int bit, i;
+
+    if (order == 2) {
+        bit = integrators [1] >= 0.0;
+        feedback = bit ? 1.0 : -1.0;
+        integrators [0] += input - feedback;
+        integrators [1] += integrators [0] - feedback;
+    }
+    else {
+        double sum = input;
+
+        for (i = 0; i < 4; ++i)
+            sum += ciff_coeffs [i] * integrators [i];
+
+        bit = sum >= 0.0;
+        feedback = bit ? 1.0 : -1.0;
+        integrators [3] += integrators [2];
+        integrators [2] += integrators [1];
+        integrators [1] += integrators [0];
+        integrators [0] += input - feedback;
+    }
+
+    for (i = 0; i < order; ++i)
+        if (fabs (integrators [i]) > UNSTABLE_LIMIT) {
+            memset (integrators, 0, sizeof (integrators));
+            resets++;
+            break;
+        }
+
+    return bit;
+}
+
+// Design the polyphase interpolation filter (Kaiser windowed sinc). Phase j produces the output
+// that's j/UP_FIRST of an input sample after the newest sample in the first half of the window,
+// and each phase is normalized to unity DC gain.
+
+static void init_sinc_filter (void)
+{
+    int j, k;
+
+    for (j = 0; j < UP_FIRST; ++j) {
+        double sum = 0.0;
+
+        for (k = 0; k < SINC_TAPS; ++k) {
+            double t = (k - SINC_TAPS / 2 + 1) - (double) j / UP_FIRST;     // input sample offset
+            double x = 2.0 * SINC_CUTOFF / PCM_RATE * t, w = t / (SINC_TAPS / 2);
+            double sinc = x == 0.0 ? 1.0 : sin (M_PI * x) / (M_PI * x);
+
+            sinc_filter [j] [k] = fabs (w) < 1.0 ? sinc * bessel_i0 (KAISER_BETA * sqrt (1.0 - w * w)) : 0.0;
+            sum += sinc_filter [j] [k];
+        }
+
+        for (k = 0; k < SINC_TAPS; ++k)
+            sinc_filter [j] [k] /= sum;
+    }
+}
+
+// zero-order modified Bessel function of the first kind (for the Kaiser window)
+
+static double bessel_i0 (double x)
+{
+    double sum = 1.0, term = 1.0;
+    int k;
+
+    for (k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
@@ -0,0 +1,320 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// pdmtest.c
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#if defined (__i386__) || defined (__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#define PDM_OPEN_DECIMATOR
+#include "pdmdec.h"
+
+// This module provides a test harness for the pdmdec.c decimator that can be compiled as a
+// command-line program. It can decode a raw PDM file (1.024 MHz, in the byte and bit order that
+// PDM_Filter_64_LSB() takes, which is what waverecorder.c passes after its byte swap) into 16 kHz
+// PCM. With -w the file is instead the SPI words as read from the microphone (or generated by
+// pdmsynth), and they're byte swapped first just like waverecorder.c does. It can also measure
+// the frequency response of the complete filter by running sine waves through a sigma-delta
+// modulator and then the decimator, and it can benchmark the decimator.
+//
+// Build right here on Cygwin or Linux:  gcc -O2 -I../inc -I../../../Utilities/STM32F4-Discovery pdmtest.c pdmdec.c -o pdmtest -lm
+
+#define PCM_RATE 16000
+#define PDM_RATE (PCM_RATE * 64)
+#define BLOCK_BYTES (PCM_RATE / 125)    // 1 millisecond of PDM data
+#define BLOCK_SAMPLES (PCM_RATE / 1000)
+
+#define MIC_GAIN 50                     // same as waverecorder.c
+
+#define RESPONSE_AMPLITUDE 0.5          // sigma-delta input level (full scale = 1.0)
+#define RESPONSE_SETTLE_MSECS 100       // let the highpass and the FIR settle before measuring
+#define RESPONSE_MSECS 1000             // measure over 1 second (so integer frequencies have no leakage)
+
+#define BENCHMARK_SECONDS 60
+
+static const char *usage =
+" Usage:   pdmtest [-options] infile.pdm [outfile.pcm]\n"
+"          pdmtest -r | -b\n\n"
+" Options: -r  = measure the frequency response of the decimator (with a sigma-delta modulator)\n"
+"          -b  = benchmark the decimator (cycles and nanoseconds per output sample)\n"
+"          -w  = input file is 16-bit SPI words (as from pdmsynth) rather than filter bytes\n"
+"          -q  = quiet (no statistics)\n\n";
+
+static const int response_freqs [] = {
+    50, 100, 250, 500, 1000, 2000, 3000, 4000, 5000, 6000, 6500, 7000, 7500, 7800,
+    8200, 8500, 9000, 10000, 12000, 15000, 17000, 20000, 25000, 31000, 33000, 39000, 57000, 0
+};
+
+static void init_filter (PDMFilter_InitStruct *filter);
+static void modulate (uint8_t *pdm, int num_bytes, double freq, double amplitude, uint32_t *phase, double *state);
+static void response (void);
+static void benchmark (void);
+
+int main (argc, argv) int argc; char **argv;
+{
+    int error_count = 0, run_response = 0, run_benchmark = 0, spi_words = 0, quiet = 0, blocks = 0, clipped = 0, i;
+    FILE *infile = NULL, *outfile = NULL;
+    PDMFilter_InitStruct filter;
+    uint8_t pdm [BLOCK_BYTES];
+    int16_t pcm [BLOCK_SAMPLES];
+    double sum_squares = 0.0;
+
+    // loop through command-line arguments
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+
+                    case 'R': case 'r':
+                        run_response = 1;
+                        break;
+
+                    case 'B': case 'b':
+                        run_benchmark = 1;
+                        break;
+
+                    case 'W': case 'w':
+                        spi_words = 1;
+                        break;
+
+                    case 'Q': case 'q':
+                        quiet = 1;
+                        break;
+
+                    default:
+                        fprintf (stderr, "illegal option: %c !\n", **argv);
+                        ++error_count;
+                }
+        else if (!infile) {
+            infile = fopen (*argv, "rb");
+
+            if (!infile) {
+                fprintf (stderr, "can't open file for reading: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else if (!outfile) {
+            outfile = fopen (*argv, "wb");
+
+            if (!outfile) {
+                fprintf (stderr, "can't open file for writing: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else {
+            fprintf (stderr, "extra argument: %s !\n", *argv);
+            ++error_count;
+        }
+    }
+
+    if (error_count)
+        return 1;
+
+    if (run_response || run_benchmark) {
+        if (run_response)
+            response ();
+
+        if (run_benchmark)
+            benchmark ();
+
+        return 0;
+    }
+
+    if (!infile) {
+        fputs (usage, stderr);
+        return 1;
+    }
+
+    init_filter (&filter);
+
+    while (fread (pdm, 1, BLOCK_BYTES, infile) == BLOCK_BYTES) {
+        if (spi_words)
+            for (i = 0; i < BLOCK_BYTES; i += 2) {
+                uint16_t word = pdm [i] | (pdm [i + 1] << 8);
+
+                pdm [i] = word >> 8;
+                pdm [i + 1] = (uint8_t) word;
+            }
+
+        PDM_Filter_64_LSB (pdm, (uint16_t *) pcm, MIC_GAIN, &filter);
+
+        for (i = 0; i < BLOCK_SAMPLES; ++i) {
+            sum_squares += (double) pcm [i] * pcm [i];
+
+            if (pcm [i] == 32767 || pcm [i] == -32768)
+                clipped++;
+        }
+
+        if (outfile)
+            fwrite (pcm, sizeof (int16_t), BLOCK_SAMPLES, outfile);
+
+        blocks++;
+    }
+
+    if (!quiet)
+        printf ("pdmtest: %d PDM bytes decoded to %d samples (%.2f seconds), RMS level = %.2f dBFS, %d samples clipped\n",
+            blocks * BLOCK_BYTES, blocks * BLOCK_SAMPLES, blocks / 1000.0,
+            blocks ? 10.0 * log10 (sum_squares / (blocks * BLOCK_SAMPLES) / (32768.0 * 32768.0) + 1e-20) : -200.0, clipped);
+
+    fclose (infile);
+
+    if (outfile)
+        fclose (outfile);
+
+    return 0;
+}
+
+// same filter configuration as WaveRecorderInit()
+
+static void init_filter (PDMFilter_InitStruct *filter)
+{
+    memset (filter, 0, sizeof (*filter));
+    filter->LP_HZ = 8000;
+    filter->HP_HZ = 10;
+    filter->Fs = PCM_RATE;
+    filter->Out_MicChannels = 1;
+    filter->In_MicChannels = 1;
+    PDM_Filter_Init (filter);
+}
+
+// Generate PDM data for a sine wave with a second-order sigma-delta modulator (like the one in
+// the microphone), continuing from the given phase (in 1/2^32 cycles) and integrator state.
+
+static void modulate (uint8_t *pdm, int num_bytes, double freq, double amplitude, uint32_t *phase, double *state)
+{
+    uint32_t delta = (uint32_t) floor (freq / PDM_RATE * 4294967296.0 + 0.5);
+    int i, j;
+
+    for (i = 0; i < num_bytes; ++i) {
+        pdm [i] = 0;
+
+        for (j = 0; j < 8; ++j) {
+            double input = amplitude * sin (*phase * (2.0 * M_PI / 4294967296.0)), feedback = state [1] >= 0.0 ? 1.0 : -1.0;
+
+            state [0] += input - feedback;
+            state [1] += state [0] - feedback;
+
+            if (feedback > 0.0)
+                pdm [i] |= 1 << j;
+
+            *phase += delta;
+        }
+    }
+}
+
+// Measure the level of each test frequency (or its alias, for those above 8 kHz) in the decimator
+// output with a quadrature detector, and display it relative to the 1 kHz level.
+
+static void response (void)
+{
+    double level_1k = 0.0, *levels = malloc (sizeof (response_freqs) / sizeof (response_freqs [0]) * sizeof (double));
+    PDMFilter_InitStruct filter;
+    int f, i, j;
+
+    init_filter (&filter);
+
+    for (f = 0; response_freqs [f]; ++f) {
+        double state [2] = { 0.0, 0.0 }, sum_i = 0.0, sum_q = 0.0;
+        int freq = response_freqs [f], alias = freq % PCM_RATE;
+        uint32_t phase = 0;
+        uint8_t pdm [BLOCK_BYTES];
+        int16_t pcm [BLOCK_SAMPLES];
+
+        if (alias > PCM_RATE / 2)
+            alias = PCM_RATE - alias;
+
+        PDM_Filter_Init (&filter);           // reset the same instance for each frequency
+
+        for (i = 0; i < RESPONSE_SETTLE_MSECS + RESPONSE_MSECS; ++i) {
+            modulate (pdm, BLOCK_BYTES, freq, RESPONSE_AMPLITUDE, &phase, state);
+            PDM_Filter_64_LSB (pdm, (uint16_t *) pcm, 64, &filter);
+
+            if (i >= RESPONSE_SETTLE_MSECS)
+                for (j = 0; j < BLOCK_SAMPLES; ++j) {
+                    double angle = 2.0 * M_PI * alias * ((i - RESPONSE_SETTLE_MSECS) * BLOCK_SAMPLES + j) / PCM_RATE;
+
+                    sum_i += pcm [j] * cos (angle);
+                    sum_q += pcm [j] * sin (angle);
+                }
+        }
+
+        levels [f] = 2.0 * sqrt (sum_i * sum_i + sum_q * sum_q) / (RESPONSE_MSECS * BLOCK_SAMPLES);
+
+        if (freq == 1000)
+            level_1k = levels [f];
+    }
+
+    printf ("\ndecimator frequency response (sigma-delta input at %.1f dBFS, output relative to 1 kHz):\n\n", 20.0 * log10 (RESPONSE_AMPLITUDE));
+
+    for (f = 0; response_freqs [f]; ++f) {
+        int freq = response_freqs [f], alias = freq % PCM_RATE;
+
+        if (alias > PCM_RATE / 2)
+            alias = PCM_RATE - alias;
+
+        if (alias != freq)
+            printf ("  %5d Hz (alias at %4d Hz): %8.2f dB\n", freq, alias, 20.0 * log10 (levels [f] / level_1k + 1e-10));
+        else
+            printf ("  %5d Hz                   : %8.2f dB\n", freq, 20.0 * log10 (levels [f] / level_1k + 1e-10));
+    }
+
+    printf ("\n  1 kHz output level = %.1f dBFS\n\n", 20.0 * log10 (level_1k / 32768.0));
+    free (levels);
+}
+
+// Decimate a minute of sigma-delta modulated audio and report the time per output sample (and the
+// CPU cycles on x86, where the time stamp counter is available).
+
+static void benchmark (void)
+{
+    uint8_t *pdm = malloc (BENCHMARK_SECONDS * 1000 * BLOCK_BYTES);
+    double state [2] = { 0.0, 0.0 }, seconds;
+    int num_samples = BENCHMARK_SECONDS * 1000 * BLOCK_SAMPLES, i;
+    PDMFilter_InitStruct filter;
+    int16_t pcm [BLOCK_SAMPLES];
+    uint32_t phase = 0;
+    clock_t start;
+#if defined (__i386__) || defined (__x86_64__)
+    unsigned long long start_cycles, cycles;
+#endif
+
+    modulate (pdm, BENCHMARK_SECONDS * 1000 * BLOCK_BYTES, 1000.0, RESPONSE_AMPLITUDE, &phase, state);
+    init_filter (&filter);
+    start = clock ();
+#if defined (__i386__) || defined (__x86_64__)
+    start_cycles = __rdtsc ();
+#endif
+
+    for (i = 0; i < BENCHMARK_SECONDS * 1000; ++i)
+        PDM_Filter_64_LSB (pdm + i * BLOCK_BYTES, (uint16_t *) pcm, MIC_GAIN, &filter);
+
+#if defined (__i386__) || defined (__x86_64__)
+    cycles = __rdtsc () - start_cycles;
+#endif
+    seconds = (double) (clock () - start) / CLOCKS_PER_SEC;
+
+    printf ("benchmark: %d seconds of PDM decimated in %.3f seconds (%.1fx real time), %.1f nsecs per sample",
+        BENCHMARK_SECONDS, seconds, seconds > 0.0 ? BENCHMARK_SECONDS / seconds : 0.0, seconds * 1e9 / num_samples);
+#if defined (__i386__) || defined (__x86_64__)
+    printf (", %.1f cycles per sample", (double) cycles / num_samples);
+#endif
+    printf ("\n");
+    free (pdm);
+}
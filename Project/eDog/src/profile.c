@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// profile.c
+
+#ifdef HOST_SIM
+#include <simboard.h>
+#endif
+#include <string.h>
+
+#include "profile.h"
+#include "serial.h"
+
+// The statistics can be updated from both the main loop and PendSV (with USB_RECORDER the audio
+// processing and the console run there, and the logging stage is timed in both), so they are
+// only updated, reset or copied with interrupts disabled. The total is 64 bits so the mean stays
+// right for as long as the dog is running.
+
+struct stage {
+    uint32_t count, min, max;
+    uint64_t total;
+    uint32_t histogram [PROFILE_BUCKETS];
+};
+
+static const char *stage_names [PROFILE_NUM_STAGES] = {
+    "fill_buffer", "scan", "check_peaks", "canned audio", "logging"
+};
+
+static struct stage stages [PROFILE_NUM_STAGES];
+
+// number of significant bits in the cycle count (which is also the histogram bucket)
+
+#ifdef HOST_SIM
+#define COUNT_BITS(x) ((x) ? 32 - __builtin_clz (x) : 0)
+#else
+#define COUNT_BITS(x) (32 - __CLZ (x))
+#endif
+
+void profile_add (int stage, uint32_t cycles)
+{
+    struct stage *s = stages + stage;
+    int bucket = COUNT_BITS (cycles);
+
+    __disable_irq ();
+
+    if (!s->count++ || cycles < s->min)
+        s->min = cycles;
+
+    if (cycles > s->max)
+        s->max = cycles;
+
+    s->total += cycles;
+    s->histogram [bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1]++;
+    __enable_irq ();
+}
+
+// Display the statistics for every stage that has run, with the max as a percentage of the
+// specified deadline (in cycles), and then the non-empty histogram buckets (labeled with the
+// log2 of their upper limit, so "12=5" means 5 calls took under 4096 cycles, but at least 2048,
+// and "more" is for the ones beyond the last bucket). Each bucket is a separate call because
+// Dbg_printf() is limited to 128 characters. Each stage is copied before it's displayed (the
+// displaying itself updates the logging stage).
+
+void profile_dump (uint32_t deadline)
+{
+    int i, j;
+
+    Dbg_printf ("profile: cycles per call, deadline = %u\n", deadline);
+
+    for (i = 0; i < PROFILE_NUM_STAGES; ++i) {
+        struct stage copy, *s = &copy;
+
+        __disable_irq ();
+        copy = stages [i];
+        __enable_irq ();
+
+        if (!s->count)
+            continue;
+
+        Dbg_printf ("%-12s calls = %u, min/mean/max = %u/%u/%u (max is %u.%u%% of deadline)\n",
+            stage_names [i], s->count, s->min, (uint32_t) (s->total / s->count), s->max,
+            (uint32_t) ((uint64_t) s->max * 100 / deadline), (uint32_t) ((uint64_t) s->max * 1000 / deadline % 10));
+
+        Dbg_puts ("             log2:");
+
+        for (j = 0; j < PROFILE_BUCKETS; ++j)
+            if (s->histogram [j] && j < PROFILE_BUCKETS - 1)
+                Dbg_printf (" %d=%u", j, s->histogram [j]);
+            else if (s->histogram [j])
+                Dbg_printf (" more=%u", s->histogram [j]);
+
+        Dbg_puts ("\n");
+    }
+}
+
+void profile_reset (void)
+{
+    __disable_irq ();
+    memset (stages, 0, sizeof (stages));
+    __enable_irq ();
+}
@@ -24,9 +24,12 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "scan.h"
+#include "profile.h"
+#include "logfmt.h"
 
 // Local macros. Some are configurable to change the characteristics of the detection.
 
@@ -51,6 +54,56 @@
 #define LOW_THRESHOLD_SCALING 1.5F
 #define THRESHOLD_SCALING (flags & SCAN_HIGH_SENSITIVITY ? HIGH_THRESHOLD_SCALING : LOW_THRESHOLD_SCALING)
 
+// The base peak threshold comes either from the original adaptive controller or from the noise floor tracker
+
+#define PEAK_THRESHOLD (flags & SCAN_FLOOR_THRESHOLD ? floor_threshold : peak_threshold)
+
+// The noise floor tracker keeps a sliding histogram of the largest windowed level seen in each analysis interval over
+// the last FLOOR_INTERVALS intervals (6.4 seconds). The bins are spaced logarithmically (8 per octave) and the floor is
+// taken at the level exceeded by FLOOR_EXCEEDANCES of the intervals, which is about one per second, just like the
+// target of the adaptive controller.
+
+#define FLOOR_INTERVALS 64
+#define FLOOR_EXCEEDANCES (FLOOR_INTERVALS / 10)
+#define FLOOR_BINS_PER_OCTAVE 8
+#define FLOOR_BINS (FLOOR_BINS_PER_OCTAVE * 16)
+
+// The smoke/CO alarm detector classifies the output of a 3.2 kHz bandpass as "beeping" or not once every ALARM_TICK
+// samples (1 ms), with hysteresis, and then matches the durations of the beeps and gaps against the standard T3 (smoke)
+// and T4 (CO) temporal patterns. These are the acceptable ranges (in ms) for each, and the number of complete groups
+// (of 3 or 4 beeps) we need to hear before we report a detection.
+
+#define ALARM_TICK 16
+#define ALARM_ON_LEVEL (NORMALIZATION_LEVEL * 0.6F)
+#define ALARM_OFF_LEVEL (NORMALIZATION_LEVEL * 0.4F)
+
+#define T3_MIN_BEEP 350
+#define T3_MAX_BEEP 750
+#define T3_MIN_LONG_GAP 1000
+#define T3_MAX_LONG_GAP 2500
+
+#define T4_MIN_BEEP 50
+#define T4_MAX_BEEP 200
+#define T4_MIN_LONG_GAP 1000
+#define T4_MAX_LONG_GAP 7000
+
+#define ALARM_GROUPS (flags & SCAN_HIGH_SENSITIVITY ? 1 : 2)
+
+// The glass-break detector works on whole windows (WINDOW_SIZE samples, or 16 ms). It looks for an impact (a window
+// much louder than the background that's also dominated by high frequencies) followed by GLASS_RING_WINDOWS windows of
+// ringing that mostly stay high frequency, decay without any new impacts, and are still well above the background at
+// the end. The high-frequency ratio is the level of the first difference over twice the level, which is about 0.7 for
+// white noise and approaches 1.0 as the energy moves toward the Nyquist frequency.
+
+#define GLASS_IMPACT_RATIO (flags & SCAN_HIGH_SENSITIVITY ? 6.0F : 10.0F)
+#define GLASS_MIN_HF_RATIO 0.75F
+#define GLASS_RING_WINDOWS 12
+#define GLASS_MIN_HF_WINDOWS (GLASS_RING_WINDOWS * 3 / 4)
+#define GLASS_MAX_REGROWTH 1.5F
+#define GLASS_MAX_FINAL_LEVEL 0.5F
+#define GLASS_MIN_FINAL_RATIO 3.0F
+#define GLASS_HOLDOFF_WINDOWS 64
+
 #define HIGH_SPURIOUS_REJECTION_RATIO 0.75F
 #define LOW_SPURIOUS_REJECTION_RATIO 0.5F
 #define SPURIOUS_REJECTION_RATIO (flags & SCAN_HIGH_SENSITIVITY ? HIGH_SPURIOUS_REJECTION_RATIO : LOW_SPURIOUS_REJECTION_RATIO)
@@ -61,7 +114,7 @@ static struct biquad {
     float a0, a1, a2, b1, b2;	// coefficients
     float in_d1, in_d2;	        // delayed input
     float out_d1, out_d2;	    // delayed output
-} bell_biquad;
+} bell_biquad, alarm_biquad;
 
 // This structure represents a detected transient in the audio. We keep an array of these around by adding new
 // transients to the end of the array and deleting expired ones off the beginning.
@@ -76,30 +129,112 @@ static struct peak {
 
 static int16_t sample_window [WINDOW_SIZE];
 static int num_peaks, sample_index;    
-static float filtered_level;
+static float filtered_level, peak_threshold = 30.0F, floor_threshold = 30.0F;
+
+// These are the sliding histogram used for the noise floor (see above) and the history of the bins that were added
+// to it, so that each can be removed again when it expires.
+
+static uint8_t floor_histogram [FLOOR_BINS], floor_history [FLOOR_INTERVALS];
+static int floor_index, interval_max_level;
+
+// In the early-decision mode a knock is reported provisionally as soon as its third peak is captured, and then
+// held here until either the normal confirmation point is reached or a spurious peak shows up and retracts it.
+// We identify the pending peaks by time rather than index because the peak buffer shifts underneath us.
+
+static struct knock {
+    int times [3], heights [3], span;
+    float ratio, rejection_height, spurious_margin, confidence;
+} pending_knock;
 
-// Local functions (except for Dbg_printf() which is external)
+static int knock_pending;
+
+// This is the state of the alarm pattern matcher. The "pattern" is the number of beeps per group (3 or 4) that the
+// current beeps match, or zero if we haven't classified the first beep yet.
+
+static struct alarm {
+    int beeping, run_ticks, pattern, beeps, groups, start_time;
+    float level, beep_peak_level, beep_level_sum;
+} alarm;
+
+// This is the state of the glass-break detector. The sums are accumulated over the current window, and "windows" is
+// the number of ringing windows seen since the impact (or zero if we're not following one, or negative during the
+// holdoff after a detection so that the tail of the same break isn't detected again).
+
+static struct glass {
+    int level_sum, hf_sum, windows, hf_windows, impact_time;
+    float background, impact_level, impact_hf_ratio, last_level;
+    int16_t last_sample;
+} glass;
+
+// While scan_audio_detect() is running, detection records are written to the caller's array through these
+// (records that don't fit are dropped, but the returned bitmask always reflects every detection)
+
+static struct scan_detection *detection_records;
+static int max_detection_records, num_detection_records;
+
+// These are the bells that the ring detector can be tuned to (see scan_audio_init() for where the coefficients came
+// from), and the running counts of peaks and detections (for display on the debug console)
+
+static const struct bell {
+    int frequency;
+    float a0, a1, a2, b1, b2;
+} bells [] = {
+    { 770, 0.0014867434962988915F, 0.0F, -0.0014867434962988915F, -1.9064233259820802F, 0.9970265130074023F },  // Q = 100
+    { 785, 0.001514749455122275F, 0.0F, -0.001514749455122275F, -1.9028338435963745F, 0.9969705010897554F }     // Q = 100
+};
+
+#define NUM_BELLS (sizeof (bells) / sizeof (bells [0]))
+
+static int bell_id;
+static struct scan_stats stats;
+
+// Local functions (the debug messages are logged with Dbg_log(), see logfmt.h)
 
-extern void Dbg_printf (const char *format, ...);
-static char *time_format (int time_in_samples);
 static void biquad_init (struct biquad *f, float gain, float a0, float a1, float a2, float b1, float b2);
 static float biquad_apply (struct biquad *f, float input);
 static void add_peak (struct peak *new_peak, int flags);
 static int check_peaks (int flags);
+static int find_knock (struct knock *knock, int flags);
+static int spurious_peak (struct knock *knock, float *max_height);
+static void record_knock (struct knock *knock, int type);
+static struct scan_detection *new_record (int type);
+static void update_floor (int level);
+static int floor_bin (int level);
+static float floor_bin_level (int bin);
+static int check_alarm (int flags);
+static void reset_alarm (void);
+static int check_glass (int flags);
 
 // Initialize the audio scanner. Currently, all this does is initialize the biquad filter that is used to
 // detect the bell. It should be a narrow bandpass tuned to the fundamental of the desired bell (not a
 // harmonic). I measured my doorbell's frequency (the "ding", not the lower "dong") at 770 Hz and used
 // the biquad generator at http://www.earlevel.com/main/2013/10/13/biquad-calculator-v2/ using a "Q" of
 // 100. I measured a newer wireless doorbell (that only had a "ding") at 785 Hz and have included those
-// coefficients also.
+// coefficients also (in the bells table above, selected with scan_select_bell()).
 
 void scan_audio_init (void)
 {
-    biquad_init (&bell_biquad, 4.0F,
-        0.0014867434962988915F, 0.0F, -0.0014867434962988915F, -1.9064233259820802F, 0.9970265130074023F    // 770 Hz, Q = 100
-        // 0.001514749455122275F, 0.0F, -0.001514749455122275F, -1.9028338435963745F, 0.9969705010897554F      // 785 Hz, Q = 100
+    int i;
+
+    memset (&stats, 0, sizeof (stats));     // the counts start over with the scanner
+
+    // Start the noise floor history out at the same level as the adaptive threshold's initial value
+
+    memset (floor_histogram, 0, sizeof (floor_histogram));
+
+    for (i = 0; i < FLOOR_INTERVALS; ++i)
+        floor_histogram [floor_history [i] = floor_bin (30)]++;
+
+    scan_select_bell (bell_id);
+
+    // The alarm filter is much wider because the piezo sounders in smoke and CO alarms vary quite a bit (about 2.9 to
+    // 3.5 kHz), and it has unity gain so that a pure tone at the center produces the normalization level.
+
+    biquad_init (&alarm_biquad, 1.0F,
+        0.10625075537885177F, 0.0F, -0.10625075537885177F, -0.5523674105954138F, 0.7874984892422964F    // 3200 Hz, Q = 4
     );
+
+    reset_alarm ();
 }
 
 // Scan the supplied mono audio samples and return any detected "knocks" or "rings". The "out_samples"
@@ -110,12 +245,26 @@ void scan_audio_init (void)
 
 int scan_audio (int16_t *in_samples, int num_samples, int16_t *out_samples, int flags)
 {
-    static float decorrelated_level = 32760.0F, peak_threshold = 30.0F;
+    return scan_audio_detect (in_samples, num_samples, out_samples, flags, NULL, NULL);
+}
+
+// This is the same as scan_audio(), but in addition to the bitmask it writes a record describing each detection into the
+// caller's "records" array. On entry "num_records" holds the capacity of the array, and on return it holds the number of
+// records written. Either may be NULL if only the bitmask is wanted.
+
+int scan_audio_detect (int16_t *in_samples, int num_samples, int16_t *out_samples, int flags,
+    struct scan_detection *records, int *num_records)
+{
+    static float decorrelated_level = 32760.0F;
     static int peak_started, window_index, window_sum;    
     static int16_t last_sample, weight;
 
     int detections = 0;
 
+    detection_records = records;
+    max_detection_records = (records && num_records) ? *num_records : 0;
+    num_detection_records = 0;
+
     while (num_samples--) {
         int16_t sample = *in_samples, window_level;
         float normalized_sample, filtered_sample;
@@ -174,6 +323,21 @@ int scan_audio (int16_t *in_samples, int num_samples, int16_t *out_samples, int
         if (out_samples && (flags & SCAN_OUTP_WINDOW_LEVEL))
             *out_samples++ = window_level;
 
+        if (window_level > interval_max_level)
+            interval_max_level = window_level;
+
+        // If the glass-break detector is enabled, we accumulate the absolute level of the decorrelated audio and
+        // of its first difference (which emphasizes the high frequencies), and then analyze those once per window.
+
+        if (flags & SCAN_DETECT_GLASS) {
+            glass.level_sum += abs (sample);
+            glass.hf_sum += abs (sample - glass.last_sample);
+            glass.last_sample = sample;
+
+            if (!window_index)
+                detections |= check_glass (flags);
+        }
+
         // Independent of the windowing stuff, we also filter the normalized audio with a biquad
         // bandpass tuned to the fundamental frequency of our target "bell", and then calculate
         // a exponentially decaying average on that signal. Because we specified an initial gain
@@ -198,6 +362,17 @@ int scan_audio (int16_t *in_samples, int num_samples, int16_t *out_samples, int
         if (out_samples && (flags & SCAN_OUTP_FILTER_LEVEL))
             *out_samples++ = filtered_level;
 
+        // If the alarm detector is enabled, we also filter the normalized audio with a wider bandpass centered on
+        // the frequency of smoke alarm sounders and keep the decaying average of that. Everything else about the
+        // alarm detection is done once per millisecond.
+
+        if (flags & SCAN_DETECT_ALARM) {
+            alarm.level = alarm.level * (255.0F / 256.0F) + fabsf (biquad_apply (&alarm_biquad, normalized_sample)) * (1.0F / 256.0F);
+
+            if (!(sample_index % ALARM_TICK))
+                detections |= check_alarm (flags);
+        }
+
         // Finally, we capture the potential transients. The algorithm is to keep track of every contiguous
         // region of positive windowed level (indicating that the average value in the window is greater
         // than the target normalization). For each of these areas we keep track of the maximum value (which
@@ -227,21 +402,21 @@ int scan_audio (int16_t *in_samples, int num_samples, int16_t *out_samples, int
                 // threshold to allow a peak approximately every second (on average) and then use a second
                 // "real" threshold that is a scaled version of the first. This allows our detector to adjust
                 // to quiet environments by becoming more sensitive and avoid unnessary triggering in noisier
-                // environments by becoming insensitive.
+                // environments by becoming insensitive. The adaptive threshold is always maintained, but if
+                // SCAN_FLOOR_THRESHOLD is set we use the noise floor tracker's threshold instead.
 
-                if (current_peak.height > peak_threshold) {
+                if (current_peak.height > peak_threshold)
                     peak_threshold *= 1.01F;    // bump threshold 1% each detected peak to target 1 per second
 
-                    if (current_peak.height > peak_threshold * THRESHOLD_SCALING) {
-                        current_peak.width = current_peak.area / current_peak.height;
+                if (current_peak.height > PEAK_THRESHOLD * THRESHOLD_SCALING) {
+                    current_peak.width = current_peak.area / current_peak.height;
+                    stats.peaks++;
 
-                        if (flags & SCAN_DISP_PEAKS)
-                            Dbg_printf ("peak added, time = %s, height = %d, width = %d, filtered level = %.2f\n",
-                                time_format (current_peak.time), current_peak.height,
-                                current_peak.width, current_peak.filtered_level);
+                    if (flags & SCAN_DISP_PEAKS)
+                        Dbg_log (LOG_PEAK_ADDED, current_peak.time, current_peak.height,
+                            current_peak.width, current_peak.filtered_level);
 
-                        add_peak (&current_peak, flags);
-                    }
+                    add_peak (&current_peak, flags);
                 }
             }
             else
@@ -253,21 +428,29 @@ int scan_audio (int16_t *in_samples, int num_samples, int16_t *out_samples, int
         // peak before issuing a detection, and it allows the peak buffer to be cleared of expired peaks.
 
         if (++sample_index % ANALYSIS_INTERVAL == 0) {
+            uint32_t start = profile_begin ();
+
             detections |= check_peaks (flags);
+            profile_end (PROFILE_PEAKS, start);
             peak_threshold *= 0.999F;           // peak threshold decays about 1% per second
+            update_floor (interval_max_level);
+            interval_max_level = 0;
         }
 
         // Optionally display the peak thresholds every 10 seconds for debugging
 
         if ((flags & SCAN_DISP_THRESHOLDS) && sample_index % (SAMPLING_RATE * 10) == 0)
-            Dbg_printf ("peak_threshold = %.2f base, %.2f actual\n", peak_threshold, peak_threshold * THRESHOLD_SCALING);
+            Dbg_log (LOG_THRESHOLDS, PEAK_THRESHOLD, PEAK_THRESHOLD * THRESHOLD_SCALING, floor_threshold);
 
         // We work on a 24-hour loop for the sample_index, but we should only reset it when nothing's going on...
 
-        if (sample_index > SAMPLING_RATE * 3600 * 24 && !num_peaks && !peak_started)
+        if (sample_index > SAMPLING_RATE * 3600 * 24 && !num_peaks && !peak_started && !knock_pending)
             sample_index %= SAMPLING_RATE * 3600 * 24;
     }
 
+    if (num_records)
+        *num_records = num_detection_records;
+
     return detections;
 }
 
@@ -288,7 +471,7 @@ static void add_peak (struct peak *new_peak, int flags)
 
         if (smallest_peak_index == -1) {
             if (flags & SCAN_DISP_EVENTS)
-                Dbg_printf ("add_peak(): discarded newest peak (height = %d) because buffer was full!\n", new_peak->height);
+                Dbg_log (LOG_DISCARD_NEWEST, new_peak->height);
 
             return;
         }
@@ -297,7 +480,7 @@ static void add_peak (struct peak *new_peak, int flags)
             peak_buffer [i] = peak_buffer [i+1];
 
         if (flags & SCAN_DISP_EVENTS)
-            Dbg_printf ("add_peak(): discarded smallest peak (height = %d) because buffer was full!\n", smallest_peak_height);
+            Dbg_log (LOG_DISCARD_SMALLEST, smallest_peak_height);
 
         num_peaks--;
     }
@@ -306,74 +489,521 @@ static void add_peak (struct peak *new_peak, int flags)
 }
 
 // Check the current peak buffer for any "knocks" or "rings" that meet our defined parameters. The "flags" parameter is just
-// used (for now) to control logging output and the high sensitivity mode. The return value indicates any detections. Note
-// that any detections cause the peak buffer to be cleared so that we don't detect the same event again, although it could
-// be problematic if we ever want to mask events at a higher level (e.g. a detected "knock" might wipe out a pending "ring").
+// used (for now) to control logging output, the high sensitivity mode and the early-decision mode. The return value indicates
+// any detections. Note that any detections cause the peak buffer to be cleared so that we don't detect the same event again,
+// although it could be problematic if we ever want to mask events at a higher level (e.g. a detected "knock" might wipe out
+// a pending "ring").
+//
+// Normally we can't confirm a knock until we have watched the period after the third peak for spurious peaks, which costs up
+// to half the knock span in latency. In the early-decision mode (SCAN_EARLY_DECISION) we instead report the knock as
+// provisional right away, and then either confirm it at the normal point or retract it if a spurious peak arrives first.
 
 static int check_peaks (int flags)
 {
-    int detections = 0;
-    int p1, p2, p3, i;
+    struct scan_detection *record;
+    int detections = 0, p1;
 
     while (num_peaks && peak_buffer [0].time + KNOCK_MAX_SPAN * 2 < sample_index) {
-        for (i = 0; i < num_peaks - 1; ++i)
-            peak_buffer [i] = peak_buffer [i+1];
+        for (p1 = 0; p1 < num_peaks - 1; ++p1)
+            peak_buffer [p1] = peak_buffer [p1+1];
         num_peaks--;
     }
 
+    if (knock_pending) {
+        float max_height;
+
+        if (spurious_peak (&pending_knock, &max_height)) {
+            if (flags & SCAN_DISP_EVENTS)
+                Dbg_log (LOG_KNOCK_RETRACTED, pending_knock.times [0], max_height, pending_knock.rejection_height);
+
+            pending_knock.spurious_margin = 1.0F - max_height / pending_knock.rejection_height;
+            record_knock (&pending_knock, SCAN_KNOCK_RETRACTED);
+            detections |= SCAN_KNOCK_RETRACTED;
+            knock_pending = 0;
+        }
+        else if (pending_knock.times [2] + (pending_knock.span / 2) < sample_index) {
+            if (flags & SCAN_DISP_EVENTS)
+                Dbg_log (LOG_KNOCK_CONFIRMED, pending_knock.times [0], pending_knock.span, pending_knock.ratio, pending_knock.confidence);
+
+            record_knock (&pending_knock, SCAN_KNOCK_DETECTED);
+            detections |= SCAN_KNOCK_DETECTED;
+            knock_pending = 0;
+            num_peaks = 0;
+        }
+    }
+    else if (find_knock (&pending_knock, flags)) {
+        if (pending_knock.times [2] + (pending_knock.span / 2) < sample_index) {
+            record_knock (&pending_knock, SCAN_KNOCK_DETECTED);
+            detections |= SCAN_KNOCK_DETECTED;
+            num_peaks = 0;
+        }
+        else {
+            if (flags & SCAN_DISP_EVENTS)
+                Dbg_log (LOG_KNOCK_PROVISIONAL, pending_knock.times [0], pending_knock.span, pending_knock.ratio, pending_knock.confidence);
+
+            record_knock (&pending_knock, SCAN_KNOCK_PROVISIONAL);
+            detections |= SCAN_KNOCK_PROVISIONAL;
+            knock_pending = 1;
+        }
+    }
+
+    for (p1 = 0; p1 < num_peaks; ++p1)
+        if (peak_buffer [p1].time + SAMPLING_RATE > sample_index && filtered_level > peak_buffer [p1].filtered_level * 2 + 50)
+            if (++peak_buffer [p1].filter_hits == 5) {
+                if (flags & SCAN_DISP_EVENTS)
+                    Dbg_log (LOG_RING_DETECTED, peak_buffer [p1].time, (sample_index - peak_buffer [p1].time) / (float) SAMPLING_RATE,
+                        peak_buffer [p1].filtered_level, filtered_level);
+
+                if (knock_pending) {
+                    record_knock (&pending_knock, SCAN_KNOCK_RETRACTED);
+                    detections |= SCAN_KNOCK_RETRACTED;
+                    knock_pending = 0;
+                }
+
+                if ((record = new_record (SCAN_BELL_DETECTED))) {
+                    float trigger_level = peak_buffer [p1].filtered_level * 2 + 50;
+
+                    record->time = peak_buffer [p1].time;
+                    record->span = sample_index - peak_buffer [p1].time;
+                    record->min_height = record->max_height = peak_buffer [p1].height;
+                    record->filter_excess = filtered_level / trigger_level;
+                    record->bell_id = bell_id;
+                    record->confidence = 1.0F - trigger_level / filtered_level;
+                }
+
+                detections |= SCAN_BELL_DETECTED;
+                num_peaks = 0;
+                break;
+            }
+
+    return detections;
+}
+
+// Search the peak buffer for three peaks that qualify as a "knock" and fill in the supplied structure if one is found. Unless
+// we are in the early-decision mode we only consider knocks whose following quiet period (half the span) has fully elapsed.
+// The confidence score is a blend of how well the spacing matched, how far the largest competing peak was below the spurious
+// rejection level, and how far the weakest knock cleared the current peak threshold (each term ranges from 0 to 1).
+
+static int find_knock (struct knock *knock, int flags)
+{
+    int p1, p2, p3;
+
     for (p1 = 0; p1 < num_peaks - 2; ++p1)
         for (p2 = p1 + 1; p2 < num_peaks - 1; ++p2)
-            for (p3 = p2 + 1; !detections && p3 < num_peaks; ++p3) {
+            for (p3 = p2 + 1; p3 < num_peaks; ++p3) {
                 int span = peak_buffer [p3].time - peak_buffer [p1].time;
 
                 if (span > KNOCK_MIN_SPAN && span < KNOCK_MAX_SPAN && 
                     peak_buffer [p1].width < 512 && peak_buffer [p2].width < 512 && peak_buffer [p3].width < 512 &&
-                    peak_buffer [p3].time + (span / 2) < sample_index) {
+                    ((flags & SCAN_EARLY_DECISION) || peak_buffer [p3].time + (span / 2) < sample_index)) {
                         int d1 = peak_buffer [p2].time - peak_buffer [p1].time;
                         int d2 = peak_buffer [p3].time - peak_buffer [p2].time;
                         float ratio = (d1 > d2) ? (float) d1 / d2 : (float) d2 / d1;
-                        float min_height = peak_buffer [p1].height;
+                        float min_height = peak_buffer [p1].height, max_height;
 
                         if (peak_buffer [p2].height < min_height) min_height = peak_buffer [p2].height;
                         if (peak_buffer [p3].height < min_height) min_height = peak_buffer [p3].height;
 
-                        min_height = min_height * SPURIOUS_REJECTION_RATIO;
-
-                        for (i = 0; i < num_peaks; ++i)
-                            if (i != p1 && i != p2 && i != p3 &&
-                                peak_buffer [i].time > peak_buffer [p1].time - (span / 3) &&
-                                peak_buffer [i].time < peak_buffer [p3].time + (span / 3) &&
-                                peak_buffer [i].height > min_height)
-                                    break;
-
-                        if (i == num_peaks && ratio < KNOCK_MAX_RATIO) {
-                            if (flags & SCAN_DISP_EVENTS)
-                                Dbg_printf ("*** knock detected, time = %s, span = %d, ratio = %.3f, heights = %d %d %d, widths = %d %d %d\n",
-                                    time_format (peak_buffer [p1].time), d1 + d2, ratio,
-                                    peak_buffer [p1].height, peak_buffer [p2].height, peak_buffer [p3].height,
-                                    peak_buffer [p1].area / peak_buffer [p1].height, peak_buffer [p2].area / peak_buffer [p2].height,
-                                    peak_buffer [p3].area / peak_buffer [p3].height);
-
-                            detections |= SCAN_KNOCK_DETECTED;
-                            num_peaks = 0;
-                        }
+                        if (ratio >= KNOCK_MAX_RATIO)
+                            continue;
+
+                        knock->times [0] = peak_buffer [p1].time;
+                        knock->times [1] = peak_buffer [p2].time;
+                        knock->times [2] = peak_buffer [p3].time;
+                        knock->heights [0] = peak_buffer [p1].height;
+                        knock->heights [1] = peak_buffer [p2].height;
+                        knock->heights [2] = peak_buffer [p3].height;
+                        knock->rejection_height = min_height * SPURIOUS_REJECTION_RATIO;
+                        knock->ratio = ratio;
+                        knock->span = span;
+
+                        if (spurious_peak (knock, &max_height))
+                            continue;
+
+                        knock->spurious_margin = 1.0F - max_height / knock->rejection_height;
+                        knock->confidence = (KNOCK_MAX_RATIO - ratio) / (KNOCK_MAX_RATIO - 1.0F) * 0.4F +
+                            knock->spurious_margin * 0.3F;
+
+                        if (min_height > PEAK_THRESHOLD * THRESHOLD_SCALING)
+                            knock->confidence += (1.0F - PEAK_THRESHOLD * THRESHOLD_SCALING / min_height) * 0.3F;
+
+                        if ((flags & SCAN_DISP_EVENTS) && peak_buffer [p3].time + (span / 2) < sample_index)
+                            Dbg_log (LOG_KNOCK_DETECTED, peak_buffer [p1].time, d1 + d2, ratio,
+                                peak_buffer [p1].height, peak_buffer [p2].height, peak_buffer [p3].height,
+                                peak_buffer [p1].area / peak_buffer [p1].height, peak_buffer [p2].area / peak_buffer [p2].height,
+                                peak_buffer [p3].area / peak_buffer [p3].height);
+
+                        return 1;
                     }
             }
 
-    for (p1 = 0; p1 < num_peaks; ++p1)
-        if (peak_buffer [p1].time + SAMPLING_RATE > sample_index && filtered_level > peak_buffer [p1].filtered_level * 2 + 50)
-            if (++peak_buffer [p1].filter_hits == 5) {
-                if (flags & SCAN_DISP_EVENTS)
-                    Dbg_printf ("*** ring detected, time = %s, delay = %.3f, pre level = %.2f, post level = %.2f\n",
-                        time_format (peak_buffer [p1].time), (sample_index - peak_buffer [p1].time) / (float) SAMPLING_RATE,
-                        peak_buffer [p1].filtered_level, filtered_level);
+    return 0;
+}
 
-                detections |= SCAN_BELL_DETECTED;
-                num_peaks = 0;
-                break;
-            }
+// Check whether any peak other than the three belonging to the specified knock falls within a third of the span on either
+// side and is larger than the knock's spurious rejection height (or if one of the knock's own peaks has been pushed out of
+// the buffer). The height of the largest competing peak in the window is returned either way.
 
-    return detections;
+static int spurious_peak (struct knock *knock, float *max_height)
+{
+    int i, matches = 0;
+
+    *max_height = 0.0F;
+
+    for (i = 0; i < num_peaks; ++i)
+        if (peak_buffer [i].time == knock->times [0] || peak_buffer [i].time == knock->times [1] ||
+            peak_buffer [i].time == knock->times [2])
+                matches++;
+        else if (peak_buffer [i].time > knock->times [0] - (knock->span / 3) &&
+            peak_buffer [i].time < knock->times [2] + (knock->span / 3) &&
+            peak_buffer [i].height > *max_height)
+                *max_height = peak_buffer [i].height;
+
+    return matches < 3 || *max_height > knock->rejection_height;
+}
+
+// Write a detection record for the specified knock (detected, provisional or retracted). The latency is measured
+// from the third knock, which is when a listener would expect a reaction, to the current sample.
+
+static void record_knock (struct knock *knock, int type)
+{
+    struct scan_detection *record = new_record (type);
+    int i;
+
+    if (!record)
+        return;
+
+    record->time = knock->times [0];
+    record->span = knock->span;
+    record->ratio = knock->ratio;
+    record->min_height = record->max_height = knock->heights [0];
+
+    for (i = 1; i < 3; ++i)
+        if (knock->heights [i] < record->min_height)
+            record->min_height = knock->heights [i];
+        else if (knock->heights [i] > record->max_height)
+            record->max_height = knock->heights [i];
+
+    record->spurious_margin = knock->spurious_margin;
+    record->confidence = (type == SCAN_KNOCK_RETRACTED) ? 0.0F : knock->confidence;
+    record->latency = sample_index - knock->times [2];
+}
+
+// Return a cleared detection record of the specified type from the caller's array, or NULL if there isn't
+// one (either because the caller didn't supply an array or because it's full). Every detection comes through
+// here, so this is also where they're counted.
+
+static struct scan_detection *new_record (int type)
+{
+    struct scan_detection *record;
+
+    switch (type) {
+        case SCAN_KNOCK_DETECTED: stats.knocks++; break;
+        case SCAN_KNOCK_PROVISIONAL: stats.provisional_knocks++; break;
+        case SCAN_KNOCK_RETRACTED: stats.retracted_knocks++; break;
+        case SCAN_BELL_DETECTED: stats.bells++; break;
+        case SCAN_ALARM_DETECTED: stats.alarms++; break;
+        case SCAN_GLASS_DETECTED: stats.glass_breaks++; break;
+    }
+
+    if (num_detection_records == max_detection_records)
+        return NULL;
+
+    record = detection_records + num_detection_records++;
+    memset (record, 0, sizeof (*record));
+    record->type = type;
+    return record;
+}
+
+// Update the alarm pattern state machine. This is called every ALARM_TICK samples. A beep must be within the duration
+// limits of either pattern, and once the first beep has picked the pattern, every following beep and short gap must be
+// within that pattern's limits. A group is complete when a long gap follows the correct number of beeps, and we report
+// a detection when we have heard the required number of consecutive complete groups.
+
+static int check_alarm (int flags)
+{
+    int run_msecs;
+
+    if (alarm.run_ticks < SAMPLING_RATE * 60 / ALARM_TICK)    // durations over a minute don't matter
+        alarm.run_ticks++;
+
+    run_msecs = alarm.run_ticks * ALARM_TICK * 1000 / SAMPLING_RATE;
+
+    if (alarm.beeping) {
+        if (alarm.level > ALARM_OFF_LEVEL) {
+            if (alarm.level > alarm.beep_peak_level)
+                alarm.beep_peak_level = alarm.level;
+
+            return 0;
+        }
+
+        // the beep just ended, so check its duration (and classify the pattern if it's the first beep)
+
+        if (run_msecs >= T3_MIN_BEEP && run_msecs <= T3_MAX_BEEP && alarm.pattern != 4)
+            alarm.pattern = 3;
+        else if (run_msecs >= T4_MIN_BEEP && run_msecs <= T4_MAX_BEEP && alarm.pattern != 3)
+            alarm.pattern = 4;
+        else {
+            reset_alarm ();
+            return 0;
+        }
+
+        alarm.beep_level_sum += alarm.beep_peak_level;
+        alarm.beeps++;
+        alarm.beeping = 0;
+        alarm.run_ticks = 0;
+        return 0;
+    }
+
+    if (alarm.level < ALARM_ON_LEVEL) {
+        struct scan_detection *record;
+
+        // still quiet: if we've just reached the minimum long gap after a full group, count the group
+
+        if (!alarm.beeps || alarm.beeps != alarm.pattern ||
+            run_msecs != (alarm.pattern == 3 ? T3_MIN_LONG_GAP : T4_MIN_LONG_GAP))
+                return 0;
+
+        alarm.beeps = 0;
+
+        if (++alarm.groups < ALARM_GROUPS)
+            return 0;
+
+        if (flags & SCAN_DISP_EVENTS)
+            Dbg_log (LOG_ALARM_DETECTED, alarm.start_time, alarm.pattern, alarm.groups,
+                alarm.beep_level_sum / (alarm.groups * alarm.pattern));
+
+        if ((record = new_record (SCAN_ALARM_DETECTED))) {
+            record->time = alarm.start_time;
+            record->span = sample_index - alarm.start_time;
+            record->pattern = alarm.pattern;
+            record->filter_excess = alarm.beep_level_sum / (alarm.groups * alarm.pattern) / ALARM_ON_LEVEL;
+            record->confidence = 1.0F - 1.0F / record->filter_excess;
+        }
+
+        reset_alarm ();
+        return SCAN_ALARM_DETECTED;
+    }
+
+    // a beep just started, so check the gap that preceded it (unless this is the first beep)
+
+    if (alarm.beeps || alarm.groups) {
+        int min_gap, max_gap;
+
+        if (alarm.beeps) {
+            min_gap = alarm.pattern == 3 ? T3_MIN_BEEP : T4_MIN_BEEP;
+            max_gap = alarm.pattern == 3 ? T3_MAX_BEEP : T4_MAX_BEEP;
+        }
+        else {
+            min_gap = alarm.pattern == 3 ? T3_MIN_LONG_GAP : T4_MIN_LONG_GAP;
+            max_gap = alarm.pattern == 3 ? T3_MAX_LONG_GAP : T4_MAX_LONG_GAP;
+        }
+
+        if (run_msecs < min_gap || run_msecs > max_gap)
+            reset_alarm ();
+    }
+
+    if (!alarm.beeps && !alarm.groups)
+        alarm.start_time = sample_index;
+
+    alarm.beep_peak_level = alarm.level;
+    alarm.beeping = 1;
+    alarm.run_ticks = 0;
+    return 0;
+}
+
+// Reset the alarm pattern matcher (but not the filter level)
+
+static void reset_alarm (void)
+{
+    alarm.beeping = alarm.run_ticks = alarm.pattern = alarm.beeps = alarm.groups = 0;
+    alarm.beep_level_sum = 0.0F;
+}
+
+// Analyze the window of decorrelated audio that just finished for glass breaking. The background level is a slow
+// average of the window levels that's frozen while we're following a possible impact. Note that a knock is also a
+// loud broadband impact, but it is mostly low frequency and dies away within a window or two, whereas glass keeps
+// ringing at high frequencies for a couple hundred milliseconds. The confidence score is a blend of how far the impact
+// and the final level cleared their thresholds over the background and how many ring windows beyond the minimum were
+// high frequency (each term ranges from 0 to 1, like the knock score). The high frequency ratio itself isn't used
+// because real breaks only clear it by a few percent.
+
+static int check_glass (int flags)
+{
+    float level = glass.level_sum * (1.0F / WINDOW_SIZE);
+    float hf_ratio = glass.level_sum ? glass.hf_sum * 0.5F / glass.level_sum : 0.0F;
+    struct scan_detection *record;
+    float final_ratio, impact_ratio;
+
+    glass.level_sum = glass.hf_sum = 0;
+
+    if (glass.windows < 0) {
+        glass.windows++;
+        return 0;
+    }
+
+    if (!glass.windows) {
+        if (level > glass.background * GLASS_IMPACT_RATIO + 1.0F && hf_ratio > GLASS_MIN_HF_RATIO) {
+            glass.impact_time = sample_index - WINDOW_SIZE;
+            glass.impact_level = glass.last_level = level;
+            glass.impact_hf_ratio = hf_ratio;
+            glass.hf_windows = 0;
+            glass.windows = 1;
+        }
+        else
+            glass.background = glass.background * (63.0F / 64.0F) + level * (1.0F / 64.0F);
+
+        return 0;
+    }
+
+    if (hf_ratio > GLASS_MIN_HF_RATIO)
+        glass.hf_windows++;
+
+    if (level > glass.last_level * GLASS_MAX_REGROWTH) {      // a new impact, or something that isn't decaying
+        glass.windows = 0;
+        return 0;
+    }
+
+    glass.last_level = level;
+
+    if (++glass.windows <= GLASS_RING_WINDOWS)
+        return 0;
+
+    glass.windows = 0;
+    final_ratio = level / (glass.background + 1.0F);
+
+    if (glass.hf_windows < GLASS_MIN_HF_WINDOWS || level > glass.impact_level * GLASS_MAX_FINAL_LEVEL ||
+        final_ratio < GLASS_MIN_FINAL_RATIO)
+            return 0;
+
+    impact_ratio = glass.impact_level / (glass.background + 1.0F);
+
+    if (flags & SCAN_DISP_EVENTS)
+        Dbg_log (LOG_GLASS_DETECTED, glass.impact_time, glass.impact_level, impact_ratio,
+            glass.impact_hf_ratio, glass.hf_windows);
+
+    glass.windows = -GLASS_HOLDOFF_WINDOWS;
+
+    if ((record = new_record (SCAN_GLASS_DETECTED))) {
+        record->time = glass.impact_time;
+        record->span = sample_index - glass.impact_time;
+        record->ratio = glass.impact_hf_ratio;
+        record->min_height = (int) level;
+        record->max_height = (int) glass.impact_level;
+        record->confidence = (impact_ratio > GLASS_IMPACT_RATIO ? (1.0F - GLASS_IMPACT_RATIO / impact_ratio) * 0.4F : 0.0F) +
+            (float) (glass.hf_windows - GLASS_MIN_HF_WINDOWS) / (GLASS_RING_WINDOWS - GLASS_MIN_HF_WINDOWS) * 0.3F +
+            (1.0F - GLASS_MIN_FINAL_RATIO / final_ratio) * 0.3F;
+    }
+
+    return SCAN_GLASS_DETECTED;
+}
+
+// Add the maximum windowed level of the analysis interval that just finished to the noise floor histogram (replacing
+// the oldest one) and recalculate the floor threshold. Because we only have to walk down from the top bin until we
+// have passed the allowed number of exceedances, this is much cheaper than maintaining a sorted history. Unlike the
+// adaptive threshold, which can only decay about 1% per second, this recovers completely as soon as a noisy period
+// has left the history window.
+
+static void update_floor (int level)
+{
+    int bin, count = 0;
+
+    floor_histogram [floor_history [floor_index]]--;
+    floor_histogram [floor_history [floor_index] = floor_bin (level)]++;
+    floor_index = (floor_index + 1) % FLOOR_INTERVALS;
+
+    for (bin = FLOOR_BINS - 1; bin > 0; --bin)
+        if ((count += floor_histogram [bin]) > FLOOR_EXCEEDANCES)
+            break;
+
+    floor_threshold = floor_bin_level (bin);
+}
+
+// Convert a windowed level to its noise floor histogram bin. The octave comes from the position of the most
+// significant bit and the next three bits select one of the eight bins in that octave. Levels of zero or below
+// (i.e., intervals with no peak at all) all go in the first bin.
+
+static int floor_bin (int level)
+{
+    int octave = 0;
+
+    if (level < FLOOR_BINS_PER_OCTAVE)
+        return level > 0 ? level : 0;
+
+    while (level >> (octave + 4))
+        octave++;
+
+    return (octave + 1) * FLOOR_BINS_PER_OCTAVE + ((level >> octave) & (FLOOR_BINS_PER_OCTAVE - 1));
+}
+
+// Convert a noise floor histogram bin back into a level (at the middle of the bin)
+
+static float floor_bin_level (int bin)
+{
+    int octave = bin / FLOOR_BINS_PER_OCTAVE, offset = bin % FLOOR_BINS_PER_OCTAVE;
+
+    if (!octave)
+        return (float) offset;
+
+    return ((FLOOR_BINS_PER_OCTAVE + offset) << (octave - 1)) + ((1 << (octave - 1)) - 1) * 0.5F;
+}
+
+// Return the current base thresholds of both peak threshold controllers, whichever one is being used. This is only
+// intended for testing and display purposes.
+
+void scan_thresholds (float *adaptive_threshold, float *noise_floor_threshold)
+{
+    *adaptive_threshold = peak_threshold;
+    *noise_floor_threshold = floor_threshold;
+}
+
+// Copy the running counts of peaks and detections (since initialization) and the current time (in samples).
+
+void scan_get_stats (struct scan_stats *scan_stats)
+{
+    *scan_stats = stats;
+    scan_stats->time = sample_index;
+}
+
+// Copy up to "max_peaks" of the peaks currently in the peak buffer (oldest first) and return how many there were.
+
+int scan_get_peaks (struct scan_peak *peaks, int max_peaks)
+{
+    int i;
+
+    for (i = 0; i < num_peaks && i < max_peaks; ++i) {
+        peaks [i].time = peak_buffer [i].time;
+        peaks [i].height = peak_buffer [i].height;
+        peaks [i].width = peak_buffer [i].width;
+        peaks [i].filter_hits = peak_buffer [i].filter_hits;
+        peaks [i].filtered_level = peak_buffer [i].filtered_level;
+    }
+
+    return i;
+}
+
+// Select the bell that the ring detector listens for (an index into the bells table). The filter starts over, so
+// this can be done while scanning. Returns zero (and changes nothing) if there's no such bell.
+
+int scan_select_bell (int id)
+{
+    if (id < 0 || id >= (int) NUM_BELLS)
+        return 0;
+
+    bell_id = id;
+    biquad_init (&bell_biquad, 4.0F, bells [id].a0, bells [id].a1, bells [id].a2, bells [id].b1, bells [id].b2);
+    return 1;
+}
+
+// Return the frequency (in Hz) of the specified bell (or the selected one if the index is negative), or zero if
+// there's no such bell (so the caller can list them).
+
+int scan_bell_frequency (int id)
+{
+    if (id < 0)
+        id = bell_id;
+
+    return id < (int) NUM_BELLS ? bells [id].frequency : 0;
 }
 
 // Initialize the specified biquad filter with the given parameters. Note that the "gain" parameter is supplied here
@@ -401,18 +1031,3 @@ static float biquad_apply (struct biquad *f, float input)
     f->in_d1 = input;
     return sum;
 }
-
-// Convert a sample index (at SAMPLING_RATE samples per second) to a formatted string in 24-hour time.
-// Note that this returns a pointer to a static area and so is NOT re-entrant, and should not be used
-// more than once in a single printf() statement!
-
-static char *time_format (int time_in_samples)
-{
-    int hours = time_in_samples / (SAMPLING_RATE * 3600);
-    int minutes = (time_in_samples / (SAMPLING_RATE * 60)) - (hours * 60);
-    float seconds = (time_in_samples % (SAMPLING_RATE * 60)) / (float) SAMPLING_RATE;
-    static char string [32];
-
-    sprintf (string, "%02d:%02d:%06.3f", hours, minutes, seconds);
-    return string;
-}
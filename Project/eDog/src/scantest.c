@@ -20,21 +20,41 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <time.h>
 
 #include "scan.h"
+#include "logfmt.h"
 
 // This module provides a test harness for the scan.c module that can be compiled as a command-line
 // program and process raw audio data using the same algorithm as the embedded version. To aid in
 // debugging it can also create output files containing intermediate values inside the audio
 // scanning algorithm used for detecting "knocks" and "rings".
 //
-// Build right here on Cygwin or Linux:  gcc -I../inc scantest.c scan.c -o scantest
+// Build right here on Cygwin or Linux:  gcc -O2 -I../inc scantest.c scan.c logfmt.c -o scantest
 
 #define BUFFER_SAMPLES 16
 
+// Knock decision latencies (from the third knock to the decision) are binned into a histogram for display
+
+#define LATENCY_BIN_MSECS 50
+#define LATENCY_BINS 20
+
+#define MAX_RECORDS 8
+
+// The thresholds of both peak threshold controllers are sampled at this interval for the convergence report
+
+#define THRESHOLD_TRACE_SAMPLES 1600
+
 static const char *usage =
 " Usage:   scantest [-options] infile.pcm [outfile.pcm]\n\n"
 " Options: -h  = high sensitivity mode (probably more false positives)\n"
+"          -e  = early-decision mode (report provisional knocks, then confirm/retract)\n"
+"          -d  = display every detection record returned by the scanner\n"
+"          -n  = use noise floor tracker for the peak threshold (instead of adaptive)\n"
+"          -t  = report convergence of both peak threshold controllers\n"
+"          -a  = enable smoke/CO alarm detector\n"
+"          -g  = enable glass-break detector\n"
+"          -b  = benchmark the scanner with each combination of detectors\n"
 "          -v  = verbose (all diagnostic information dsiplayed to stdout)\n"
 "          -q  = quiet (don't even display knock/ring event detections)\n"
 "          -k  = output data samples for knock detection debug\n"
@@ -49,12 +69,24 @@ static const char *usage =
 "          0x40 = output normalized audio\n"
 "          0x80 = output windowed level\n"
 "          0x100 = output biquad-filtered audio\n"
-"          0x200 = output biquad-filtered audio level (decaying average)\n\n";
+"          0x200 = output biquad-filtered audio level (decaying average)\n"
+"          0x400 = early-decision mode\n"
+"          0x800 = noise floor peak threshold\n"
+"          0x1000 = smoke/CO alarm detector\n"
+"          0x2000 = glass-break detector\n\n";
+
+static void display_latencies (int *confirmed, int *provisional);
+static void display_record (struct scan_detection *record);
+static void display_convergence (const char *name, float *trace, int count);
+static void benchmark (FILE *infile, int flags);
 
 int main (argc, argv) int argc; char **argv;
 {
-    int error_count = 0, output_words = 0, knocks = 0, rings = 0, flags = SCAN_DISP_EVENTS;
+    int error_count = 0, output_words = 0, display_records = 0, trace_thresholds = 0, trace_count = 0, samples = 0, knocks = 0, rings = 0, provisionals = 0, retractions = 0, alarms = 0, glass_breaks = 0, run_benchmark = 0, flags = SCAN_DISP_EVENTS;
+    int confirmed_latencies [LATENCY_BINS + 1], provisional_latencies [LATENCY_BINS + 1];
     int16_t in_sample_buffer [BUFFER_SAMPLES], *out_sample_buffer = NULL;
+    struct scan_detection records [MAX_RECORDS];
+    float *adaptive_trace = NULL, *floor_trace = NULL;
     FILE *infile = NULL, *outfile = NULL;
 
     // loop through command-line arguments
@@ -68,6 +100,34 @@ int main (argc, argv) int argc; char **argv;
                         flags |= SCAN_HIGH_SENSITIVITY;
                         break;
 
+                    case 'D': case 'd':
+                        display_records = 1;
+                        break;
+
+                    case 'E': case 'e':
+                        flags |= SCAN_EARLY_DECISION;
+                        break;
+
+                    case 'A': case 'a':
+                        flags |= SCAN_DETECT_ALARM;
+                        break;
+
+                    case 'G': case 'g':
+                        flags |= SCAN_DETECT_GLASS;
+                        break;
+
+                    case 'B': case 'b':
+                        run_benchmark = 1;
+                        break;
+
+                    case 'N': case 'n':
+                        flags |= SCAN_FLOOR_THRESHOLD;
+                        break;
+
+                    case 'T': case 't':
+                        trace_thresholds = 1;
+                        break;
+
                     case 'K': case 'k':
                         flags |= SCAN_OUTP_NORMAL_AUDIO | SCAN_OUTP_WINDOW_LEVEL;
                         break;
@@ -125,6 +185,12 @@ int main (argc, argv) int argc; char **argv;
     if (error_count)
         return 1;
 
+    if (run_benchmark) {
+        benchmark (infile, flags);
+        fclose (infile);
+        return 0;
+    }
+
     if (flags & SCAN_OUTP_DECORR_AUDIO) output_words++;
     if (flags & SCAN_OUTP_DECORR_LEVEL) output_words++;
     if (flags & SCAN_OUTP_NORMAL_AUDIO) output_words++;
@@ -141,23 +207,65 @@ int main (argc, argv) int argc; char **argv;
         out_sample_buffer = malloc (output_words * sizeof (int16_t) * BUFFER_SAMPLES);
     }
 
+    memset (confirmed_latencies, 0, sizeof (confirmed_latencies));
+    memset (provisional_latencies, 0, sizeof (provisional_latencies));
     scan_audio_init ();
 
     while (1) {
         int sample_count = fread (in_sample_buffer, sizeof (int16_t), BUFFER_SAMPLES, infile);
-        int res;
+        int res, num_records = MAX_RECORDS, bin, i;
 
         if (!sample_count)
             break;
 
-        res = scan_audio (in_sample_buffer, sample_count, out_sample_buffer, flags);
+        res = scan_audio_detect (in_sample_buffer, sample_count, out_sample_buffer, flags, records, &num_records);
+
+        for (i = 0; i < num_records; ++i) {
+            if (display_records)
+                display_record (records + i);
+
+            if (records [i].type & (SCAN_KNOCK_DETECTED | SCAN_KNOCK_PROVISIONAL)) {
+                bin = records [i].latency * 1000 / 16000 / LATENCY_BIN_MSECS;
+
+                if (bin > LATENCY_BINS)
+                    bin = LATENCY_BINS;
+
+                if (records [i].type & SCAN_KNOCK_DETECTED)
+                    confirmed_latencies [bin]++;
+                else
+                    provisional_latencies [bin]++;
+            }
+        }
 
         if (res & SCAN_KNOCK_DETECTED)
             knocks++;
 
+        if (res & SCAN_KNOCK_PROVISIONAL)
+            provisionals++;
+
+        if (res & SCAN_KNOCK_RETRACTED)
+            retractions++;
+
         if (res & SCAN_BELL_DETECTED)
             rings++;
 
+        if (res & SCAN_ALARM_DETECTED)
+            alarms++;
+
+        if (res & SCAN_GLASS_DETECTED)
+            glass_breaks++;
+
+        if (trace_thresholds && (samples += sample_count) >= THRESHOLD_TRACE_SAMPLES) {
+            if (!(trace_count & (trace_count - 1))) {
+                adaptive_trace = realloc (adaptive_trace, (trace_count ? trace_count * 2 : 1) * sizeof (float));
+                floor_trace = realloc (floor_trace, (trace_count ? trace_count * 2 : 1) * sizeof (float));
+            }
+
+            scan_thresholds (adaptive_trace + trace_count, floor_trace + trace_count);
+            samples -= THRESHOLD_TRACE_SAMPLES;
+            trace_count++;
+        }
+
         if (outfile && output_words && !fwrite (out_sample_buffer, sizeof (int16_t), sample_count * output_words, outfile)) {
             fprintf (stderr, "can't write to output file!\n");
             break;
@@ -166,6 +274,26 @@ int main (argc, argv) int argc; char **argv;
 
     printf ("final results: %d knocks and %d rings detected\n", knocks, rings);
 
+    if (flags & SCAN_DETECT_ALARM)
+        printf ("alarm detector: %d smoke/CO alarms detected\n", alarms);
+
+    if (flags & SCAN_DETECT_GLASS)
+        printf ("glass-break detector: %d glass breaks detected\n", glass_breaks);
+
+    if (flags & SCAN_EARLY_DECISION)
+        printf ("early decisions: %d provisional knocks, %d retracted\n", provisionals, retractions);
+
+    if (knocks || provisionals)
+        display_latencies (confirmed_latencies, (flags & SCAN_EARLY_DECISION) ? provisional_latencies : NULL);
+
+    if (trace_count) {
+        printf ("\nthreshold controller   baseline   maximum   rise time   recovery time\n");
+        display_convergence ("adaptive", adaptive_trace, trace_count);
+        display_convergence ("noise floor", floor_trace, trace_count);
+        free (adaptive_trace);
+        free (floor_trace);
+    }
+
     if (out_sample_buffer) free (out_sample_buffer);
     if (outfile) fclose (outfile);
     if (infile) fclose (infile);
@@ -173,6 +301,162 @@ int main (argc, argv) int argc; char **argv;
     return 0;
 }
 
+// Display the histogram of knock decision latencies. These are measured from the time of the third knock (which is when a
+// listener would expect a response) to when scan_audio() returned the decision, so they include the analysis interval.
+// The provisional column is only shown in the early-decision mode.
+
+static void display_latencies (int *confirmed, int *provisional)
+{
+    int i;
+
+    printf ("\nknock latency (ms)   confirmed%s\n", provisional ? "  provisional" : "");
+
+    for (i = 0; i <= LATENCY_BINS; ++i) {
+        if (!confirmed [i] && (!provisional || !provisional [i]))
+            continue;
+
+        if (i == LATENCY_BINS)
+            printf ("     >= %4d      ", i * LATENCY_BIN_MSECS);
+        else
+            printf ("  %4d - %4d      ", i * LATENCY_BIN_MSECS, (i + 1) * LATENCY_BIN_MSECS);
+
+        if (provisional)
+            printf ("%8d  %11d\n", confirmed [i], provisional [i]);
+        else
+            printf ("%8d\n", confirmed [i]);
+    }
+}
+
+// Display how a threshold controller reacted to the loudest period in the file. The baseline is the lowest threshold
+// reached before the maximum (after a 10 second warm-up) and the "plateau" is anywhere within 80% of the maximum. The
+// rise time is from when the threshold last left the baseline region (within 25%) until it first reached the plateau,
+// and the recovery time is from when it last left the plateau until it got back into the baseline region. A good test
+// file has quiet audio, then a period of steady noise (like a TV), and then quiet audio again for a couple of minutes.
+
+static void display_convergence (const char *name, float *trace, int count)
+{
+    int max_index = 0, rise_start, rise_end, fall_start, fall_end, warmup = 10 * 16000 / THRESHOLD_TRACE_SAMPLES, i;
+    float baseline, maximum = trace [0];
+    char recovery [32];
+
+    for (i = 1; i < count; ++i)
+        if (trace [i] > maximum)
+            maximum = trace [max_index = i];
+
+    if (max_index <= warmup) {
+        printf ("%-20s  (no threshold excursion after the %d second warm-up)\n", name, warmup * THRESHOLD_TRACE_SAMPLES / 16000);
+        return;
+    }
+
+    for (baseline = trace [i = warmup]; i < max_index; ++i)
+        if (trace [i] < baseline)
+            baseline = trace [i];
+
+    for (rise_end = max_index; rise_end > warmup && trace [rise_end - 1] >= maximum * 0.8F; --rise_end);
+    for (rise_start = rise_end; rise_start > warmup && trace [rise_start - 1] > baseline * 1.25F; --rise_start);
+    for (fall_end = max_index; fall_end < count && trace [fall_end] > baseline * 1.25F; ++fall_end);
+    for (fall_start = fall_end; trace [fall_start - 1] < maximum * 0.8F; --fall_start);
+
+    if (fall_end < count)
+        sprintf (recovery, "%.1f s", (fall_end - fall_start) * THRESHOLD_TRACE_SAMPLES / 16000.0);
+    else
+        sprintf (recovery, "> %.1f s", (fall_end - fall_start) * THRESHOLD_TRACE_SAMPLES / 16000.0);
+
+    printf ("%-20s %10.2f %9.2f %9.1f s   %13s\n", name, baseline, maximum,
+        (rise_end - rise_start) * THRESHOLD_TRACE_SAMPLES / 16000.0, recovery);
+}
+
+// Benchmark the scanner on the input file with each combination of the optional detectors. The file is read into
+// memory and scanned (repeatedly, if it's short) in blocks of 64 samples, which is what fill_buffer() does on the
+// board. Of course the absolute times here are for the host, but the relative costs of the detectors should carry
+// over reasonably well to the STM32F4, where we have 4 ms of budget for each block. Each configuration is timed
+// several times (taking turns, so they all see the same host conditions) and the best run is reported, because
+// single runs vary by tens of percent. Build with -O2 for this, as the unoptimized costs don't mean much.
+
+#define BENCHMARK_BLOCK 64
+#define BENCHMARK_MIN_SAMPLES (16000 * 600)
+#define BENCHMARK_RUNS 5
+
+static void benchmark (FILE *infile, int flags)
+{
+    static const struct { const char *name; int flags; } configs [] = {
+        { "knock + bell", 0 },
+        { "knock + bell + alarm", SCAN_DETECT_ALARM },
+        { "knock + bell + glass", SCAN_DETECT_GLASS },
+        { "all detectors", SCAN_DETECT_ALARM | SCAN_DETECT_GLASS }
+    };
+
+    int num_configs = sizeof (configs) / sizeof (configs [0]), num_samples = 0, alloc_samples = 16000 * 60;
+    int16_t *samples = malloc (alloc_samples * sizeof (int16_t));
+    double best_nsecs [sizeof (configs) / sizeof (configs [0])];
+    int passes, config, run, pass, i;
+
+    while ((i = fread (samples + num_samples, sizeof (int16_t), alloc_samples - num_samples, infile)) > 0)
+        if ((num_samples += i) == alloc_samples)
+            samples = realloc (samples, (alloc_samples *= 2) * sizeof (int16_t));
+
+    num_samples -= num_samples % BENCHMARK_BLOCK;
+
+    if (!num_samples) {
+        fprintf (stderr, "input file is too short to benchmark !\n");
+        free (samples);
+        return;
+    }
+
+    passes = (BENCHMARK_MIN_SAMPLES + num_samples - 1) / num_samples;
+    flags &= SCAN_HIGH_SENSITIVITY | SCAN_EARLY_DECISION | SCAN_FLOOR_THRESHOLD;
+
+    printf ("scanning %.1f seconds of audio %d time(s) in blocks of %d samples, best of %d runs\n\n",
+        num_samples / 16000.0, passes, BENCHMARK_BLOCK, BENCHMARK_RUNS);
+    printf ("detectors               ns/sample   us/block   x realtime   relative\n");
+
+    for (run = 0; run < BENCHMARK_RUNS; ++run)
+        for (config = 0; config < num_configs; ++config) {
+            clock_t start;
+            double nsecs;
+
+            scan_audio_init ();
+            start = clock ();
+
+            for (pass = 0; pass < passes; ++pass)
+                for (i = 0; i < num_samples; i += BENCHMARK_BLOCK)
+                    scan_audio (samples + i, BENCHMARK_BLOCK, NULL, flags | configs [config].flags);
+
+            nsecs = (double) (clock () - start) / CLOCKS_PER_SEC * 1e9 / ((double) num_samples * passes);
+
+            if (!run || nsecs < best_nsecs [config])
+                best_nsecs [config] = nsecs;
+        }
+
+    for (config = 0; config < num_configs; ++config)
+        printf ("%-22s %10.2f %10.2f %12.0f %10.2f\n", configs [config].name, best_nsecs [config],
+            best_nsecs [config] * BENCHMARK_BLOCK / 1000.0, 1e9 / 16000.0 / best_nsecs [config],
+            best_nsecs [config] / best_nsecs [0]);
+
+    free (samples);
+}
+
+// Display a single detection record on one line
+
+static void display_record (struct scan_detection *record)
+{
+    const char *type = "unknown";
+
+    switch (record->type) {
+        case SCAN_KNOCK_DETECTED: type = "knock"; break;
+        case SCAN_BELL_DETECTED: type = "bell"; break;
+        case SCAN_KNOCK_PROVISIONAL: type = "provisional"; break;
+        case SCAN_KNOCK_RETRACTED: type = "retracted"; break;
+        case SCAN_ALARM_DETECTED: type = "alarm"; break;
+        case SCAN_GLASS_DETECTED: type = "glass"; break;
+    }
+
+    printf ("record: %s, time = %.3f, span = %d, ratio = %.3f, heights = %d-%d, margin = %.2f, excess = %.2f, bell = %d, "
+        "pattern = %d, confidence = %.2f, latency = %d\n", type, record->time / 16000.0, record->span, record->ratio,
+        record->min_height, record->max_height, record->spurious_margin, record->filter_excess, record->bell_id,
+        record->pattern, record->confidence, record->latency);
+}
+
 void Dbg_puts (const char *s)
 {
     fputs (s, stdout);
@@ -186,3 +470,13 @@ void Dbg_printf (const char *format, ...)
     vprintf (format, args);
     va_end (args);
 }
+
+// the scanner's binary log records (see logfmt.h) are decoded right away
+
+void Dbg_write (const void *data, int bytes)
+{
+    char text [256];
+
+    if (logfmt_decode (data, bytes, text, sizeof (text), NULL) > 0)
+        fputs (text, stdout);
+}
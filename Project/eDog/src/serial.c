@@ -19,26 +19,47 @@
 // The easiest way to access this is with a USB TTL serial adapter based on the Prolific PL2303HX (or
 // at least that's all I've verified). Connect the grounds and connect the RXD pin to PA2 on the
 // Discovery board. It's also possible to connect the TXD pin of the serial adapter to the PA3 pin of
-// the Discovery board, but for now we do not use the serial data received (it is simply echoed).
+// the Discovery board, in which case the characters received are queued by the receive interrupt in a
+// small ring for the firmware to read with Dbg_getc() from the main loop (this is the debug console,
+// see console.c, which also does the echo). The interrupt does nothing else, so typing on the console
+// can't disturb the audio.
 //
-// To actually have the transmission of serial data be useful, it must be buffered and transmitted by
-// interrupt (otherwise the realtime response of the firmware is compromised). This is handled here
-// with an 8K buffer. The software design should be such that we never fill this buffer (otherwise the
-// caller will be blocked).
+// To actually have the transmission of serial data be useful, it must be buffered and transmitted in
+// the background (otherwise the realtime response of the firmware is compromised). This is handled
+// here with an 8K ring buffer that is sent by DMA (DMA1 Stream 6, Channel 4 is USART2_TX), one
+// contiguous span of the ring at a time (so usually one DMA transfer for everything queued since the
+// last one finished, or two when it wraps). The writers never wait for room in the buffer: if a whole
+// message doesn't fit, it's dropped (never just part of it) and counted, and Dbg_dropped() returns
+// the count. At 921600 baud (which is 913043 actual from the 42 MHz APB1 clock, within 1%) the port
+// can send about 90K characters per second.
 
 #include <stm32f4xx.h>
 #include <misc.h>
 #include <stm32f4xx_usart.h>
+#include <stm32f4xx_dma.h>
 
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 
+#include "profile.h"
+
 #define TX_BUFLEN 8192
 #define TX_BUFMASK (TX_BUFLEN-1)
 
+#define RX_BUFLEN 128
+#define RX_BUFMASK (RX_BUFLEN-1)
+
+#define TX_DMA_STREAM DMA1_Stream6
+#define TX_DMA_CHANNEL DMA_Channel_4
+#define TX_DMA_FLAGS (DMA_FLAG_TCIF6 | DMA_FLAG_HTIF6 | DMA_FLAG_TEIF6 | DMA_FLAG_DMEIF6 | DMA_FLAG_FEIF6)
+
 static volatile uint8_t tx_buffer [TX_BUFLEN];
-static volatile int tx_head, tx_tail;
+static volatile int tx_head, tx_tail, tx_dma_span;
+static volatile uint32_t tx_dropped;
+
+static volatile uint8_t rx_buffer [RX_BUFLEN];
+static volatile int rx_head, rx_tail;
 
 /* This funcion initializes the USART2 peripheral
  *
@@ -50,6 +71,7 @@ static void init_USART2(uint32_t baudrate){
 	GPIO_InitTypeDef GPIO_InitStructure;
 	USART_InitTypeDef USART_InitStructure;
 	NVIC_InitTypeDef NVIC_InitStructure;
+	DMA_InitTypeDef DMA_InitStructure;
 
 	/* enable APB1 peripheral clock for USART2
 	 * note that only USART1 and USART6 are connected to APB2
@@ -91,58 +113,155 @@ static void init_USART2(uint32_t baudrate){
 	 */
 	USART_ITConfig(USART2, USART_IT_RXNE, ENABLE); // enable the USART2 receive interrupt
 
+	/* The receive interrupt and the transmit DMA interrupt have the same (low) priority
+	 * so they can't preempt the audio interrupts
+	 */
 	NVIC_InitStructure.NVIC_IRQChannel = USART2_IRQn;		 // we want to configure the USART2 interrupts
-	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;// this sets the priority group of the USART2 interrupts
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;// this sets the priority group of the USART2 interrupts
 	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;		 // this sets the subpriority inside the group
 	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;			 // the USART2 interrupts are globally enabled
 	NVIC_Init(&NVIC_InitStructure);							 // the properties are passed to the NVIC_Init function
 
+	/* DMA1 Stream 6 Channel 4 moves the transmit data from the ring buffer to the
+	 * USART2 data register; the address and count are set for each transfer
+	 */
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+	DMA_DeInit(TX_DMA_STREAM);
+
+	DMA_InitStructure.DMA_Channel = TX_DMA_CHANNEL;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&USART2->DR;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)tx_buffer;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+	DMA_InitStructure.DMA_BufferSize = 1;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_Low;
+	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+	DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+	DMA_Init(TX_DMA_STREAM, &DMA_InitStructure);
+	DMA_ITConfig(TX_DMA_STREAM, DMA_IT_TC, ENABLE);
+
+	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Stream6_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+
+	USART_DMACmd(USART2, USART_DMAReq_Tx, ENABLE);
 	USART_Cmd(USART2, ENABLE); // enable USART2
 }
 
-// Write a single character to the USART2 transmit buffer. Note that we block here if the buffer is full
-// (obviously that is not recommended).
+// If the transmit DMA is idle and there's data in the ring, start sending the contiguous span from the
+// tail (to the head, or to the end of the buffer if the data wraps). Called with interrupts disabled
+// or from the DMA interrupt.
 
-static void USART2_putchar (char c)
+static void start_tx_dma (void)
 {
-    int buffer_was_empty;
+    int span;
+
+    if (tx_dma_span || tx_head == tx_tail)
+        return;
 
-    while (((tx_head + 1) & TX_BUFMASK) == tx_tail);    // block when buffer full (should not happen with a little care...)
+    span = (tx_head > tx_tail ? tx_head : TX_BUFLEN) - tx_tail;
+    DMA_ClearFlag(TX_DMA_STREAM, TX_DMA_FLAGS);
+    TX_DMA_STREAM->M0AR = (uint32_t)(tx_buffer + tx_tail);
+    TX_DMA_STREAM->NDTR = span;
+    tx_dma_span = span;
+    DMA_Cmd(TX_DMA_STREAM, ENABLE);
+}
+
+// Queue data for transmission, optionally expanding "\n" to "\r\n" (for text). If the whole thing
+// doesn't fit in the ring it's dropped and counted (we never block, and never send part of a message,
+// which is important for the binary log records). Interrupts are disabled while we copy and start the
+// DMA because the transmit DMA interrupt also moves the tail and starts transfers.
+
+static void tx_write (const char *data, int length, int crlf)
+{
+    int bytes = length, head, i;
+
+    if (crlf)
+        for (i = 0; i < length; ++i)
+            if (data [i] == '\n')
+                bytes++;
 
     __disable_irq ();
-    buffer_was_empty = (tx_head == tx_tail);
-    tx_buffer [tx_head] = c;
-    tx_head = (tx_head + 1) & TX_BUFMASK;
-    __enable_irq ();
 
-    if (buffer_was_empty)                               // if the buffer was empty when we disabled interrupts, then we
-        USART_ITConfig(USART2, USART_IT_TXE, ENABLE);   // need to [re]enable the USART2 transmit interrupt because when
-                                                        // the buffer goes empty the ISR disables it
+    if (bytes > TX_BUFMASK - ((tx_head - tx_tail) & TX_BUFMASK)) {
+        tx_dropped++;
+        __enable_irq ();
+        return;
+    }
+
+    for (head = tx_head, i = 0; i < length; ++i) {
+        if (crlf && data [i] == '\n') {
+            tx_buffer [head] = '\r';
+            head = (head + 1) & TX_BUFMASK;
+        }
+
+        tx_buffer [head] = data [i];
+        head = (head + 1) & TX_BUFMASK;
+    }
+
+    tx_head = head;
+    start_tx_dma ();
+    __enable_irq ();
 }
 
 // Debug puts. Expand "\n" to "\r\n"
 
 void Dbg_puts (const char *s)
 {
-    while (*s) {
-        if (*s == '\n')
-            USART2_putchar ('\r');
+    tx_write (s, strlen (s), 1);
+}
 
-        USART2_putchar (*s++);
-    }
+// Queue a binary log record (see logfmt.h) as is.
+
+void Dbg_write (const void *data, int bytes)
+{
+    tx_write (data, bytes, 0);
 }
 
-// Debug printf. Don't exceed 128 character width!
+// Return the number of debug messages dropped because the transmit buffer was full.
+
+uint32_t Dbg_dropped (void)
+{
+    return tx_dropped;
+}
+
+// Debug printf. Don't exceed 128 character width (longer lines are cut off). This is profiled
+// as the logging stage.
 
 void Dbg_printf (const char *format, ...)
 {
+    uint32_t start = profile_begin ();
     char pstring [128];
     va_list args;
 
     va_start (args, format);
-    vsprintf (pstring, format, args);
+    vsnprintf (pstring, sizeof (pstring), format, args);
     Dbg_puts (pstring);
     va_end (args);
+    profile_end (PROFILE_LOG, start);
+}
+
+// Get the next character received, or -1 if there isn't one (this never blocks). If the receive
+// ring fills (because the main loop isn't keeping up) the additional characters are discarded.
+
+int Dbg_getc (void)
+{
+    int c;
+
+    if (rx_tail == rx_head)
+        return -1;
+
+    c = rx_buffer [rx_tail];
+    rx_tail = (rx_tail + 1) & RX_BUFMASK;
+    return c;
 }
 
 // Dump memory to the debug log (shows both ASCII and hex)
@@ -177,26 +296,37 @@ void Dbg_dumpmem (char *memory, int bcount)
     }
 }
 
-// For debug logging output, initialize USART to 230400 baud
+// For debug logging output, initialize USART to 921600 baud
 
 void Dbg_init (void)
 {
-    init_USART2 (230400); // initialize USART2 @ 230400 baud
+    init_USART2 (921600); // initialize USART2 @ 921600 baud
 }
 
-// this is the interrupt request handler (IRQ) for all USART2 interrupts
+// this is the interrupt request handler (IRQ) for the USART2 interrupts (only receive is enabled)
 
 void USART2_IRQHandler(void)
 {
-	// check if the USART2 transmit interrupt flag was set
-	if( USART_GetITStatus(USART2, USART_IT_TXE) ){
-        USART2->DR = tx_buffer [tx_tail];
-        tx_tail = (tx_tail + 1) & TX_BUFMASK;
-        if (tx_tail == tx_head)
-            USART_ITConfig(USART2, USART_IT_TXE, DISABLE); // disable the USART2 transmit interrupt
+	// check if the USART2 receive interrupt flag was set and queue the character (reading DR clears the flag)
+	if( USART_GetITStatus(USART2, USART_IT_RXNE) ){
+        uint8_t c = USART2->DR;
+
+        if (((rx_head + 1) & RX_BUFMASK) != rx_tail) {
+            rx_buffer [rx_head] = c;
+            rx_head = (rx_head + 1) & RX_BUFMASK;
+        }
     }
+}
+
+// this is the interrupt request handler (IRQ) for the transmit DMA: the span that was being sent is
+// now free, so move the tail past it and start sending whatever has been queued since
 
-	// check if the USART2 receive interrupt flag was set and just echo character
-	if( USART_GetITStatus(USART2, USART_IT_RXNE) )
-        USART2_putchar (USART2->DR);
+void DMA1_Stream6_IRQHandler(void)
+{
+	if( DMA_GetITStatus(TX_DMA_STREAM, DMA_IT_TCIF6) ){
+        DMA_ClearITPendingBit(TX_DMA_STREAM, DMA_IT_TCIF6);
+        tx_tail = (tx_tail + tx_dma_span) & TX_BUFMASK;
+        tx_dma_span = 0;
+        start_tx_dma ();
+    }
 }
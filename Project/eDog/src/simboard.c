@@ -0,0 +1,1053 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// simboard.c
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#if defined (__i386__) || defined (__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "simboard.h"
+#include "ring.h"
+#include "stereo.h"
+#include "cycles.h"
+#include "profile.h"
+#include "logfmt.h"
+#include "pdm_filter.h"
+
+#ifdef USB_RECORDER
+#include "usbrec.h"
+#include "diskimg.h"
+#endif
+
+#define PDM_OPEN_DECIMATOR
+#include "pdmdec.h"
+
+// This module is a "virtual board" that allows the unmodified waveplayer.c audio loop (and the
+// scan.c module under it) to run on the host. It stubs out the parts of the STM32 libraries that
+// the audio loop uses, feeds the microphone callback from a raw PCM file (16-bit mono, 16 kHz)
+// and writes whatever the ping-pong output buffers play to a stereo WAV file. There are no real
+// interrupts, so whenever the main loop waits we advance a simulated sample clock by one
+// millisecond and run the microphone and DMA completion callbacks that would have occurred.
+// This means that the processing itself takes zero simulated time, but the host time spent
+// filling each buffer is measured and reported against the real-time deadline (which is the
+// duration of one output buffer, or 4 ms). The same host time drives the virtual cycle counter
+// behind cycles.h, so the firmware's CPU load accounting works here too (as the load that the
+// host would be at if it were clocked like the board).
+//
+// The firmware passes buffer addresses around as uint32_t, so this must be built as a
+// non-position-independent executable (which puts the static buffers in the low 4 GB).
+//
+// There is also a stress test for the mic ring buffer (ring.h) that runs a producer and a
+// consumer on separate threads as fast as they can go, with random block sizes, and checks
+// that every sample arrives in order and that the overrun count accounts for every gap.
+//
+// The microphone input can also be raw PDM (the SPI words generated by pdmsynth, with -d), in
+// which case it's delivered a DMA half buffer at a time through WaveRecorder_ProcessHalf() and
+// the decimator, exactly as on the board, so detection can be checked end-to-end.
+//
+// Finally, there is a model of the PDM microphone capture (waverecorder.c) that feeds the same
+// SPI word stream through the per-word interrupt path and through a simulated circular DMA
+// with randomly late half/full transfer interrupts, and checks that the PCM is bit-identical.
+// ST's PDM filter library is only available for ARM, so this uses the open one in pdmdec.c.
+//
+// The -s option displays the firmware's execution time profile (profile.c) of the audio loop
+// stages at the end, which on the board is requested with the "prof" console command.
+//
+// The -k option types commands into the firmware's debug console (console.c) as if they were
+// received on the debug port. They're separated by semicolons and go in one per simulated
+// second, starting at one second (so empty commands can be used to delay the later ones).
+//
+// With the USB recorder (-DUSB_RECORDER), the buffers are filled in the simulated PendSV, which
+// is pended by the DMA "interrupts" and runs when interrupts are enabled again (or right at the
+// end of the tick if they weren't disabled). The -u option "plugs in" a drive, which is a disk
+// image file (see diskimg.h, and fsbench to create one), and -l injects a latency into every disk
+// command, during which the simulated clock keeps running (and the audio keeps playing).
+//
+// The -f option benchmarks the output buffer fill (a clip copy expanded to stereo frames, and
+// silence) with the block functions in stereo.h against the old sample-at-a-time loops, in
+// cycles per frame (TSC ticks on x86, otherwise nanoseconds).
+//
+// Build right here on Linux (all on one line):
+//
+//   gcc -no-pie -pthread -DHOST_SIM -I../inc -I../../../Utilities/STM32F4-Discovery
+//       simboard.c waveplayer.c waverecorder.c scan.c pdmdec.c adpcm.c barkmix.c profile.c logfmt.c console.c
+//       -o simboard -lm
+//
+// For the USB recorder, add -DUSB_RECORDER -D_USE_DISKCACHE=1 -I../../../Utilities/Third_Party/fat_fs/inc
+// usbrec.c diskimg.c diskcache.c ../../../Utilities/Third_Party/fat_fs/src/ff.c
+// ../../../Utilities/Third_Party/fat_fs/src/option/syncobj.c
+//
+// To play the barks from the ADPCM image, add -DCANNED_AUDIO_ADPCM and run with
+// -c ../bin/dog-adpcm.bin, and to play them through the bark mixer add -DBARK_MIXER
+// (the time spent filling buffers while barking is reported separately).
+
+#define SIM_SAMPLE_RATE 16000
+#define SIM_TICK_SAMPLES 16             // the PDM filter delivers 16 samples every millisecond
+#define SIM_TICK_WORDS 64               // which is from 64 SPI words of PDM data
+#define CANNED_AUDIO_FILE "../bin/dog-30secs.bin"
+
+#define STRESS_RING_BITS 8              // same as the firmware's default mic ring
+#define STRESS_SAMPLES 100000000
+#define STRESS_MAX_BLOCK 64
+#define STRESS_OVERRUN_ODDS 16          // producer overruns 1 in 16 times that the ring is full
+
+#define MODEL_HALF_BUFFERS 4000         // length of the PDM capture model (in DMA half buffers)
+
+#define BENCH_FRAMES 64                 // frames per fill, same as waveplayer.c's default buffers
+#define BENCH_CLIP_SAMPLES 16000        // the clip copied in the fill benchmark
+#define BENCH_PASSES 2000
+
+static const char *usage =
+" Usage:   simboard [-options] infile.pcm|infile.pdm [outfile.wav]\n"
+"          simboard -r | -p | -f\n\n"
+" Options: -mn = set the user mode (as if the user button was pressed n times)\n"
+"          -c  = next argument is the canned bark audio (default " CANNED_AUDIO_FILE ")\n"
+"          -k  = next argument is debug console commands (separated with ';', one per second)\n"
+#ifdef USB_RECORDER
+"          -u  = next argument is a disk image to plug in as the USB drive (see fsbench)\n"
+"          -l  = next argument is the USB drive's latency per command in usecs (default 0)\n"
+#endif
+"          -d  = mic input is PDM (SPI words from pdmsynth) through the DMA capture path\n"
+"          -q  = quiet (don't display the firmware's debug output)\n"
+"          -s  = display the execution time profile of the audio loop at the end\n"
+"          -r  = run the threaded mic ring buffer stress test\n"
+"          -p  = run the PDM capture model (per-word interrupt vs. DMA)\n"
+"          -f  = run the output buffer fill benchmark\n\n";
+
+volatile uint8_t LED_Toggle;
+volatile int user_mode;
+int16_t *sim_canned_audio;
+
+static FILE *mic_file, *wav_file;
+static const char *console_input;
+static int console_time = SIM_SAMPLE_RATE;
+static int quiet, profile_stats, wav_frames, sim_samples, barking, barks, clips;
+
+#ifdef USB_RECORDER
+static const char *drive_image;
+static int drive_latency;
+
+static void drive_wait (uint32_t usecs);
+#endif
+
+// simulated PDM capture DMA state (in SPI words)
+
+static uint32_t pdm_buffer [AUDIO_REC_DMA_HALF_WORDS];
+static int pdm_input, pdm_index;
+
+// simulated output DMA state (in stereo frames)
+
+static int16_t *dma_buffer;
+static int dma_frames, dma_index, dma_active, dma_underruns;
+
+// per-buffer processing time statistics (in host microseconds)
+
+static double busy_start, buffer_busy, busy_min, busy_max, busy_total, deadline;
+static double bark_busy_max, bark_busy_total;
+static int busy_count, bark_busy_count, deadline_misses, timing;
+
+// virtual cycle counter (at the end of the last tick or wherever processing pushed it)
+
+#define SIM_CYCLES_PER_SAMPLE (CYCLES_PER_SECOND / SIM_SAMPLE_RATE)
+#define SIM_CYCLES_PER_USEC (CYCLES_PER_SECOND / 1000000)
+
+static uint32_t sim_cycle_count;
+
+// simulated interrupt mask and PendSV
+
+static int irq_disabled, pend_sv, in_pend_sv;
+
+static void run_pend_sv (void);
+
+static void charge_buffer (void);
+static double host_usecs (void);
+static void write_wav_header (FILE *outfile, int num_frames);
+static void sim_finish (void);
+static void init_pdm_filter (void);
+static int ring_stress (void);
+static int capture_model (void);
+static int fill_benchmark (void);
+
+int main (argc, argv) int argc; char **argv;
+{
+    const char *canned_filename = CANNED_AUDIO_FILE;
+    int error_count = 0, run_stress = 0, run_model = 0, run_bench = 0, canned_bytes;
+    FILE *canned_file;
+
+    // loop through command-line arguments
+
+    while (--argc) {
+        if ((**++argv == '-') && (*argv)[1])
+            while (*++*argv)
+                switch (**argv) {
+
+                    case 'M': case 'm':
+                        user_mode = strtol (++*argv, argv, 10);
+                        --*argv;
+                        break;
+
+                    case 'C': case 'c':
+                        if (argc > 1) {
+                            canned_filename = *++argv;
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-c requires a filename !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'K': case 'k':
+                        if (argc > 1) {
+                            console_input = *++argv;
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-k requires console commands !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+#ifdef USB_RECORDER
+                    case 'U': case 'u':
+                        if (argc > 1) {
+                            drive_image = *++argv;
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-u requires a disk image !\n");
+                            ++error_count;
+                        }
+
+                        break;
+
+                    case 'L': case 'l':
+                        if (argc > 1) {
+                            drive_latency = atoi (*++argv);
+                            --argc;
+                            *argv += strlen (*argv) - 1;
+                        }
+                        else {
+                            fprintf (stderr, "-l requires the latency !\n");
+                            ++error_count;
+                        }
+
+                        break;
+#endif
+
+                    case 'D': case 'd':
+                        pdm_input = 1;
+                        break;
+
+                    case 'Q': case 'q':
+                        quiet = 1;
+                        break;
+
+                    case 'S': case 's':
+                        profile_stats = 1;
+                        break;
+
+                    case 'R': case 'r':
+                        run_stress = 1;
+                        break;
+
+                    case 'P': case 'p':
+                        run_model = 1;
+                        break;
+
+                    case 'F': case 'f':
+                        run_bench = 1;
+                        break;
+
+                    default:
+                        fprintf (stderr, "illegal option: %c !\n", **argv);
+                        ++error_count;
+                }
+        else if (!mic_file) {
+            mic_file = fopen (*argv, "rb");
+
+            if (!mic_file) {
+                fprintf (stderr, "can't open file for reading: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else if (!wav_file) {
+            wav_file = fopen (*argv, "wb");
+
+            if (!wav_file) {
+                fprintf (stderr, "can't open file for writing: %s !\n", *argv);
+                ++error_count;
+            }
+        }
+        else {
+            fprintf (stderr, "extra argument: %s !\n", *argv);
+            ++error_count;
+        }
+    }
+
+    // check for various command-line argument problems
+
+    if (run_stress && !error_count && !mic_file)
+        return ring_stress ();
+
+    if (run_model && !error_count && !mic_file)
+        return capture_model ();
+
+    if (run_bench && !error_count && !mic_file)
+        return fill_benchmark ();
+
+    if (!mic_file) {
+        fputs (usage, stderr);
+        return 1;
+    }
+
+    if (error_count)
+        return 1;
+
+    if ((uintptr_t)(uint32_t)(uintptr_t) &wav_frames != (uintptr_t) &wav_frames) {
+        fprintf (stderr, "static data is above 4 GB, rebuild with -no-pie !\n");
+        return 1;
+    }
+
+    // load the canned bark audio that normally sits in flash
+
+    canned_file = fopen (canned_filename, "rb");
+
+    if (!canned_file) {
+        fprintf (stderr, "can't open canned audio file: %s !\n", canned_filename);
+        return 1;
+    }
+
+    fseek (canned_file, 0, SEEK_END);
+    canned_bytes = ftell (canned_file);
+    fseek (canned_file, 0, SEEK_SET);
+    sim_canned_audio = malloc (canned_bytes);
+
+    if (fread (sim_canned_audio, 1, canned_bytes, canned_file) != canned_bytes) {
+        fprintf (stderr, "can't read canned audio file: %s !\n", canned_filename);
+        return 1;
+    }
+
+    fclose (canned_file);
+
+    if (wav_file)
+        write_wav_header (wav_file, 0);
+
+    if (pdm_input)
+        init_pdm_filter ();
+
+#ifdef USB_RECORDER
+    if (drive_image) {
+        if (!diskimg_open (drive_image, 0)) {
+            fprintf (stderr, "can't open disk image: %s !\n", drive_image);
+            return 1;
+        }
+
+        diskimg_set_latency (drive_latency, 0, drive_wait);
+        usbrec_attach (1);
+    }
+#endif
+
+    // this never returns; the simulation ends in sim_wait_for_interrupt() when the mic file runs out
+
+    WavePlayBack (SIM_SAMPLE_RATE);
+    return 0;
+}
+
+// This is called by the main loop whenever it would be waiting for an interrupt on the board.
+// The time since the previous wait returned is time the firmware spent processing, so that's
+// accumulated first, and then charged against the deadline when the current output buffer
+// finishes playing. Then we advance the sample clock by one tick, which delivers a block of
+// microphone samples and plays a tick's worth of the DMA buffer.
+
+void sim_wait_for_interrupt (void)
+{
+    int16_t mic_samples [SIM_TICK_SAMPLES];
+    int frames_to_play = SIM_TICK_SAMPLES;
+    uint16_t *pdm_words = (uint16_t *) pdm_buffer;
+
+    if (timing) {
+        sim_cycle_count = sim_cycles ();
+        buffer_busy += host_usecs () - busy_start;
+        timing = 0;
+    }
+
+    // Microphone "interrupt". With PDM input, the capture DMA fills a tick's worth of SPI words
+    // and the half or full transfer "interrupt" runs the decimator every fourth tick.
+
+    if (pdm_input) {
+        if (fread (pdm_words + pdm_index, sizeof (uint16_t), SIM_TICK_WORDS, mic_file) != SIM_TICK_WORDS)
+            sim_finish ();
+
+        pdm_index += SIM_TICK_WORDS;
+
+        if (pdm_index == AUDIO_REC_DMA_HALF_WORDS)
+            WaveRecorder_ProcessHalf (pdm_buffer);
+        else if (pdm_index == AUDIO_REC_DMA_HALF_WORDS * 2) {
+            WaveRecorder_ProcessHalf (pdm_buffer + AUDIO_REC_DMA_HALF_WORDS / 2);
+            pdm_index = 0;
+        }
+    }
+    else {
+        if (fread (mic_samples, sizeof (int16_t), SIM_TICK_SAMPLES, mic_file) != SIM_TICK_SAMPLES)
+            sim_finish ();
+
+        WaveRecorderCallback (mic_samples, SIM_TICK_SAMPLES);
+    }
+
+    // Output DMA, including the transfer complete "interrupt" (which normally restarts it). In
+    // circular mode the DMA just wraps around and there's also a half transfer "interrupt".
+
+    while (frames_to_play && dma_active) {
+        int frames = dma_frames - dma_index;
+
+#ifdef AUDIO_MAL_MODE_CIRCULAR
+        if (dma_index < dma_frames / 2)
+            frames = dma_frames / 2 - dma_index;
+#endif
+
+        if (frames > frames_to_play)
+            frames = frames_to_play;
+
+        if (wav_file)
+            fwrite (dma_buffer + dma_index * 2, sizeof (int16_t) * 2, frames, wav_file);
+
+        wav_frames += frames;
+        dma_index += frames;
+        frames_to_play -= frames;
+
+#ifdef AUDIO_MAL_MODE_CIRCULAR
+        if (dma_index == dma_frames / 2) {
+            charge_buffer ();
+            EVAL_AUDIO_HalfTransfer_CallBack ((uint32_t)(uintptr_t) dma_buffer, 0);
+        }
+        else if (dma_index == dma_frames) {
+            charge_buffer ();
+            dma_index = 0;
+            EVAL_AUDIO_TransferComplete_CallBack ((uint32_t)(uintptr_t) dma_buffer, 0);
+        }
+#else
+        if (dma_index == dma_frames) {
+            charge_buffer ();
+            dma_active = 0;
+            EVAL_AUDIO_TransferComplete_CallBack ((uint32_t)(uintptr_t) dma_buffer, 0);
+        }
+#endif
+    }
+
+    if (frames_to_play && deadline)
+        dma_underruns++;
+
+    sim_samples += SIM_TICK_SAMPLES;
+
+    // sleeping until the next tick brings the cycle counter up to it (unless we're already past)
+
+    if ((int32_t) ((uint32_t) sim_samples * SIM_CYCLES_PER_SAMPLE - sim_cycle_count) > 0)
+        sim_cycle_count = (uint32_t) sim_samples * SIM_CYCLES_PER_SAMPLE;
+
+    // the LED controller normally runs in the SysTick handler; here we just watch for the dog
+    // to start barking (which is indicated by the orange LED toggling)
+
+    if ((LED_Toggle & LED_CTRL_ORANGE_TOGGLE) == LED_CTRL_ORANGE_TOGGLE) {
+        if (!barking) {
+            printf ("simboard: barking at %.3f seconds\n", sim_samples / (double) SIM_SAMPLE_RATE);
+            barking = 1;
+            barks++;
+        }
+    }
+    else
+        barking = 0;
+
+    busy_start = host_usecs ();
+    timing = 1;
+
+    if (!irq_disabled)
+        run_pend_sv ();
+}
+
+// Like the Cortex-M, a PendSV that's pended with the interrupts disabled waits for them to be
+// enabled again, and it never preempts itself.
+
+void __disable_irq (void)
+{
+    irq_disabled = 1;
+}
+
+void __enable_irq (void)
+{
+    irq_disabled = 0;
+    run_pend_sv ();
+}
+
+void sim_pend_sv (void)
+{
+    pend_sv = 1;
+}
+
+static void run_pend_sv (void)
+{
+    if (in_pend_sv)
+        return;
+
+    in_pend_sv = 1;
+
+    while (pend_sv) {
+        pend_sv = 0;
+        WavePlayerService ();
+    }
+
+    in_pend_sv = 0;
+}
+
+// the virtual cycle counter includes the processing time so far since the last wait
+
+uint32_t sim_cycles (void)
+{
+    if (timing)
+        return sim_cycle_count + (uint32_t) ((host_usecs () - busy_start) * SIM_CYCLES_PER_USEC);
+
+    return sim_cycle_count;
+}
+
+// Charge the processing time accumulated while the DMA was playing one buffer (or half buffer
+// in circular mode) against the deadline, which is the time it takes to play that buffer.
+
+static void charge_buffer (void)
+{
+    if (!busy_count || buffer_busy < busy_min) busy_min = buffer_busy;
+    if (buffer_busy > busy_max) busy_max = buffer_busy;
+    if (buffer_busy > deadline) deadline_misses++;
+
+    busy_total += buffer_busy;
+
+    // the buffers filled while barking are also tallied separately (to benchmark the playback)
+
+    if (barking) {
+        if (buffer_busy > bark_busy_max) bark_busy_max = buffer_busy;
+        bark_busy_total += buffer_busy;
+        bark_busy_count++;
+    }
+
+    buffer_busy = 0.0;
+    busy_count++;
+}
+
+// At the end of the microphone data we finish up the WAV file, display the timing results, and exit.
+
+static void sim_finish (void)
+{
+    uint32_t overruns, underruns;
+    uint16_t load, max_load;
+
+    if (wav_file) {
+        fseek (wav_file, 0, SEEK_SET);
+        write_wav_header (wav_file, wav_frames);
+        fclose (wav_file);
+    }
+
+    fclose (mic_file);
+
+    printf ("simboard: %.2f seconds simulated, %d barks, %d mic clipping events, %d DMA underruns\n",
+        sim_samples / (double) SIM_SAMPLE_RATE, barks, clips, dma_underruns);
+
+    WavePlayerMicStats (&overruns, &underruns);
+    printf ("simboard: mic ring had %u samples dropped (overrun) and %u short reads (underrun)\n", overruns, underruns);
+
+    WavePlayerCpuLoad (&load, &max_load);
+    printf ("simboard: cpu load (at %u MHz) was %u.%u%% for the last second and %u.%u%% at the peak\n",
+        CYCLES_PER_SECOND / 1000000, load / 10, load % 10, max_load / 10, max_load % 10);
+
+    if (busy_count)
+        printf ("simboard: %d buffers processed, min/avg/max = %.1f/%.1f/%.1f usecs (%.2f%% of %.0f usec deadline), %d missed\n",
+            busy_count, busy_min, busy_total / busy_count, busy_max, busy_max * 100.0 / deadline, deadline, deadline_misses);
+
+    if (bark_busy_count)
+        printf ("simboard: %d buffers processed while barking, avg/max = %.1f/%.1f usecs\n",
+            bark_busy_count, bark_busy_total / bark_busy_count, bark_busy_max);
+
+#ifdef USB_RECORDER
+    if (drive_image) {
+        struct diskimg_stats disk;
+        struct usbrec_stats usb;
+
+        usbrec_get_stats (&usb);
+        diskimg_get_stats (&disk);
+        diskimg_close ();
+
+        printf ("simboard: usb recorder logged %u events (%u dropped) and wrote %u clips (%u dropped), %u write errors\n",
+            usb.events_logged, usb.events_dropped, usb.clips_written, usb.clips_dropped, usb.write_errors);
+        printf ("simboard: usb drive had %u writes (%u sectors) and %u reads (%u sectors), %.2f seconds of latency\n",
+            disk.writes, disk.sectors_written, disk.reads, disk.sectors_read, disk.latency_usecs / 1000000.0);
+    }
+#endif
+
+    // the profile is in virtual cycles (host time at the board's clock rate, see cycles.h)
+
+    if (profile_stats) {
+        quiet = 0;
+        profile_dump ((uint32_t) (deadline * SIM_CYCLES_PER_USEC));
+    }
+
+    exit (0);
+}
+
+static double host_usecs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void write_wav_header (FILE *outfile, int num_frames)
+{
+    uint32_t data_bytes = num_frames * 4;
+    uint8_t header [44];
+
+    memcpy (header, "RIFF\0\0\0\0WAVEfmt \20\0\0\0\1\0\2\0\0\0\0\0\0\0\0\0\4\0\20\0data\0\0\0\0", 44);
+    header [4] = (data_bytes + 36); header [5] = (data_bytes + 36) >> 8;
+    header [6] = (data_bytes + 36) >> 16; header [7] = (data_bytes + 36) >> 24;
+    header [24] = SIM_SAMPLE_RATE & 0xff; header [25] = SIM_SAMPLE_RATE >> 8;
+    header [28] = (SIM_SAMPLE_RATE * 4) & 0xff; header [29] = (SIM_SAMPLE_RATE * 4) >> 8;
+    header [30] = (SIM_SAMPLE_RATE * 4) >> 16;
+    header [40] = data_bytes; header [41] = data_bytes >> 8;
+    header [42] = data_bytes >> 16; header [43] = data_bytes >> 24;
+    fwrite (header, 1, sizeof (header), outfile);
+}
+
+/*----------------------------------------------------------------------------*/
+
+// This is the threaded ring buffer stress test. The producer writes blocks of consecutive 16-bit
+// sequence numbers (sequence numbers of dropped samples are skipped, like real time would be) and
+// the consumer reads blocks of random sizes in place and adds up the gaps in the sequence (modulo
+// 65536). At the end, the gaps must match the samples dropped for overruns, and the samples
+// consumed plus the samples dropped must equal the samples produced. Stale or torn data would
+// show up as gaps that don't match. When the ring is full the producer usually yields to let the
+// consumer catch up (otherwise on a single core it would just drop nearly everything), but some
+// fraction of the time it writes anyway to exercise the overrun path.
+
+static struct ring stress_ring;
+static int16_t stress_buffer [RING_SIZE (STRESS_RING_BITS)];
+static uint32_t stress_produced;
+static int stress_done;
+
+static void *stress_producer (void *arg)
+{
+    uint32_t random = 1;
+    int16_t sequence = 0, block [STRESS_MAX_BLOCK];
+
+    while (stress_produced < STRESS_SAMPLES) {
+        int count = ((random = random * 1103515245 + 12345) >> 16) % STRESS_MAX_BLOCK + 1, i;
+
+        if (count > RING_SIZE (STRESS_RING_BITS) - ring_count (&stress_ring) && (random >> 24) % STRESS_OVERRUN_ODDS) {
+            sched_yield ();
+            continue;
+        }
+
+        for (i = 0; i < count; ++i)
+            block [i] = sequence++;
+
+        ring_write (&stress_ring, block, count);
+        stress_produced += count;
+    }
+
+    __atomic_store_n (&stress_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int ring_stress (void)
+{
+    uint32_t random = 2, consumed = 0, gaps = 0;
+    double start_time = host_usecs (), elapsed;
+    int16_t expected = 0;
+    int passed;
+    pthread_t producer;
+
+    ring_init (&stress_ring, stress_buffer, RING_SIZE (STRESS_RING_BITS));
+
+    if (pthread_create (&producer, NULL, stress_producer, NULL)) {
+        fprintf (stderr, "can't create producer thread !\n");
+        return 1;
+    }
+
+    while (1) {
+        int done = __atomic_load_n (&stress_done, __ATOMIC_ACQUIRE), count, i;
+        int wanted = ((random = random * 1103515245 + 12345) >> 16) % STRESS_MAX_BLOCK + 1;
+        int16_t *samples;
+
+        count = ring_peek (&stress_ring, &samples, wanted);
+
+        if (!count) {
+            if (done)
+                break;
+
+            ring_underrun (&stress_ring);
+            sched_yield ();
+            continue;
+        }
+
+        for (i = 0; i < count; ++i) {
+            gaps += (uint16_t)(samples [i] - expected);
+            expected = samples [i] + 1;
+        }
+
+        ring_advance (&stress_ring, count);
+        consumed += count;
+    }
+
+    pthread_join (producer, NULL);
+    elapsed = host_usecs () - start_time;
+
+    // the final gap (if the last samples were dropped) isn't seen by the consumer
+
+    gaps += (uint16_t)(stress_produced - expected);
+    passed = (uint16_t) gaps == (uint16_t) stress_ring.overruns && consumed + stress_ring.overruns == stress_produced;
+
+    printf ("ring stress: %u samples produced, %u consumed, %u dropped (overrun), %u short reads (underrun)\n",
+        stress_produced, consumed, stress_ring.overruns, stress_ring.underruns);
+    printf ("ring stress: %.1f million samples/sec, sequence gaps total %u, %s\n", stress_produced / elapsed, gaps,
+        passed ? "passed" : "FAILED");
+
+    return passed ? 0 : 1;
+}
+
+/*----------------------------------------------------------------------------*/
+
+// This is the PDM capture model. The same pseudo-random stream of SPI words is first fed to the
+// per-word (RXNE interrupt) path, and then written into a circular double buffer like the DMA
+// would, with the half and full transfer "interrupts" each serviced after a random latency of
+// up to almost a half buffer (any later and the DMA would be overwriting unprocessed data, on
+// the board too). The PCM samples coming out of the recorder must match bit for bit.
+
+extern PDMFilter_InitStruct Filter;
+static int16_t *model_pcm;
+static int model_samples;
+
+static void model_callback (int16_t *buffer, int num_samples)
+{
+    memcpy (model_pcm + model_samples, buffer, num_samples * sizeof (int16_t));
+    model_samples += num_samples;
+}
+
+static int capture_model (void)
+{
+    int num_words = MODEL_HALF_BUFFERS * AUDIO_REC_DMA_HALF_WORDS, word_samples, pending = 0, latency = 0, index = 0, i;
+    uint32_t random = 1, dma_buffer [AUDIO_REC_DMA_HALF_WORDS];
+    uint16_t *words = malloc (num_words * sizeof (uint16_t));
+    int16_t *word_pcm;
+
+    // the model PCM buffers have 1 sample per 4 PDM words
+
+    model_pcm = word_pcm = malloc (num_words / 4 * sizeof (int16_t));
+    sim_recorder_callback = model_callback;
+
+    for (i = 0; i < num_words; ++i)
+        words [i] = (random = random * 1103515245 + 12345) >> 16;
+
+    init_pdm_filter ();
+
+    for (i = 0; i < num_words; ++i)
+        WaveRecorder_PutWord (words [i]);
+
+    word_samples = model_samples;
+    model_pcm = malloc (num_words / 4 * sizeof (int16_t));
+    model_samples = 0;
+    init_pdm_filter ();
+
+    for (i = 0; i <= num_words; ++i) {
+        if (pending && (!latency-- || i == num_words)) {
+            WaveRecorder_ProcessHalf (pending == 1 ? dma_buffer : dma_buffer + AUDIO_REC_DMA_HALF_WORDS / 2);
+            pending = 0;
+        }
+
+        if (i == num_words)
+            break;
+
+        ((uint16_t *) dma_buffer) [index++] = words [i];
+
+        if (index == AUDIO_REC_DMA_HALF_WORDS || index == AUDIO_REC_DMA_HALF_WORDS * 2) {
+            pending = index == AUDIO_REC_DMA_HALF_WORDS ? 1 : 2;
+            latency = ((random = random * 1103515245 + 12345) >> 16) % AUDIO_REC_DMA_HALF_WORDS;
+
+            if (index == AUDIO_REC_DMA_HALF_WORDS * 2)
+                index = 0;
+        }
+    }
+
+    sim_recorder_callback = WaveRecorderCallback;
+
+    printf ("capture model: %d PDM words, %d PCM samples from per-word capture (%d interrupts/sec), %d from DMA capture (%d interrupts/sec)\n",
+        num_words, word_samples, 64000, model_samples, 64000 / AUDIO_REC_DMA_HALF_WORDS);
+
+    if (word_samples != model_samples || memcmp (word_pcm, model_pcm, model_samples * sizeof (int16_t))) {
+        printf ("capture model: FAILED, PCM streams differ\n");
+        return 1;
+    }
+
+    printf ("capture model: passed, PCM streams are bit-identical\n");
+    return 0;
+}
+
+// same PDM filter configuration as WaveRecorderInit() (which doesn't exist in the simulation)
+
+static void init_pdm_filter (void)
+{
+    Filter.LP_HZ = 8000;
+    Filter.HP_HZ = 10;
+    Filter.Fs = 16000;
+    Filter.Out_MicChannels = 1;
+    Filter.In_MicChannels = 1;
+    PDM_Filter_Init (&Filter);
+}
+
+/*----------------------------------------------------------------------------*/
+
+// This is the output buffer fill benchmark. A one second clip is copied into stereo frames a
+// buffer at a time (and then the same number of frames of silence are filled), first with the
+// loops that fill_buffer() used to have, which check for the end of the clip on every sample,
+// and then with the block functions. The results must be identical, of course.
+
+static int16_t bench_clip [BENCH_CLIP_SAMPLES];
+static uint32_t bench_frames [BENCH_CLIP_SAMPLES];
+
+static uint64_t bench_ticks (void)
+{
+#if defined (__i386__) || defined (__x86_64__)
+    return __rdtsc ();
+#else
+    return (uint64_t) (host_usecs () * 1000.0);
+#endif
+}
+
+static void old_fill (int16_t *buffer, int count, const int16_t **canned_audio, int *canned_samples)
+{
+    while (count--)
+        if (*canned_samples) {
+            *buffer++ = **canned_audio;
+            *buffer++ = *(*canned_audio)++;
+            --*canned_samples;
+        }
+        else {
+            *buffer++ = 0;
+            *buffer++ = 0;
+        }
+}
+
+static void block_fill (int16_t *buffer, int count, const int16_t **canned_audio, int *canned_samples)
+{
+    int frames = count < *canned_samples ? count : *canned_samples;
+
+    stereo_expand (buffer, *canned_audio, frames);
+    *canned_audio += frames;
+    *canned_samples -= frames;
+    stereo_silence (buffer + frames * 2, count - frames);
+}
+
+static double time_fill (void (*fill) (int16_t *, int, const int16_t **, int *), int silence)
+{
+    uint64_t best = 0;
+    int pass;
+
+    for (pass = 0; pass < BENCH_PASSES; ++pass) {
+        const int16_t *canned_audio = bench_clip;
+        int canned_samples = silence ? 0 : BENCH_CLIP_SAMPLES, offset;
+        uint64_t start = bench_ticks (), ticks;
+
+        for (offset = 0; offset < BENCH_CLIP_SAMPLES; offset += BENCH_FRAMES)
+            fill ((int16_t *) (bench_frames + offset), BENCH_FRAMES, &canned_audio, &canned_samples);
+
+        if ((ticks = bench_ticks () - start) < best || !pass)
+            best = ticks;
+    }
+
+    return (double) best / BENCH_CLIP_SAMPLES;
+}
+
+static int fill_benchmark (void)
+{
+    uint32_t random = 1, *expected = malloc (sizeof (bench_frames));
+    double old_copy, old_silence, new_copy, new_silence;
+    int passed, i;
+
+    for (i = 0; i < BENCH_CLIP_SAMPLES; ++i)
+        bench_clip [i] = (random = random * 1103515245 + 12345) >> 16;
+
+    old_copy = time_fill (old_fill, 0);
+    memcpy (expected, bench_frames, sizeof (bench_frames));
+    new_copy = time_fill (block_fill, 0);
+    passed = !memcmp (expected, bench_frames, sizeof (bench_frames));
+
+    // the odd-aligned source case (the M4 version handles this separately)
+
+    stereo_expand ((int16_t *) bench_frames, bench_clip + 1, BENCH_CLIP_SAMPLES - 1);
+    passed &= !memcmp (expected + 1, bench_frames, sizeof (bench_frames) - sizeof (uint32_t));
+
+    old_silence = time_fill (old_fill, 1);
+    new_silence = time_fill (block_fill, 1);
+
+    for (i = 0; i < BENCH_CLIP_SAMPLES; ++i)
+        passed &= !bench_frames [i];
+
+    printf ("fill benchmark: %d frames per fill, %s per frame (best of %d passes over %d frames)\n", BENCH_FRAMES,
+#if defined (__i386__) || defined (__x86_64__)
+        "TSC ticks",
+#else
+        "nanoseconds",
+#endif
+        BENCH_PASSES, BENCH_CLIP_SAMPLES);
+    printf ("fill benchmark: clip copy %.3f (sample loop) vs. %.3f (%s), silence %.3f vs. %.3f (block)\n",
+        old_copy, new_copy,
+#if defined (STEREO_EXPAND_SSE2)
+        "SSE2",
+#elif defined (STEREO_EXPAND_NEON)
+        "NEON",
+#else
+        "32-bit stores",
+#endif
+        old_silence, new_silence);
+    printf ("fill benchmark: %s\n", passed ? "passed, outputs are identical" : "FAILED, outputs differ");
+
+    free (expected);
+    return passed ? 0 : 1;
+}
+
+/*----------------------------------------------------------------------------*/
+
+// These are the stubs for the board, codec and microphone functions that the audio loop calls.
+// The only LED that the audio loop controls directly is the red one (LED5), for mic clipping.
+
+void STM_EVAL_LEDInit (Led_TypeDef Led) { }
+void STM_EVAL_LEDOff (Led_TypeDef Led) { }
+void STM_EVAL_LEDToggle (Led_TypeDef Led) { }
+
+void STM_EVAL_LEDOn (Led_TypeDef Led)
+{
+    if (Led == LED5)
+        clips++;
+}
+
+void EVAL_AUDIO_SetAudioInterface (uint32_t Interface) { }
+uint32_t EVAL_AUDIO_Init (uint16_t OutputDevice, uint8_t Volume, uint32_t AudioFreq) { return 0; }
+uint32_t EVAL_AUDIO_PauseResume (uint32_t Cmd) { return 0; }
+uint32_t EVAL_AUDIO_Stop (uint32_t CodecPowerDown_Mode) { return 0; }
+uint32_t EVAL_AUDIO_VolumeCtl (uint8_t Volume) { return 0; }
+
+// Like the real driver, the size is in bytes and the buffer is stereo 16-bit samples. The real-time
+// deadline for the main loop is the duration of the buffer (or half of it in circular mode).
+
+void Audio_MAL_Play (uint32_t Addr, uint32_t Size)
+{
+    dma_buffer = (int16_t *)(uintptr_t) Addr;
+    dma_frames = Size / 4;
+    dma_index = 0;
+    dma_active = 1;
+    deadline = dma_frames * 1000000.0 / SIM_SAMPLE_RATE;
+
+#ifdef AUDIO_MAL_MODE_CIRCULAR
+    deadline /= 2.0;
+#endif
+}
+
+void WaveRecorderBeginSampling (void) { }
+
+void Dbg_puts (const char *s)
+{
+    if (!quiet)
+        fputs (s, stdout);
+}
+
+// The line is always formatted (even when quiet) so that the logging stage is profiled as on
+// the board, where the formatting is done whether or not anyone is listening.
+
+void Dbg_printf (const char *format, ...)
+{
+    uint32_t start = profile_begin ();
+    char pstring [128];
+    va_list args;
+
+    va_start (args, format);
+    vsnprintf (pstring, sizeof (pstring), format, args);
+    va_end (args);
+
+    if (!quiet)
+        fputs (pstring, stdout);
+
+    profile_end (PROFILE_LOG, start);
+}
+
+// Binary log records (see logfmt.h) are decoded right away (the timestamp isn't displayed).
+
+void Dbg_write (const void *data, int bytes)
+{
+    char text [256];
+
+    if (!quiet && logfmt_decode (data, bytes, text, sizeof (text), NULL) > 0)
+        fputs (text, stdout);
+}
+
+// the debug output can't overflow in the simulation
+
+uint32_t Dbg_dropped (void)
+{
+    return 0;
+}
+
+#ifdef USB_RECORDER
+
+// The USB drive's latency is spent like the main loop's waits on the board: the simulated clock
+// keeps running (one tick per millisecond of latency), and the audio preempts the waiting.
+
+static void drive_wait (uint32_t usecs)
+{
+    static uint32_t pending_usecs;
+
+    for (pending_usecs += usecs; pending_usecs >= 1000000 / SIM_SAMPLE_RATE * SIM_TICK_SAMPLES;
+        pending_usecs -= 1000000 / SIM_SAMPLE_RATE * SIM_TICK_SAMPLES)
+            sim_wait_for_interrupt ();
+}
+
+#endif
+
+// The debug port input is the -k commands, each one made available at the next whole simulated
+// second (the semicolons and the end of the string are the carriage returns).
+
+int Dbg_getc (void)
+{
+    if (!console_input || sim_samples < console_time)
+        return -1;
+
+    if (!*console_input) {
+        console_input = NULL;
+        return '\r';
+    }
+
+    if (*console_input++ == ';') {
+        console_time += SIM_SAMPLE_RATE;
+        return '\r';
+    }
+
+    return console_input [-1];
+}
@@ -23,6 +23,10 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
+#ifdef USB_RECORDER
+#include "usbh_usr.h"
+#include "usb_hcd_int.h"
+#endif
 
 
 /** @addtogroup STM32F4-Discovery_Audio_Player_Recorder
@@ -123,12 +127,15 @@ void DebugMon_Handler(void)
 }
 
 /**
-  * @brief  This function handles PendSVC exception.
+  * @brief  This function handles PendSVC exception. With the USB recorder
+  *         the output buffers are filled here (see waveplayer.c), at the
+  *         lowest priority, and the DMA callbacks pend it.
   * @param  None
   * @retval None
   */
 void PendSV_Handler(void)
 {
+  WavePlayerService();
 }
 
 static void LED_periodic_controller (void)
@@ -249,6 +256,19 @@ void EXTI0_IRQHandler(void)
   EXTI_ClearITPendingBit(EXTI_Line0);
 }
 
+/**
+  * @brief  This function handles the USB OTG_FS interrupt (the host for the
+  *         USB recorder's drive, see usbh_usr.c).
+  * @param  None
+  * @retval None
+  */
+#ifdef USB_RECORDER
+void OTG_FS_IRQHandler(void)
+{
+  USBH_OTG_ISR_Handler(&USB_OTG_Core);
+}
+#endif
+
 /**
   * @brief  This function handles PPP interrupt request.
   * @param  None
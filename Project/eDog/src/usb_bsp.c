@@ -0,0 +1,156 @@
+/**
+  ******************************************************************************
+  * @file    usb_bsp.c
+  * @author  MCD Application Team
+  * @version V2.0.0
+  * @date    22-July-2011
+  * @brief   USB OTG_FS host board support for the STM32F4-Discovery (the
+  *          micro-AB connector CN5, with the VBUS power switch on PC0)
+  ******************************************************************************
+  * @attention
+  *
+  * THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+  * WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+  * TIME. AS A RESULT, STMICROELECTRONICS SHALL NOT BE HELD LIABLE FOR ANY
+  * DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+  * FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+  * CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+  *
+  * <h2><center>&copy; COPYRIGHT 2011 STMicroelectronics</center></h2>
+  ******************************************************************************
+  */ 
+
+/* Includes ------------------------------------------------------------------*/
+#include "usb_bsp.h"
+#include "usb_hcd_int.h"
+#include "cycles.h"
+
+/* Private define ------------------------------------------------------------*/
+
+/* The STMPS2141 power switch that supplies VBUS to the connector is enabled
+ * by driving PC0 low */
+#define HOST_POWERSW_PORT_RCC             RCC_AHB1Periph_GPIOC
+#define HOST_POWERSW_PORT                 GPIOC
+#define HOST_POWERSW_VBUS                 GPIO_Pin_0
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  USB_OTG_BSP_Init
+  *         Initializes the OTG_FS pins (VBUS sense on PA9, ID on PA10 and the
+  *         data lines on PA11/PA12) and clock
+  * @param  pdev: USB OTG core handle
+  * @retval None
+  */
+void USB_OTG_BSP_Init(USB_OTG_CORE_HANDLE *pdev)
+{
+  GPIO_InitTypeDef GPIO_InitStructure;
+
+  RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+  GPIO_InitStructure.GPIO_Pin = GPIO_Pin_9 | GPIO_Pin_11 | GPIO_Pin_12;
+  GPIO_InitStructure.GPIO_Speed = GPIO_Speed_100MHz;
+  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
+  GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
+  GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL;
+  GPIO_Init(GPIOA, &GPIO_InitStructure);
+
+  GPIO_PinAFConfig(GPIOA, GPIO_PinSource9, GPIO_AF_OTG1_FS);
+  GPIO_PinAFConfig(GPIOA, GPIO_PinSource11, GPIO_AF_OTG1_FS);
+  GPIO_PinAFConfig(GPIOA, GPIO_PinSource12, GPIO_AF_OTG1_FS);
+
+  /* the ID line is open drain with a pull-up */
+  GPIO_InitStructure.GPIO_Pin = GPIO_Pin_10;
+  GPIO_InitStructure.GPIO_OType = GPIO_OType_OD;
+  GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_UP;
+  GPIO_Init(GPIOA, &GPIO_InitStructure);
+  GPIO_PinAFConfig(GPIOA, GPIO_PinSource10, GPIO_AF_OTG1_FS);
+
+  RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+  RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_OTG_FS, ENABLE);
+}
+
+/**
+  * @brief  USB_OTG_BSP_EnableInterrupt
+  *         Enables the OTG_FS interrupt, below the audio and the serial port
+  *         but above the buffer filling (PendSV, see waveplayer.c)
+  * @param  pdev: USB OTG core handle
+  * @retval None
+  */
+void USB_OTG_BSP_EnableInterrupt(USB_OTG_CORE_HANDLE *pdev)
+{
+  NVIC_InitTypeDef NVIC_InitStructure;
+
+  NVIC_InitStructure.NVIC_IRQChannel = OTG_FS_IRQn;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 3;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+  NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&NVIC_InitStructure);
+}
+
+/**
+  * @brief  USB_OTG_BSP_DriveVBUS
+  *         Drives the VBUS power switch (which is active low)
+  * @param  pdev: USB OTG core handle
+  * @param  state: VBUS state (1 to supply power)
+  * @retval None
+  */
+void USB_OTG_BSP_DriveVBUS(USB_OTG_CORE_HANDLE *pdev, uint8_t state)
+{
+  if (state == 0)
+    GPIO_SetBits(HOST_POWERSW_PORT, HOST_POWERSW_VBUS);
+  else
+    GPIO_ResetBits(HOST_POWERSW_PORT, HOST_POWERSW_VBUS);
+}
+
+/**
+  * @brief  USB_OTG_BSP_ConfigVBUS
+  *         Configures the VBUS power switch pin (and leaves it off)
+  * @param  pdev: USB OTG core handle
+  * @retval None
+  */
+void USB_OTG_BSP_ConfigVBUS(USB_OTG_CORE_HANDLE *pdev)
+{
+  GPIO_InitTypeDef GPIO_InitStructure;
+
+  RCC_AHB1PeriphClockCmd(HOST_POWERSW_PORT_RCC, ENABLE);
+
+  GPIO_InitStructure.GPIO_Pin = HOST_POWERSW_VBUS;
+  GPIO_InitStructure.GPIO_Speed = GPIO_Speed_100MHz;
+  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_OUT;
+  GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
+  GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL;
+  GPIO_Init(HOST_POWERSW_PORT, &GPIO_InitStructure);
+
+  GPIO_SetBits(HOST_POWERSW_PORT, HOST_POWERSW_VBUS);
+
+  /* let the VBUS capacitor discharge */
+  USB_OTG_BSP_mDelay(200);
+}
+
+/**
+  * @brief  USB_OTG_BSP_uDelay
+  *         Busy waits with the cycle counter (see cycles.h), so this can only
+  *         be used after cycles_init()
+  * @param  usec: Value of delay required in micro sec
+  * @retval None
+  */
+void USB_OTG_BSP_uDelay(const uint32_t usec)
+{
+  uint32_t start = cycles_now ();
+
+  while (cycles_now () - start < usec * (CYCLES_PER_SECOND / 1000000))
+    ;
+}
+
+/**
+  * @brief  USB_OTG_BSP_mDelay
+  * @param  msec: Value of delay required in milli sec
+  * @retval None
+  */
+void USB_OTG_BSP_mDelay(const uint32_t msec)
+{
+  USB_OTG_BSP_uDelay(msec * 1000);
+}
+
+/******************* (C) COPYRIGHT 2011 STMicroelectronics *****END OF FILE****/
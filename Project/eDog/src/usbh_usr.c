@@ -0,0 +1,261 @@
+/**
+  ******************************************************************************
+  * @file    usbh_usr.c
+  * @author  MCD Application Team
+  * @version V1.0.0
+  * @date    28-October-2011
+  * @brief   USB host user callbacks for the event recorder's USB drive
+  ******************************************************************************
+  * @attention
+  *
+  * THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+  * WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+  * TIME. AS A RESULT, STMICROELECTRONICS SHALL NOT BE HELD LIABLE FOR ANY
+  * DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+  * FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+  * CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+  *
+  * <h2><center>&copy; COPYRIGHT 2011 STMicroelectronics</center></h2>
+  ******************************************************************************
+  */ 
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "usbh_usr.h"
+#include "usbrec.h"
+
+/** @addtogroup STM32F4-Discovery_Audio_Player_Recorder
+* @{
+*/ 
+
+/* Private variables ---------------------------------------------------------*/
+
+/* These are the host core and state, which the MSC class's FatFs glue
+ * (usbh_msc_fatfs.c) also uses */
+USB_OTG_CORE_HANDLE USB_OTG_Core;
+USBH_HOST USB_Host;
+
+/* The callbacks just track the drive for the event recorder (usbrec.c), which
+ * does all the file system access from the main loop (between USBH_Process()
+ * calls), so the MSC application callback itself does nothing. */
+USBH_Usr_cb_TypeDef USR_Callbacks =
+{
+  USBH_USR_Init,
+  USBH_USR_DeInit,
+  USBH_USR_DeviceAttached,
+  USBH_USR_ResetDevice,
+  USBH_USR_DeviceDisconnected,
+  USBH_USR_OverCurrentDetected,
+  USBH_USR_DeviceSpeedDetected,
+  USBH_USR_Device_DescAvailable,
+  USBH_USR_DeviceAddressAssigned,
+  USBH_USR_Configuration_DescAvailable,
+  USBH_USR_Manufacturer_String,
+  USBH_USR_Product_String,
+  USBH_USR_SerialNum_String,
+  USBH_USR_EnumerationDone,
+  USBH_USR_UserInput,
+  USBH_USR_MSC_Application,
+  USBH_USR_DeviceNotSupported,
+  USBH_USR_UnrecoveredError
+};
+
+static uint8_t drive_ready;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  USBH_USR_Init 
+  *         Host library is initialized
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_Init(void)
+{
+  drive_ready = 0;
+}
+
+/**
+  * @brief  USBH_USR_DeviceAttached 
+  *         A device has been plugged in (it's not usable until enumerated)
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_DeviceAttached(void)
+{
+  Dbg_puts ("usb: device attached\n");
+}
+
+/**
+  * @brief  USBH_USR_UnrecoveredError
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_UnrecoveredError (void)
+{
+  Dbg_puts ("usb: unrecovered error\n");
+  USBH_USR_DeviceDisconnected ();
+}
+
+/**
+  * @brief  USBH_USR_DeviceDisconnected
+  *         The device has been removed, so the recorder must drop the drive
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_DeviceDisconnected (void)
+{
+  drive_ready = 0;
+  usbrec_attach (0);
+}
+
+/**
+  * @brief  USBH_USR_ResetDevice 
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_ResetDevice(void)
+{
+}
+
+/**
+  * @brief  USBH_USR_DeviceSpeedDetected 
+  * @param  DeviceSpeed : USB speed
+  * @retval None
+  */
+void USBH_USR_DeviceSpeedDetected(uint8_t DeviceSpeed)
+{
+}
+
+/**
+  * @brief  USBH_USR_Device_DescAvailable 
+  * @param  DeviceDesc : device descriptor
+  * @retval None
+  */
+void USBH_USR_Device_DescAvailable(void *DeviceDesc)
+{
+}
+
+/**
+  * @brief  USBH_USR_DeviceAddressAssigned 
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_DeviceAddressAssigned(void)
+{
+}
+
+/**
+  * @brief  USBH_USR_Configuration_DescAvailable 
+  * @param  cfgDesc : Configuration descriptor
+  * @param  itfDesc : Interface descriptor
+  * @param  epDesc : Endpoint descriptor
+  * @retval None
+  */
+void USBH_USR_Configuration_DescAvailable(USBH_CfgDesc_TypeDef * cfgDesc,
+                                          USBH_InterfaceDesc_TypeDef *itfDesc,
+                                          USBH_EpDesc_TypeDef *epDesc)
+{
+}
+
+/**
+  * @brief  USBH_USR_Manufacturer_String 
+  * @param  ManufacturerString : Manufacturer String of Device
+  * @retval None
+  */
+void USBH_USR_Manufacturer_String(void *ManufacturerString)
+{
+}
+
+/**
+  * @brief  USBH_USR_Product_String 
+  * @param  ProductString : Product String of Device
+  * @retval None
+  */
+void USBH_USR_Product_String(void *ProductString)
+{
+}
+
+/**
+  * @brief  USBH_USR_SerialNum_String 
+  * @param  SerialNumString : SerialNum_String of device
+  * @retval None
+  */
+void USBH_USR_SerialNum_String(void *SerialNumString)
+{
+}
+
+/**
+  * @brief  EnumerationDone 
+  *         User response request is displayed to ask for application jump to class
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_EnumerationDone(void)
+{
+}
+
+/**
+  * @brief  USBH_USR_DeviceNotSupported
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_DeviceNotSupported(void)
+{
+  Dbg_puts ("usb: device is not a mass storage device\n");
+}
+
+/**
+  * @brief  USBH_USR_UserInput
+  *         There's no user to ask, so always go ahead with the class
+  * @param  None
+  * @retval USBH_USR_Status : User response for key button
+  */
+USBH_USR_Status USBH_USR_UserInput(void)
+{
+  return USBH_USR_RESP_OK;
+}
+
+/**
+  * @brief  USBH_USR_OverCurrentDetected
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_OverCurrentDetected (void)
+{
+  Dbg_puts ("usb: overcurrent detected\n");
+}
+
+/**
+  * @brief  USBH_USR_MSC_Application
+  *         Called repeatedly once the drive is ready; the first call hands it
+  *         to the recorder
+  * @param  None
+  * @retval Status (always 0 to stay in the application state)
+  */
+int USBH_USR_MSC_Application(void)
+{
+  if (!drive_ready) {
+    drive_ready = 1;
+    usbrec_attach (1);
+  }
+
+  return 0;
+}
+
+/**
+  * @brief  USBH_USR_DeInit
+  *         Deint User state and associated variables
+  * @param  None
+  * @retval None
+  */
+void USBH_USR_DeInit(void)
+{
+  drive_ready = 0;
+}
+
+/**
+  * @}
+  */ 
+
+/******************* (C) COPYRIGHT 2011 STMicroelectronics *****END OF FILE****/
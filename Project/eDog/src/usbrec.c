@@ -0,0 +1,546 @@
+////////////////////////////////////////////////////////////////////////////
+//                             **** eDog ****                             //
+//                                                                        //
+//                  Electronic Dog Home Security System                   //
+//                                 on the                                 //
+//                           STM32F4-Discovery                            //
+//                                                                        //
+//                    Copyright (c) 2014 David Bryant                     //
+//                          All Rights Reserved                           //
+//        Distributed under the GNU Software License (see COPYING)        //
+////////////////////////////////////////////////////////////////////////////
+
+// usbrec.c
+
+// This is the event and clip recorder (see usbrec.h). There are two queues between the audio side
+// and the writers, both lock-free with exactly one producer and one consumer (like ring.h):
+//
+// 1. The history ring holds the last HISTORY_SAMPLES of scanned microphone audio (about 2 seconds).
+//    It's always written (the audio side never waits for the writer), so the writer copies a clip
+//    out a chunk at a time and then checks that the chunk wasn't overwritten while it was copying.
+//    The producer advances "history_claimed" before it writes and "history_written" after, so the
+//    data below history_written is complete and anything above history_claimed - HISTORY_SAMPLES
+//    is still intact. If a clip's audio is lost (because the writer fell behind) the partial file
+//    is deleted and the clip is counted as dropped.
+//
+// 2. The event queue holds the detection records waiting to be logged. If it's full, the new
+//    event is dropped and counted.
+//
+// The writing is done by two independent tasks, the log writer and the clip writer, each with its
+// own file. FatFs is built reentrant (see option/syncobj.c) so neither has to know what the other
+// is doing. usbrec_service() is a simple cooperative scheduler: each call runs one step (a single
+// file operation) of the next task that has something to do, taking turns, so a long clip doesn't
+// hold up the log (and the log doesn't hold up a clip by more than a line). The log writer numbers
+// the clips as it logs them and passes them to the clip writer in a small clip queue (if that's
+// full, the clip is dropped, but the event is still logged).
+//
+// The clips start CLIP_PRE_SAMPLES before the event time (which for knocks is the first knock, a
+// second or so before the detection) and are a fixed length, so the WAV header can be written
+// first. Each clip file is allocated as one contiguous block up front (f_expand) and the header
+// goes out with the first chunk of audio (which is short by the header size), so every write
+// is whole sectors and FatFs sends it straight to the drive as one command without touching the
+// FAT. If the drive is too fragmented for that, the clip is just written the normal way. Only
+// the final detections get a clip (the provisional and retracted knocks are just logged). The main
+// loop keeps running between the writer steps, and the log file is synced after every line so
+// pulling the drive loses very little.
+
+#ifdef HOST_SIM
+#include <simboard.h>
+#else
+#include <main.h>
+#include "usbh_usr.h"
+#endif
+#include <string.h>
+#include <stdio.h>
+
+#include "usbrec.h"
+#include "ring.h"
+#include "ff.h"
+
+#define SAMPLING_RATE 16000
+#define DAY_SAMPLES (SAMPLING_RATE * 3600 * 24)     // the scanner's time wraps daily
+
+#define HISTORY_BITS 15                 // 32768 samples (2.05 seconds, 64K bytes)
+#define HISTORY_SAMPLES (1 << HISTORY_BITS)
+#define HISTORY_MASK (HISTORY_SAMPLES - 1)
+
+#define CLIP_PRE_SAMPLES (SAMPLING_RATE / 4)
+#define CLIP_SAMPLES (SAMPLING_RATE * 5 / 2)
+#define CLIP_MAX_AGE (HISTORY_SAMPLES * 3 / 4) // older starts are moved up (leaves the writer 0.5 sec)
+#define CLIP_CHUNK_BYTES 4096               // written 4K bytes (8 sectors) at a time
+#define WAV_HEADER_BYTES 44
+
+#define EVENT_QUEUE_SIZE 8                  // must be a power of two
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+#define CLIP_QUEUE_SIZE 4                   // must be a power of two
+#define CLIP_QUEUE_MASK (CLIP_QUEUE_SIZE - 1)
+
+#define LOG_FILENAME "EVENTS.TXT"
+#define CLIP_TYPES (SCAN_KNOCK_DETECTED | SCAN_BELL_DETECTED | SCAN_ALARM_DETECTED | SCAN_GLASS_DETECTED)
+
+// producer (audio) side
+
+static int16_t history [HISTORY_SAMPLES];
+static volatile uint32_t history_claimed, history_written;
+static uint32_t stream_seconds, stream_remainder;   // stream time, without the 32-bit wrap
+
+static struct event {
+    struct scan_detection record;
+    uint32_t seconds, samples;      // time of the event (seconds and samples since power-up)
+    uint32_t clip_start;            // history position of the first clip sample
+} event_queue [EVENT_QUEUE_SIZE];
+
+static volatile uint32_t event_head, event_tail;
+static volatile uint32_t events_dropped;
+
+// consumer (writer) side
+
+static struct clip_request {
+    uint32_t clip_start;            // history position of the first clip sample
+    int number;                     // clip file number (CLIPnnnn.WAV)
+} clip_queue [CLIP_QUEUE_SIZE];
+
+static uint32_t clip_head, clip_tail;   // both writers run in the main loop, so no locking here
+
+static FATFS fatfs;
+static FIL log_file, clip_file;
+static volatile int attached;
+static int mounted, next_writer, clip_open, clip_number, clip_file_number;
+static uint32_t clip_position, clip_end;
+static uint8_t clip_chunk [CLIP_CHUNK_BYTES];
+static int clip_header_bytes;       // header bytes waiting at the front of clip_chunk
+static uint32_t events_logged, clips_written, clips_dropped, write_errors, reported_drops;
+
+static int mount_drive (void);
+static void unmount_drive (void);
+static int log_writer (void);
+static int clip_writer (void);
+static int write_clip_chunk (void);
+static int log_event (struct event *event, int number);
+static void open_clip (struct clip_request *request);
+static void close_clip (int keep);
+static void write_error (const char *operation, FRESULT result);
+
+void usbrec_init (void)
+{
+#ifndef HOST_SIM
+    USBH_Init (&USB_OTG_Core, USB_OTG_FS_CORE_ID, &USB_Host, &USBH_MSC_cb, &USR_Callbacks);
+#endif
+}
+
+// Copy a scanned block of microphone audio into the history ring (this never waits).
+
+void usbrec_audio (const int16_t *samples, int num_samples)
+{
+    uint32_t position = history_written;
+
+    ring_store_release (&history_claimed, position + num_samples);
+
+    while (num_samples) {
+        int index = position & HISTORY_MASK, count = HISTORY_SAMPLES - index;
+
+        if (count > num_samples)
+            count = num_samples;
+
+        memcpy (history + index, samples, count * sizeof (int16_t));
+        position += count;
+        samples += count;
+        num_samples -= count;
+
+        if ((stream_remainder += count) >= SAMPLING_RATE) {
+            stream_remainder -= SAMPLING_RATE;
+            stream_seconds++;
+        }
+    }
+
+    ring_store_release (&history_written, position);
+}
+
+// Queue a detection record from the block just passed to usbrec_audio(), or count it as dropped if
+// the queue is full. The event's age comes from the scanner's current time (which is at the end of
+// that block), and the clip position from that.
+
+void usbrec_detection (const struct scan_detection *record)
+{
+    uint32_t tail = ring_load_acquire (&event_tail), age;
+    struct scan_stats stats;
+    struct event *event;
+
+    if (event_head - tail == EVENT_QUEUE_SIZE) {
+        events_dropped++;
+        return;
+    }
+
+    scan_get_stats (&stats);
+    age = (stats.time - record->time + DAY_SAMPLES) % DAY_SAMPLES;
+
+    event = event_queue + (event_head & EVENT_QUEUE_MASK);
+    event->record = *record;
+    event->seconds = stream_seconds - age / SAMPLING_RATE;
+    event->samples = stream_remainder - age % SAMPLING_RATE;
+
+    if ((int32_t) event->samples < 0) {
+        event->samples += SAMPLING_RATE;
+        event->seconds--;
+    }
+
+    if (age + CLIP_PRE_SAMPLES > CLIP_MAX_AGE)
+        event->clip_start = history_written - CLIP_MAX_AGE;
+    else
+        event->clip_start = history_written - age - CLIP_PRE_SAMPLES;
+
+    ring_store_release (&event_head, event_head + 1);
+}
+
+// Do the next piece of writing: mount a newly attached drive, or run one step of the next writer
+// task that has something to do. Any new drops are reported here (because the producer can't
+// print). On the board this also runs the USB host state machine.
+
+static int (*const writers []) (void) = { log_writer, clip_writer };
+
+#define NUM_WRITERS ((int)(sizeof (writers) / sizeof (writers [0])))
+
+int usbrec_service (void)
+{
+    int i;
+
+#ifndef HOST_SIM
+    USBH_Process (&USB_OTG_Core, &USB_Host);
+#endif
+
+    if (events_dropped != reported_drops) {
+        reported_drops = events_dropped;
+        Dbg_printf ("usb recorder: %u events dropped (queue full)\n", reported_drops);
+    }
+
+    if (!attached) {
+        if (mounted)
+            unmount_drive ();
+
+        return 0;
+    }
+
+    if (!mounted)
+        return mount_drive ();
+
+    for (i = 0; i < NUM_WRITERS; ++i) {
+        int (*writer) (void) = writers [next_writer];
+
+        next_writer = (next_writer + 1) % NUM_WRITERS;
+
+        if (writer ())
+            return 1;
+    }
+
+    return 0;
+}
+
+void usbrec_attach (int present)
+{
+    attached = present;
+}
+
+void usbrec_get_stats (struct usbrec_stats *stats)
+{
+    stats->attached = attached;
+    stats->mounted = mounted;
+    stats->events_logged = events_logged;
+    stats->events_dropped = events_dropped;
+    stats->clips_written = clips_written;
+    stats->clips_dropped = clips_dropped;
+    stats->write_errors = write_errors;
+}
+
+// Mount the file system, open (or create) the log file for appending, and find the highest clip
+// number already on the drive so that we don't overwrite old clips. Returns nonzero on success.
+
+static int mount_drive (void)
+{
+    FILINFO info;
+    FRESULT result;
+    DIR dir;
+
+    f_mount (0, &fatfs);
+    clip_number = 0;
+
+    if ((result = f_opendir (&dir, "")) != FR_OK) {
+        write_error ("mount", result);
+        usbrec_attach (0);
+        return 0;
+    }
+
+    while (f_readdir (&dir, &info) == FR_OK && info.fname [0])
+        if (!strncmp (info.fname, "CLIP", 4) && !strcmp (info.fname + 8, ".WAV")) {
+            int number = (info.fname [4] - '0') * 1000 + (info.fname [5] - '0') * 100 +
+                (info.fname [6] - '0') * 10 + (info.fname [7] - '0');
+
+            if (number > clip_number && number <= 9999)
+                clip_number = number;
+        }
+
+    if ((result = f_open (&log_file, LOG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE)) != FR_OK ||
+        (result = f_lseek (&log_file, log_file.fsize)) != FR_OK) {
+            write_error ("log file", result);
+            usbrec_attach (0);
+            return 0;
+    }
+
+    Dbg_printf ("usb recorder: drive mounted, next clip is %d\n", clip_number + 1);
+    mounted = 1;
+    return 1;
+}
+
+// The drive is gone, so just forget the open files (there's nothing to flush them to) and the
+// clips waiting to be written.
+
+static void unmount_drive (void)
+{
+    if (clip_open) {
+        clip_open = 0;
+        clips_dropped++;
+    }
+
+    clips_dropped += clip_head - clip_tail;
+    clip_tail = clip_head;
+
+    f_mount (0, NULL);
+    mounted = 0;
+    Dbg_puts ("usb recorder: drive removed\n");
+}
+
+// The log writer task: log the next queued event and, if it gets a clip, pass that on to the clip
+// writer. Returns nonzero if there was an event.
+
+static int log_writer (void)
+{
+    struct event *event;
+    int number = 0;
+
+    if (event_tail == ring_load_acquire (&event_head))
+        return 0;
+
+    event = event_queue + (event_tail & EVENT_QUEUE_MASK);
+
+    if (event->record.type & CLIP_TYPES)
+        number = clip_number % 9999 + 1;
+
+    if (log_event (event, number) && number) {
+        clip_number = number;
+
+        if (clip_head - clip_tail == CLIP_QUEUE_SIZE) {
+            Dbg_printf ("usb recorder: clip %d dropped (queue full)\n", number);
+            clips_dropped++;
+        }
+        else {
+            clip_queue [clip_head & CLIP_QUEUE_MASK].clip_start = event->clip_start;
+            clip_queue [clip_head & CLIP_QUEUE_MASK].number = number;
+            clip_head++;
+        }
+    }
+
+    ring_store_release (&event_tail, event_tail + 1);
+    return 1;
+}
+
+// The clip writer task: write the next chunk of the clip in progress, or start the next queued
+// one. Returns nonzero if something was done.
+
+static int clip_writer (void)
+{
+    if (clip_open)
+        return write_clip_chunk ();
+
+    if (clip_tail == clip_head)
+        return 0;
+
+    open_clip (clip_queue + (clip_tail++ & CLIP_QUEUE_MASK));
+    return 1;
+}
+
+// Append one line describing the event (and its clip number, if any) to the log. Returns nonzero
+// if it was written.
+
+static int log_event (struct event *event, int number)
+{
+    struct scan_detection *record = &event->record;
+    char line [160], clip_name [16];
+    FRESULT result;
+    UINT written;
+    int length;
+
+    if (number)
+        sprintf (clip_name, "CLIP%04d.WAV", number);
+    else
+        strcpy (clip_name, "no clip");
+
+    length = sprintf (line, "%03u:%02u:%06.3f ", event->seconds / 3600, event->seconds / 60 % 60,
+        event->seconds % 60 + event->samples / (float) SAMPLING_RATE);
+
+    switch (record->type) {
+        case SCAN_KNOCK_DETECTED:
+        case SCAN_KNOCK_PROVISIONAL:
+        case SCAN_KNOCK_RETRACTED:
+            length += sprintf (line + length, "knock %s, span = %d, ratio = %.3f, heights = %d-%d, confidence = %.2f",
+                record->type == SCAN_KNOCK_DETECTED ? "detected" : record->type == SCAN_KNOCK_PROVISIONAL ? "provisional" : "retracted",
+                record->span, record->ratio, record->min_height, record->max_height, record->confidence);
+            break;
+
+        case SCAN_BELL_DETECTED:
+            length += sprintf (line + length, "bell %d detected, delay = %d, filter excess = %.2f, confidence = %.2f",
+                record->bell_id, record->span, record->filter_excess, record->confidence);
+            break;
+
+        case SCAN_ALARM_DETECTED:
+            length += sprintf (line + length, "alarm detected, pattern = T%d, confidence = %.2f",
+                record->pattern, record->confidence);
+            break;
+
+        case SCAN_GLASS_DETECTED:
+            length += sprintf (line + length, "glass break detected, impact = %d, hf ratio = %.2f, confidence = %.2f",
+                record->max_height, record->ratio, record->confidence);
+            break;
+
+        default:
+            length += sprintf (line + length, "event type %d", record->type);
+            break;
+    }
+
+    length += sprintf (line + length, ", %s\r\n", clip_name);
+
+    if ((result = f_write (&log_file, line, length, &written)) != FR_OK || written != length ||
+        (result = f_sync (&log_file)) != FR_OK) {
+            write_error ("log", result);
+            return 0;
+    }
+
+    events_logged++;
+    return 1;
+}
+
+// Start the requested clip: create and allocate the file, and put the WAV header (the length is
+// fixed) at the front of the first chunk.
+
+static void open_clip (struct clip_request *request)
+{
+    static const uint8_t wav_header [WAV_HEADER_BYTES] = {
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+        'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0,                // PCM, mono
+        SAMPLING_RATE & 0xff, SAMPLING_RATE >> 8, 0, 0,             // sample rate
+        (SAMPLING_RATE * 2) & 0xff, (SAMPLING_RATE * 2) >> 8, 0, 0, // byte rate
+        2, 0, 16, 0, 'd', 'a', 't', 'a', 0, 0, 0, 0                 // block align, bits
+    };
+
+    uint32_t data_bytes = CLIP_SAMPLES * 2;
+    uint8_t *header = clip_chunk;
+    char clip_name [16];
+    FRESULT result;
+
+    memcpy (header, wav_header, WAV_HEADER_BYTES);
+    header [4] = (data_bytes + 36);
+    header [5] = (data_bytes + 36) >> 8;
+    header [6] = (data_bytes + 36) >> 16;
+    header [40] = data_bytes;
+    header [41] = data_bytes >> 8;
+    header [42] = data_bytes >> 16;
+
+    clip_file_number = request->number;
+    sprintf (clip_name, "CLIP%04d.WAV", clip_file_number);
+
+    if ((result = f_open (&clip_file, clip_name, FA_CREATE_ALWAYS | FA_WRITE)) != FR_OK) {
+        write_error ("clip open", result);
+        clips_dropped++;
+        return;
+    }
+
+    // no contiguous space is not an error (the clip is written the normal way), but others are
+
+    if ((result = f_expand (&clip_file, WAV_HEADER_BYTES + data_bytes, 1)) != FR_OK && result != FR_DENIED) {
+        write_error ("clip allocate", result);
+        f_close (&clip_file);
+        f_unlink (clip_name);
+        clips_dropped++;
+        return;
+    }
+
+    clip_open = 1;
+    clip_header_bytes = WAV_HEADER_BYTES;
+    clip_position = request->clip_start;
+    clip_end = request->clip_start + CLIP_SAMPLES;
+}
+
+// Write the next chunk of the clip in progress from the history ring, if it's available yet.
+// Returns nonzero if something was written (or the clip finished or was dropped).
+
+static int write_clip_chunk (void)
+{
+    uint32_t available = ring_load_acquire (&history_written) - clip_position;
+    int count = clip_end - clip_position, index, first, bytes;
+    int16_t *samples = (int16_t *)(clip_chunk + clip_header_bytes);
+    FRESULT result;
+    UINT written;
+
+    if (count > (CLIP_CHUNK_BYTES - clip_header_bytes) / (int) sizeof (int16_t))
+        count = (CLIP_CHUNK_BYTES - clip_header_bytes) / sizeof (int16_t);
+
+    if ((int32_t) available < count)
+        return 0;
+
+    index = clip_position & HISTORY_MASK;
+    first = HISTORY_SAMPLES - index < count ? HISTORY_SAMPLES - index : count;
+    memcpy (samples, history + index, first * sizeof (int16_t));
+    memcpy (samples + first, history, (count - first) * sizeof (int16_t));
+
+    // if the producer has claimed the space we just copied from, the clip audio is gone
+
+    if (ring_load_acquire (&history_claimed) - clip_position > HISTORY_SAMPLES) {
+        Dbg_printf ("usb recorder: clip %d dropped (writing fell behind)\n", clip_file_number);
+        close_clip (0);
+        return 1;
+    }
+
+    bytes = clip_header_bytes + count * sizeof (int16_t);
+    clip_header_bytes = 0;
+
+    if ((result = f_write (&clip_file, clip_chunk, bytes, &written)) != FR_OK || written != bytes) {
+        write_error ("clip", result);
+        close_clip (0);
+        return 1;
+    }
+
+    if ((clip_position += count) == clip_end)
+        close_clip (1);
+
+    return 1;
+}
+
+// Close the clip, and either count it as written or delete it and count it as dropped.
+
+static void close_clip (int keep)
+{
+    FRESULT result = f_close (&clip_file);
+
+    clip_open = 0;
+
+    if (keep && result == FR_OK) {
+        clips_written++;
+        return;
+    }
+
+    if (result != FR_OK)
+        write_error ("clip close", result);
+    else {
+        char clip_name [16];
+
+        sprintf (clip_name, "CLIP%04d.WAV", clip_file_number);
+        f_unlink (clip_name);
+    }
+
+    clips_dropped++;
+}
+
+static void write_error (const char *operation, FRESULT result)
+{
+    Dbg_printf ("usb recorder: %s write error %d\n", operation, result);
+    write_errors++;
+}
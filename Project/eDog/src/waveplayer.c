@@ -20,11 +20,23 @@
   */
 
 /* Includes ------------------------------------------------------------------*/
+#ifdef HOST_SIM
+#include <simboard.h>
+#else
 #include <main.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <scan.h>
+#include <ring.h>
+#include <adpcm.h>
+#include <barkmix.h>
+#include <stereo.h>
+#include <cycles.h>
+#include <profile.h>
+#include <console.h>
+#include <usbrec.h>
 
 /** @addtogroup STM32F4-Discovery_Audio_Player_Recorder
 * @{
@@ -43,53 +55,109 @@ extern volatile int user_mode;
 /* Private function prototypes -----------------------------------------------*/
 
 // We have three buffers: two output buffers used in a ping-pong arrangement, and an input
-// (microphone) circular buffer. Because the output buffers are written directly to the I2S
-// interface with DMA, they must be stereo. The microphone buffer is mono and its duration
-// is exactly 3 times the length of 1 of the ping-pong buffers. The idea is that during
-// normal operation, the microphone buffer will vary between about 1/3 full and 2/3 full
-// (with a 1/3 buffer margin on either side).
+// (microphone) ring buffer. Because the output buffers are written directly to the I2S
+// interface with DMA, they must be stereo. With the codec driver in circular DMA mode (the
+// default), the two output buffers are the halves of one buffer that the DMA plays over and
+// over, and the half and full transfer interrupts tell us which half to refill, so nothing
+// needs to be reprogrammed at the buffer boundaries. In the normal DMA mode they are separate
+// buffers and each transfer complete interrupt starts the other one playing. Either way, the
+// buffer length sets the latency and how long fill_buffer() has to do its thing (and larger
+// buffers amortize the overhead better). The microphone buffer is mono and is a lock-free
+// single-producer/single-consumer ring (see ring.h) that must be a power of two in size. We
+// start playback with 2 ping-pong buffers worth of microphone data, so during normal
+// operation the ring varies between 1 and 2 buffers full, and with the default size of 4
+// buffers there's at least a 1 buffer margin on either side. If the main loop falls behind
+// anyway, the mic samples that don't fit are dropped and counted (rather than overwriting
+// the data being scanned) and the counts are reported on the debug port. The output buffers
+// are declared as words so that the stereo block functions (stereo.h) can store whole frames.
 
 #define SAMPLE_RATE 16000       // sampling rate
-#define OUT_BUFFER_SAMPLES 128  // number of samples per output ping-pong buffer
-                                // /2 == stereo samples, *2 == number of bytes
 
-#define MIC_BUFFER_SAMPLES (OUT_BUFFER_SAMPLES * 3 / 2)
+#ifndef OUT_BUFFER_SAMPLES
+#define OUT_BUFFER_SAMPLES 128  // number of samples per output ping-pong buffer (4 ms)
+#endif                          // /2 == stereo samples, *2 == number of bytes
+
+#ifndef MIC_BUFFER_BITS
+#define MIC_BUFFER_BITS 8       // log2 of the mic ring size in samples (256 == 4 output buffers)
+#endif
+
+#define MIC_BUFFER_SAMPLES RING_SIZE(MIC_BUFFER_BITS)
+
+#if MIC_BUFFER_SAMPLES < OUT_BUFFER_SAMPLES * 2
+#error "MIC_BUFFER_BITS is too small for OUT_BUFFER_SAMPLES (the mic ring must hold 4 output buffers)"
+#endif
+
+#ifdef AUDIO_MAL_MODE_CIRCULAR
+static uint32_t outbuff [OUT_BUFFER_SAMPLES];
+static int16_t *const buff0 = (int16_t *) outbuff, *const buff1 = (int16_t *) outbuff + OUT_BUFFER_SAMPLES;
+#else
+static uint32_t outbuff0 [OUT_BUFFER_SAMPLES / 2], outbuff1 [OUT_BUFFER_SAMPLES / 2];
+static int16_t *const buff0 = (int16_t *) outbuff0, *const buff1 = (int16_t *) outbuff1;
+#endif
 
-static int16_t buff0 [OUT_BUFFER_SAMPLES], buff1 [OUT_BUFFER_SAMPLES], micbuff [MIC_BUFFER_SAMPLES];
-static volatile uint16_t mic_head, mic_tail;    // head and tail indices to mic buffer
+static int16_t micbuff [MIC_BUFFER_SAMPLES];
+static struct ring mic_ring;                    // producer is the mic callback, consumer is fill_buffer()
 static volatile uint8_t next_buff;              // next output buffer to write
  
 // These functions will have different instances depending on the global function selected below
 
 static void fill_init (void);
 static void fill_buffer (int16_t *buffer, int num_samples);
+static void check_mic_ring (void);
+#ifndef USB_RECORDER
+static void wait_for_buffer (int buffer);
+#endif
+static void check_cpu_load (void);
+
+// On the board the main loop sleeps (WFI) waiting for the interrupts to change something, and
+// the cycles spent asleep are counted so that the CPU load can be reported (see cycles.h). In
+// the host simulation (simboard.c) there are no interrupts, so instead the wait calls into the
+// virtual board which advances its sample clock and runs the "interrupt" callbacks.
+
+#ifdef HOST_SIM
+#define WAIT_FOR_INTERRUPT() sim_wait_for_interrupt ()
+#else
+#define WAIT_FOR_INTERRUPT() __WFI ()
+#endif
+
+static uint32_t idle_cycles, load_period_start;
+static uint16_t cpu_load, cpu_load_max;         // in tenths of a percent
+static uint32_t debug_dropped;
 
 // define one of these three to control behavior...
 // #define GENERATE_TONES      // generate pure FS tones into the output
 // #define GENERATE_ECHO       // copy the microphone to the output (with some delay based on buffers)
 #define GENERATE_DOGS       // BARK BARK!
 
+// Define USB_RECORDER to record every detection (a log line and a WAV clip) to a USB drive. This
+// is done by the "eDog USB" target of the Keil project (not here, because the console and the
+// interrupt handlers use it too), which also adds the USB host and FatFs sources. Writing to
+// the drive can stall for tens of milliseconds, which is many buffers, so with this the buffers
+// are filled in the PendSV handler instead of the main loop (the DMA callbacks pend it, and it's
+// at the lowest priority so that it doesn't hold up any other interrupt). The main loop is then
+// left to do the writing (see usbrec.h), and the audio preempts it whenever a buffer is due.
+
+#ifdef HOST_SIM
+#define PEND_AUDIO_SERVICE() sim_pend_sv ()
+#else
+#define PEND_AUDIO_SERVICE() (SCB->ICSR = SCB_ICSR_PENDSVSET_Msk)
+#endif
+
 // This function is called by the wav recorder (i.e. microphone sampler) when PCM samples from the
-// microphone are ready. Here we store them into the circular microphone data buffer and check for
-// possibly clipped values (which we use to flash the red LED as a warning). Note that we assume
-// that the data will be removed from the buffer in time, so we do not check the mic_tail pointer
-// for buffer overrun.
+// microphone are ready. Here we store them into the microphone ring buffer and check for possibly
+// clipped values (which we use to flash the red LED as a warning). If the main loop has fallen so
+// far behind that the samples don't fit, the ring drops them and counts the overrun.
 
 void WaveRecorderCallback (int16_t *buffer, int num_samples)
 {
     static int clip_timer;
     int clip = 0, i;
 
-    for (i = 0; i < num_samples; ++i) {
-        int16_t sample = *buffer++;
-
-        if (sample >= 32700 || sample <= -32700)
+    for (i = 0; i < num_samples; ++i)
+        if (buffer [i] >= 32700 || buffer [i] <= -32700)
             clip = 1;
 
-        micbuff [mic_head + i] = sample;
-    }
-
-    mic_head = (mic_head + num_samples >= MIC_BUFFER_SAMPLES) ? 0 : mic_head + num_samples;
+    ring_write (&mic_ring, buffer, num_samples);
 
     if (clip_timer) {
         if (!--clip_timer)
@@ -112,41 +180,198 @@ void WaveRecorderCallback (int16_t *buffer, int num_samples)
 
 void WavePlayBack(uint32_t AudioFreq)
 { 
-  /* First, we start sampling internal microphone */
+  /* The USB host init busy-waits for several hundred milliseconds (VBUS and core resets, timed
+   * with the cycle counter), which would overrun the microphone ring, so it goes first */
+  cycles_init ();
+
+#ifdef USB_RECORDER
+  usbrec_init ();
+#ifndef HOST_SIM
+  NVIC_SetPriority (PendSV_IRQn, 15);
+#endif
+#endif
+
+  /* Then we start sampling internal microphone */
+  ring_init (&mic_ring, micbuff, MIC_BUFFER_SAMPLES);
   WaveRecorderBeginSampling ();
 
   /* Initialize wave player (Codec, DMA, I2C) */
   WavePlayerInit(SAMPLE_RATE);
   
-  /* Initialize the buffer filling function */
+  /* Initialize the buffer filling function, the CPU load accounting and the debug console
+   * (which compares the execution time profile against the time to play one buffer) */
   fill_init ();
+  load_period_start = cycles_now ();
+  console_init (CYCLES_PER_SECOND / SAMPLE_RATE * (OUT_BUFFER_SAMPLES / 2));
 
-  /* Let the microphone data buffer get 2/3 full (which is 2 playback buffers) */
-  while (mic_head < MIC_BUFFER_SAMPLES * 2 / 3);
+  /* Let the microphone ring get 2 playback buffers worth of data */
+  while (ring_count (&mic_ring) < OUT_BUFFER_SAMPLES)
+    WAIT_FOR_INTERRUPT ();
 
   /* Fill the second playback buffer (the first will just be zeros to start) */
   fill_buffer (buff1, OUT_BUFFER_SAMPLES);
   
   /* Start audio playback on the first buffer (which is all zeros now) */
-  Audio_MAL_Play((uint32_t)buff0, OUT_BUFFER_SAMPLES * 2);
   next_buff = 1; 
+#ifdef AUDIO_MAL_MODE_CIRCULAR
+  Audio_MAL_Play((uint32_t)outbuff, sizeof (outbuff));
+#else
+  Audio_MAL_Play((uint32_t)buff0, OUT_BUFFER_SAMPLES * 2);
+#endif
 
   /* LED Green Start toggling */
   LED_Toggle = LED_CTRL_GREEN_TOGGLE;
   
-  /* This is the main loop of the program. We simply wait for a buffer to be exhausted
-   * and then we refill it. The callback (which is triggered by DMA completion) actually
-   * handles starting the next buffer playing, so we don't need to be worried about that
-   * latency here. The functionality of the fill_buffer() function determines what it is
-   * that we are doing (e.g., playing tones, echoing the mic, being a nervous dog, etc.)
+  /* This is the main loop of the program. We simply sleep until a buffer is exhausted
+   * and then we refill it. The DMA is already playing the other buffer (in circular mode
+   * it just keeps going, and in normal mode the completion callback starts it), so we
+   * don't need to be worried about that latency here. The functionality of the fill_buffer()
+   * function determines what it is that we are doing (e.g., playing tones, echoing the mic,
+   * being a nervous dog, etc.) With the USB recorder, the filling is done by WavePlayerService() in the PendSV handler
+   * and the main loop just writes to the drive, sleeping when there's nothing to write.
    */
 
+#ifdef USB_RECORDER
+  while (1) {
+    if (!usbrec_service ()) {
+      uint32_t start;
+
+      __disable_irq ();
+      start = cycles_now ();
+      WAIT_FOR_INTERRUPT ();
+      idle_cycles += cycles_now () - start;
+      __enable_irq ();
+    }
+  }
+#else
   while (1) {
-    while (next_buff == 1);
+    uint32_t start;
+
+    wait_for_buffer (0);
+    start = profile_begin ();
     fill_buffer (buff0, OUT_BUFFER_SAMPLES);
-    while (next_buff == 0);
+    profile_end (PROFILE_FILL, start);
+    wait_for_buffer (1);
+    start = profile_begin ();
     fill_buffer (buff1, OUT_BUFFER_SAMPLES);
+    profile_end (PROFILE_FILL, start);
+    check_mic_ring ();
+    check_cpu_load ();
+    console_poll ();
   }
+#endif
+}
+
+/**
+  * @brief  Fill the next output buffer (with the USB recorder, this is called by the
+  *         PendSV handler, which the DMA callbacks pend whenever a buffer is played)
+  * @param  None
+  * @retval None
+  */
+void WavePlayerService(void)
+{
+  uint32_t start = profile_begin ();
+
+  fill_buffer (next_buff ? buff1 : buff0, OUT_BUFFER_SAMPLES);
+  profile_end (PROFILE_FILL, start);
+  check_mic_ring ();
+  check_cpu_load ();
+  console_poll ();
+}
+
+#ifndef USB_RECORDER
+
+// Sleep until the specified buffer is the next one to fill. Interrupts are disabled while
+// next_buff is checked, so one can't sneak in between the check and the WFI (and leave us
+// asleep with the buffer ready). A pending interrupt still wakes the WFI, but its handler
+// doesn't run until interrupts are enabled again, so the cycles counted as idle are just
+// the time spent asleep. Any interrupt wakes us, so we loop until it's the right one.
+
+static void wait_for_buffer (int buffer)
+{
+  while (1) {
+    uint32_t start;
+
+    __disable_irq ();
+
+    if (next_buff == buffer) {
+      __enable_irq ();
+      break;
+    }
+
+    start = cycles_now ();
+    WAIT_FOR_INTERRUPT ();
+    idle_cycles += cycles_now () - start;
+    __enable_irq ();
+  }
+}
+
+#endif
+
+// Once a second, report the CPU load (the fraction of the cycles not spent asleep) on the
+// debug port, and keep the latest and peak values for WavePlayerCpuLoad(). Any debug messages
+// dropped (because the serial transmit buffer was full) are reported here too.
+
+static void check_cpu_load (void)
+{
+  uint32_t elapsed = cycles_now () - load_period_start;
+
+  if (elapsed >= CYCLES_PER_SECOND) {
+    uint32_t idle = idle_cycles / (elapsed / 1000);
+
+    cpu_load = idle < 1000 ? 1000 - idle : 0;
+
+    if (cpu_load > cpu_load_max)
+      cpu_load_max = cpu_load;
+
+    Dbg_printf ("cpu load: %u.%u%% (%u of %u cycles idle)\n", cpu_load / 10, cpu_load % 10, idle_cycles, elapsed);
+    load_period_start += elapsed;
+    idle_cycles = 0;
+
+    if (Dbg_dropped () != debug_dropped) {
+      debug_dropped = Dbg_dropped ();
+      Dbg_printf ("debug log: %u messages dropped\n", debug_dropped);
+    }
+  }
+}
+
+// Report any new microphone ring overruns or underruns on the debug port (the counts are
+// cumulative). This is done in the main loop rather than where they happen, because an
+// overrun is detected in the interrupt handler.
+
+static void check_mic_ring (void)
+{
+  static uint32_t overruns, underruns;
+
+  if (mic_ring.overruns != overruns || mic_ring.underruns != underruns) {
+    overruns = mic_ring.overruns;
+    underruns = mic_ring.underruns;
+    Dbg_printf ("mic ring: %u samples dropped (overrun), %u short reads (underrun)\n", overruns, underruns);
+  }
+}
+
+/**
+  * @brief  Get the microphone ring buffer error counts
+  * @param  overruns: receives the number of mic samples dropped because the ring was full
+  * @param  underruns: receives the number of times fewer samples were available than needed
+  * @retval None
+  */
+void WavePlayerMicStats(uint32_t *overruns, uint32_t *underruns)
+{
+  *overruns = mic_ring.overruns;
+  *underruns = mic_ring.underruns;
+}
+
+/**
+  * @brief  Get the CPU load measured over the last second and the peak so far
+  * @param  load: receives the latest load in tenths of a percent
+  * @param  max_load: receives the highest load in tenths of a percent
+  * @retval None
+  */
+void WavePlayerCpuLoad(uint16_t *load, uint16_t *max_load)
+{
+  *load = cpu_load;
+  *max_load = cpu_load_max;
 }
 
 /**
@@ -166,10 +391,21 @@ void WavePlayerPauseResume(uint8_t state)
   */
 uint8_t WaveplayerCtrlVolume(uint8_t vol)
 { 
+  volume = vol;
   EVAL_AUDIO_VolumeCtl(vol);
   return 0;
 }
 
+/**
+  * @brief  Get the current volume
+  * @param  None
+  * @retval The volume value last set (0 - 100)
+  */
+uint8_t WavePlayerVolume(void)
+{
+  return volume;
+}
+
 
 /**
   * @brief  Stop playing wave
@@ -223,6 +459,16 @@ Below some examples of callback implementations.
 */
 void EVAL_AUDIO_TransferComplete_CallBack(uint32_t pBuffer, uint32_t Size)
 {
+#ifdef AUDIO_MAL_MODE_CIRCULAR
+  /* Called when the DMA has played the second half of the circular buffer and
+   * wrapped back to the first, so the main loop can refill the second half.
+   */
+
+  next_buff = 1;
+#ifdef USB_RECORDER
+  PEND_AUDIO_SERVICE ();
+#endif
+#else
   /* Called when the previous DMA playback buffer is completed. Here we simply
    * start playing the other buffer and signal the main loop that it can refill
    * the buffer we just played.
@@ -236,7 +482,10 @@ void EVAL_AUDIO_TransferComplete_CallBack(uint32_t pBuffer, uint32_t Size)
     Audio_MAL_Play((uint32_t)buff1, OUT_BUFFER_SAMPLES * 2);
     next_buff = 0; 
   }
-
+#ifdef USB_RECORDER
+  PEND_AUDIO_SERVICE ();
+#endif
+#endif /* AUDIO_MAL_MODE_CIRCULAR */
 }
 
 /**
@@ -247,17 +496,15 @@ void EVAL_AUDIO_TransferComplete_CallBack(uint32_t pBuffer, uint32_t Size)
 void EVAL_AUDIO_HalfTransfer_CallBack(uint32_t pBuffer, uint32_t Size)
 {  
 #ifdef AUDIO_MAL_MODE_CIRCULAR
-    
+  /* Called when the DMA has played the first half of the circular buffer and
+   * moved on to the second, so the main loop can refill the first half.
+   */
+
+  next_buff = 0;
+#ifdef USB_RECORDER
+  PEND_AUDIO_SERVICE ();
+#endif
 #endif /* AUDIO_MAL_MODE_CIRCULAR */
-  
-  /* Generally this interrupt routine is used to load the buffer when 
-  a streaming scheme is used: When first Half buffer is already transferred load 
-  the new data to the first half of buffer while DMA is transferring data from 
-  the second half. And when Transfer complete occurs, load the second half of 
-  the buffer while the DMA is transferring from the first half ... */
-  /* 
-  ...........
-  */
 }
 
 /**
@@ -357,11 +604,23 @@ static void fill_buffer (int16_t *buffer, int num_samples)
 {
     int count = num_samples / 2;
 
-    while (count--) {
-        *buffer++ = micbuff [mic_tail];
-        *buffer++ = micbuff [mic_tail];
-        mic_tail = (mic_tail + 1 >= MIC_BUFFER_SAMPLES) ? 0 : mic_tail + 1;
+    while (count) {
+        int16_t *mic_samples;
+        int samples_to_copy = ring_peek (&mic_ring, &mic_samples, count);
+
+        if (!samples_to_copy)
+            break;
+
+        stereo_expand (buffer, mic_samples, samples_to_copy);
+        buffer += samples_to_copy * 2;
+        ring_advance (&mic_ring, samples_to_copy);
+        count -= samples_to_copy;
     }
+
+    if (count)
+        ring_underrun (&mic_ring);
+
+    stereo_silence (buffer, count);
 }
 
 #endif
@@ -379,7 +638,33 @@ static void fill_buffer (int16_t *buffer, int num_samples)
 
 #ifdef GENERATE_DOGS
 
-#define CANNED_AUDIO_START 0x08010000       // raw 16-bit PCM mono audio data is here
+// #define CANNED_AUDIO_ADPCM       // canned audio is an ADPCM image (bin/dog-adpcm.bin) rather than raw PCM
+// #define BARK_MIXER               // play the clips through the mixer (random choice, pitch and crossfades)
+
+#ifndef CANNED_AUDIO_START
+#define CANNED_AUDIO_START 0x08010000       // raw 16-bit PCM mono audio data (or the ADPCM image) is here
+#endif
+
+#ifdef CANNED_AUDIO_ADPCM
+
+/* With the ADPCM image (created by adpcmenc, see adpcm.h) the clips are defined by the
+ * table in the image itself, and they're played in the order they appear there, except
+ * for the short bark (which is flagged). As with the raw audio, the first clip is the
+ * surprised one. The clips are decoded a buffer at a time right into the output.
+ */
+
+#define MAX_CANNED_CLIPS 32
+
+static const struct adpcm_image *canned_image;
+static uint8_t canned_sequence [MAX_CANNED_CLIPS];
+static int canned_sequence_length, short_bark_clip = -1;
+
+#ifndef BARK_MIXER
+static struct adpcm_stream canned_stream;
+static int canned_sequence_index;
+#endif
+
+#else
 
 /* The canned subclips are defined here as a sample offset from the beginning of the
  * data. plus a sample count. The clips start right at the onset of a bark, so that
@@ -398,52 +683,175 @@ static struct clip {
     307040, 99360,
     406400, 48000,
     0, 0
-}, *canned_ptr = canned_clips;
+};
 
+#define SHORT_BARK_START 68464      // the single short bark (for the one-bark mode)
+#define SHORT_BARK_SAMPLES 8000
+
+#ifndef BARK_MIXER
+static struct clip *canned_ptr = canned_clips;
 static int16_t *canned_audio;
+#endif
+
+#endif
+
+#ifdef BARK_MIXER
+
+/* With the bark mixer (see barkmix.h), each detection plays a randomly chosen clip (with
+ * random pitch and gain) and possibly another one crossfaded onto its end, except that the
+ * surprised clip is always first after a quiet minute. The mixer's clip table is built from
+ * whichever canned audio format is in use.
+ */
+
+#define BARK_CHAIN_CLIPS 1          // max clips to chain onto the first one
+#define MAX_MIX_CLIPS 33
+
+static struct barkmix_clip mix_clips [MAX_MIX_CLIPS];
+static int mix_first_clip, mix_short_bark = -1, mix_rewind = 1;
+
+#endif
+
 static int canned_samples, samples_since_trigger;
 
+#define MAX_DETECTION_RECORDS 4
+
 static void fill_init (void)
 {
     scan_audio_init ();     // the scanner needs to be initialized
+
+#ifdef CANNED_AUDIO_ADPCM
+    canned_image = adpcm_image_check ((const void *) CANNED_AUDIO_START);
+
+    if (canned_image) {
+        int i;
+
+        for (i = 0; i < canned_image->num_clips; ++i)
+            if (canned_image->clips [i].flags & ADPCM_CLIP_SHORT_BARK)
+                short_bark_clip = i;
+            else if (canned_sequence_length < MAX_CANNED_CLIPS)
+                canned_sequence [canned_sequence_length++] = i;
+
+        Dbg_printf ("canned audio: %d ADPCM clips in %d bytes\n", canned_image->num_clips, canned_image->image_bytes);
+    }
+    else
+        Dbg_puts ("canned audio: no valid ADPCM image found, the dog will be silent!\n");
+#endif
+
+#ifdef BARK_MIXER
+    {
+        int num_mix_clips = 0, i;
+
+#ifdef CANNED_AUDIO_ADPCM
+        if (canned_image && canned_sequence_length) {
+            for (i = 0; i < canned_image->num_clips && i < MAX_MIX_CLIPS; ++i) {
+                mix_clips [i].image = canned_image;
+                mix_clips [i].adpcm_clip = i;
+                mix_clips [i].num_samples = canned_image->clips [i].num_samples;
+                mix_clips [i].weight = (i == short_bark_clip) ? 0 : 1;
+            }
+
+            num_mix_clips = i;
+            mix_first_clip = canned_sequence [0];
+            mix_short_bark = short_bark_clip;
+        }
+#else
+        for (i = 0; canned_clips [i].num_samples; ++i) {
+            mix_clips [i].samples = (int16_t *) CANNED_AUDIO_START + canned_clips [i].start_sample;
+            mix_clips [i].num_samples = canned_clips [i].num_samples;
+            mix_clips [i].weight = 1;
+        }
+
+        mix_clips [i].samples = (int16_t *) CANNED_AUDIO_START + SHORT_BARK_START;
+        mix_clips [i].num_samples = SHORT_BARK_SAMPLES;
+        mix_short_bark = i;
+        num_mix_clips = i + 1;
+#endif
+
+        barkmix_init (mix_clips, num_mix_clips, 1);
+    }
+#endif
 }
 
 // Fill the specified buffer with the specified number of samples. Since this is stereo
 // data that we are writing (for now), we half the sample count and duplicate every
-// sample when we write. The user_mode (which is incremented by the user button) selects
-// high detection sensitivity (bit 1) and whether we play a single bark for debug and
-// setup purposes (bit 0).
+// sample when we write. The buffer is filled in blocks: whatever is left of the current
+// clip (split once at its end rather than checked every sample) and then silence. The
+// user_mode (which is incremented by the user button) selects high detection sensitivity
+// (bit 1) and whether we play a single bark for debug and setup purposes (bit 0).
 
 static void fill_buffer (int16_t *buffer, int num_samples)
 {
+    struct scan_detection records [MAX_DETECTION_RECORDS];
     int count = num_samples / 2, detection = 0;
+    uint32_t start = profile_begin ();
 
     // First, send the microphone data to the audio scanner to look for knocks and rings.
     // Because the microphone sampling and the audio playback are running at the same
-    // sample rate, we know that we have the desired number of samples so we don't have
-    // to check the mic_head pointer, but we do have to check for wrapping, obviously.
+    // sample rate, we should have the desired number of samples (if not, we count an
+    // underrun and just scan what's there). The samples are scanned right in the
+    // ring, so we have to handle wrapping, obviously.
 
     while (count) {
-        int samples_to_scan = count;
+        int16_t *mic_samples;
+        int samples_to_scan = ring_peek (&mic_ring, &mic_samples, count), num_records = MAX_DETECTION_RECORDS;
+
+        if (!samples_to_scan)
+            break;
 
-        if (mic_tail + samples_to_scan > MIC_BUFFER_SAMPLES)
-            samples_to_scan = MIC_BUFFER_SAMPLES - mic_tail;
+        detection |= scan_audio_detect (mic_samples, samples_to_scan, NULL,
+            ((user_mode & 2) ? SCAN_HIGH_SENSITIVITY : 0) | SCAN_DETECT_ALARM | SCAN_DETECT_GLASS | SCAN_DISP_THRESHOLDS | SCAN_DISP_EVENTS | SCAN_DISP_PEAKS,
+            records, &num_records);
 
-        detection |= scan_audio (micbuff + mic_tail, samples_to_scan, NULL,
-            ((user_mode & 2) ? SCAN_HIGH_SENSITIVITY : 0) | SCAN_DISP_THRESHOLDS | SCAN_DISP_EVENTS | SCAN_DISP_PEAKS);
+#ifdef USB_RECORDER
+        {
+            int i;
 
-        mic_tail = (mic_tail + samples_to_scan >= MIC_BUFFER_SAMPLES) ? 0 : mic_tail + samples_to_scan;
+            usbrec_audio (mic_samples, samples_to_scan);
+
+            for (i = 0; i < num_records; ++i)
+                usbrec_detection (records + i);
+        }
+#endif
+
+        ring_advance (&mic_ring, samples_to_scan);
         count -= samples_to_scan;
     }
 
+    if (count)
+        ring_underrun (&mic_ring);
+
+    profile_end (PROFILE_SCAN, start);
+
     // If we detected a knock or a ring (and we are not already playing canned audio for
     // a previous trigger) then we start playing canned audio here. This also switches the
     // toggling LED from the green to the orange.
 
     if (detection && !canned_samples) {
+#if defined (BARK_MIXER)
+        if ((user_mode & 1) && mix_short_bark >= 0)
+            barkmix_start (mix_short_bark, 0, samples_since_trigger);
+        else {
+            barkmix_start (mix_rewind ? mix_first_clip : BARKMIX_RANDOM, BARK_CHAIN_CLIPS, samples_since_trigger);
+            mix_rewind = 0;
+        }
+
+        canned_samples = barkmix_active ();
+#elif defined (CANNED_AUDIO_ADPCM)
+        if (canned_image) {
+            if ((user_mode & 1) && short_bark_clip >= 0)
+                adpcm_stream_init (&canned_stream, canned_image, short_bark_clip);
+            else if (canned_sequence_length) {
+                adpcm_stream_init (&canned_stream, canned_image, canned_sequence [canned_sequence_index]);
+                if (++canned_sequence_index == canned_sequence_length)
+                    canned_sequence_index = 0;
+            }
+
+            canned_samples = canned_stream.num_samples;
+        }
+#else
         if (user_mode & 1) {
-            canned_audio = (int16_t *) CANNED_AUDIO_START + 68464;
-            canned_samples = 8000;
+            canned_audio = (int16_t *) CANNED_AUDIO_START + SHORT_BARK_START;
+            canned_samples = SHORT_BARK_SAMPLES;
         }
         else {
             canned_audio = (int16_t *) CANNED_AUDIO_START + canned_ptr->start_sample;
@@ -451,10 +859,14 @@ static void fill_buffer (int16_t *buffer, int num_samples)
             if (!(++canned_ptr)->num_samples)
                 canned_ptr = canned_clips;
         }
+#endif
+
+        /* LED toggling green --> orange (unless there's no audio to play) */
+        if (canned_samples) {
+            LED_Toggle &= ~LED_CTRL_GREEN_TOGGLE;
+            LED_Toggle |= LED_CTRL_ORANGE_TOGGLE | LED_CTRL_GREEN_OFF;
+        }
 
-        /* LED toggling green --> orange */
-        LED_Toggle &= ~LED_CTRL_GREEN_TOGGLE;
-        LED_Toggle |= LED_CTRL_ORANGE_TOGGLE | LED_CTRL_GREEN_OFF;
         samples_since_trigger = 0;
     }
 
@@ -462,27 +874,67 @@ static void fill_buffer (int16_t *buffer, int num_samples)
     // or silence (if all's quiet).
 
     count = num_samples / 2;
+    start = profile_begin ();
+
+#if defined (BARK_MIXER)
+    if (canned_samples) {
+        if (!(canned_samples = barkmix_render (buffer, count))) {
+            /* LED toggling orange --> green */
+            LED_Toggle &= ~LED_CTRL_ORANGE_TOGGLE;
+            LED_Toggle |= LED_CTRL_GREEN_TOGGLE | LED_CTRL_ORANGE_OFF;
+        }
 
-    while (count--)
-        if (canned_samples) {
-            *buffer++ = *canned_audio;
-            *buffer++ = *canned_audio++;
-            if (!--canned_samples) {
-                /* LED toggling orange --> green */
-                LED_Toggle &= ~LED_CTRL_ORANGE_TOGGLE;
-                LED_Toggle |= LED_CTRL_GREEN_TOGGLE | LED_CTRL_ORANGE_OFF;
-            }
+        count = 0;
+    }
+
+    stereo_silence (buffer, count);
+#elif defined (CANNED_AUDIO_ADPCM)
+    if (canned_samples) {
+        int decoded = adpcm_decode (&canned_stream, buffer, count, 2);
+
+        buffer += decoded * 2;
+        count -= decoded;
+
+        if (!(canned_samples -= decoded)) {
+            /* LED toggling orange --> green */
+            LED_Toggle &= ~LED_CTRL_ORANGE_TOGGLE;
+            LED_Toggle |= LED_CTRL_GREEN_TOGGLE | LED_CTRL_ORANGE_OFF;
         }
-        else {
-            *buffer++ = 0;
-            *buffer++ = 0;
+    }
+
+    stereo_silence (buffer, count);
+#else
+    if (canned_samples) {
+        int frames = count < canned_samples ? count : canned_samples;
+
+        stereo_expand (buffer, canned_audio, frames);
+        canned_audio += frames;
+        buffer += frames * 2;
+        count -= frames;
+
+        if (!(canned_samples -= frames)) {
+            /* LED toggling orange --> green */
+            LED_Toggle &= ~LED_CTRL_ORANGE_TOGGLE;
+            LED_Toggle |= LED_CTRL_GREEN_TOGGLE | LED_CTRL_ORANGE_OFF;
         }
+    }
+
+    stereo_silence (buffer, count);
+#endif
+
+    profile_end (PROFILE_CANNED, start);
 
     // If it's been over a minute since our last trigger, reset the canned sequence because the
     // first one sounds more surprised.
 
     if (!canned_samples && !detection && (samples_since_trigger += num_samples / 2) > 16000 * 60)
+#if defined (BARK_MIXER)
+        mix_rewind = 1;
+#elif defined (CANNED_AUDIO_ADPCM)
+        canned_sequence_index = 0;
+#else
         canned_ptr = canned_clips;
+#endif
 }
 
 #endif
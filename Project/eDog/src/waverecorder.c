@@ -20,9 +20,19 @@
   */ 
 
 /* Includes ------------------------------------------------------------------*/
+#ifdef HOST_SIM
+#include "simboard.h"
+#else
 #include "main.h"
+#endif
 #include "pdm_filter.h"
+/* Decimate with the open PDM filter in pdmdec.c (comment out to use ST's library) */
+#define PDM_OPEN_DECIMATOR
+/* Time the open PDM filter against ST's library at init (needs the library linked) */
+/* #define PDM_DECIMATOR_BENCHMARK */
+#include "pdmdec.h"
 #include "waverecorder.h" 
+#include "cycles.h"
 
 /** @addtogroup STM32F4-Discovery_Audio_Player_Recorder
 * @{
@@ -45,6 +55,22 @@
 
 #define AUDIO_REC_SPI_IRQHANDLER          SPI2_IRQHandler
 
+/* With AUDIO_REC_DMA defined the SPI receive data is transferred by circular DMA
+   into a double buffer (AUDIO_REC_DMA_HALF_WORDS words per half) and the PDM filter
+   runs from the half and full transfer interrupts, so there are 250 interrupts per
+   second instead of one for every 16-bit word (64,000 per second). Comment it out
+   to go back to the RXNE interrupt capture. */
+#define AUDIO_REC_DMA
+
+/* SPI2_RX is on DMA1 stream 3, channel 0 */
+#define AUDIO_REC_DMA_CLOCK               RCC_AHB1Periph_DMA1
+#define AUDIO_REC_DMA_STREAM              DMA1_Stream3
+#define AUDIO_REC_DMA_CHANNEL             DMA_Channel_0
+#define AUDIO_REC_DMA_IRQ                 DMA1_Stream3_IRQn
+#define AUDIO_REC_DMA_IT_HT               DMA_IT_HTIF3
+#define AUDIO_REC_DMA_IT_TC               DMA_IT_TCIF3
+#define AUDIO_REC_DMA_IRQHANDLER          DMA1_Stream3_IRQHandler
+
 /* Audio recording frequency in Hz */
 #define REC_FREQ                          16000  
 
@@ -54,32 +80,101 @@
 /* PCM buffer output size */
 #define PCM_OUT_SIZE            16
 
+/* PDM filter blocks per half of the DMA capture buffer */
+#define PDM_DMA_BLOCKS          (AUDIO_REC_DMA_HALF_WORDS / INTERNAL_BUFF_SIZE)
+
+/* Microphone gain passed to the PDM filter */
+#define MIC_GAIN                50
+
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 
+#ifndef HOST_SIM
 /* Current state of the audio recorder interface intialization */
 static uint32_t AudioRecInited = 0;
+#endif
 PDMFilter_InitStruct Filter;
 /* Audio recording Samples format (from 8 to 16 bits) */
 uint32_t AudioRecBitRes = 16; 
-uint16_t RecBuf[PCM_OUT_SIZE], RecBuf1[PCM_OUT_SIZE];
+uint16_t RecBuf[PCM_OUT_SIZE * PDM_DMA_BLOCKS];
 /* Audio recording number of channels (1 for Mono or 2 for Stereo) */
 uint32_t AudioRecChnlNbr = 1;
 /* Main buffer pointer for the recorded data storing */
-uint16_t* pAudioRecBuf;
+uint16_t* pAudioRecBuf = RecBuf;
 /* Current size of the recorded buffer */
 uint32_t AudioRecCurrSize = 0; 
 /* Temporary data sample */
 static uint16_t InternalBuffer[INTERNAL_BUFF_SIZE];
 static uint32_t InternalBufferSize = 0;
+#if defined(AUDIO_REC_DMA) && !defined(HOST_SIM)
+/* DMA capture double buffer (32-bit aligned for the bulk byte swap) */
+static uint32_t PdmDmaBuffer[AUDIO_REC_DMA_HALF_WORDS];
+#endif
+
+/* In the host simulation the output of the recorder can be redirected (see simboard.c) */
+#ifdef HOST_SIM
+void (*sim_recorder_callback) (int16_t *buffer, int num_samples) = WaveRecorderCallback;
+#define WaveRecorderCallback(buffer, num_samples) sim_recorder_callback (buffer, num_samples)
+#endif
 
 /* Private function prototypes -----------------------------------------------*/
+#ifndef HOST_SIM
 static void WaveRecorder_GPIO_Init(void);
 static void WaveRecorder_SPI_Init(uint32_t Freq);
+#ifdef AUDIO_REC_DMA
+static void WaveRecorder_DMA_Init(void);
+#endif
 static void WaveRecorder_NVIC_Init(void);
+#ifdef PDM_DECIMATOR_BENCHMARK
+static void WaveRecorder_Benchmark(void);
+#endif
+#endif
 
 /* Private functions ---------------------------------------------------------*/
 
+/**
+  * @brief  Store one received PDM word (byte swapped for the filter) and run the
+  *         PDM filter each time a block is complete (RXNE interrupt capture)
+  * @param  Word: 16-bit word as received from the SPI data register
+  * @retval None
+  */
+void WaveRecorder_PutWord(uint16_t Word)
+{
+  InternalBuffer[InternalBufferSize++] = HTONS(Word);
+
+  /* Check to prevent overflow condition */
+  if (InternalBufferSize >= INTERNAL_BUFF_SIZE)
+  {
+    InternalBufferSize = 0;
+
+    PDM_Filter_64_LSB((uint8_t *)InternalBuffer, (uint16_t *)pAudioRecBuf, MIC_GAIN, (PDMFilter_InitStruct *)&Filter);
+    WaveRecorderCallback ((int16_t *) pAudioRecBuf, PCM_OUT_SIZE);
+  }
+}
+
+/**
+  * @brief  Run the PDM filter on one half of the DMA capture buffer (DMA capture).
+  *         The words are byte swapped in place, two at a time, which the DMA can't
+  *         interfere with because it's writing the other half.
+  * @param  pHalf: AUDIO_REC_DMA_HALF_WORDS words as received from the SPI data register
+  * @retval None
+  */
+void WaveRecorder_ProcessHalf(uint32_t *pHalf)
+{
+  int i;
+
+  for (i = 0; i < AUDIO_REC_DMA_HALF_WORDS / 2; ++i)
+    pHalf[i] = __REV16(pHalf[i]);
+
+  for (i = 0; i < PDM_DMA_BLOCKS; ++i)
+    PDM_Filter_64_LSB((uint8_t *)(pHalf + i * INTERNAL_BUFF_SIZE / 2), (uint16_t *)pAudioRecBuf + i * PCM_OUT_SIZE,
+      MIC_GAIN, (PDMFilter_InitStruct *)&Filter);
+
+  WaveRecorderCallback ((int16_t *) pAudioRecBuf, PCM_OUT_SIZE * PDM_DMA_BLOCKS);
+}
+
+#ifndef HOST_SIM
+
 /**
   * @brief  Initialize wave recording
   * @param  AudioFreq: Sampling frequency
@@ -108,6 +203,10 @@ uint32_t WaveRecorderInit(uint32_t AudioFreq, uint32_t BitRes, uint32_t ChnlNbr)
     Filter.In_MicChannels = 1;
     
     PDM_Filter_Init((PDMFilter_InitStruct *)&Filter);
+
+#ifdef PDM_DECIMATOR_BENCHMARK
+    WaveRecorder_Benchmark();
+#endif
     
     /* Configure the GPIOs */
     WaveRecorder_GPIO_Init();
@@ -117,6 +216,11 @@ uint32_t WaveRecorderInit(uint32_t AudioFreq, uint32_t BitRes, uint32_t ChnlNbr)
     
     /* Configure the SPI */
     WaveRecorder_SPI_Init(AudioFreq);
+
+#ifdef AUDIO_REC_DMA
+    /* Configure the DMA capture */
+    WaveRecorder_DMA_Init();
+#endif
     
     /* Set the local parameters */
     AudioRecBitRes = BitRes;
@@ -130,6 +234,45 @@ uint32_t WaveRecorderInit(uint32_t AudioFreq, uint32_t BitRes, uint32_t ChnlNbr)
   }  
 }
 
+#ifdef PDM_DECIMATOR_BENCHMARK
+/**
+  * @brief  Time the PDM filter functions with the DWT cycle counter and report the
+  *         cycles per output sample. The parenthesized names call ST's library even
+  *         when the open decimator is selected (the function-like macros don't apply).
+  * @param  None
+  * @retval None
+  */
+static void WaveRecorder_Benchmark(void)
+{
+  static PDMFilter_InitStruct LibFilter, OpenFilter;
+  uint32_t Random = 1, Start, LibCycles = 0, OpenCycles = 0;
+  int i, j;
+
+  cycles_init();
+
+  LibFilter = OpenFilter = Filter;
+  (PDM_Filter_Init)(&LibFilter);
+  pdmdec_init(&OpenFilter);
+
+  for (i = 0; i < 1000; ++i)
+  {
+    for (j = 0; j < INTERNAL_BUFF_SIZE; ++j)
+      InternalBuffer[j] = (Random = Random * 1103515245 + 12345) >> 16;
+
+    Start = cycles_now();
+    (PDM_Filter_64_LSB)((uint8_t *)InternalBuffer, RecBuf, MIC_GAIN, &LibFilter);
+    LibCycles += cycles_now() - Start;
+
+    Start = cycles_now();
+    pdmdec_64_lsb((uint8_t *)InternalBuffer, RecBuf, MIC_GAIN, &OpenFilter);
+    OpenCycles += cycles_now() - Start;
+  }
+
+  Dbg_printf ("PDM filter cycles per sample: ST library = %d, pdmdec = %d\n",
+    LibCycles / (1000 * PCM_OUT_SIZE), OpenCycles / (1000 * PCM_OUT_SIZE));
+}
+#endif
+
 /**
   * @brief  Start audio recording
   * @param  pbuf: pointer to a buffer
@@ -145,9 +288,15 @@ uint8_t WaveRecorderStart(uint16_t* pbuf, uint32_t size)
     pAudioRecBuf = pbuf;
     AudioRecCurrSize = size;
     
+#ifdef AUDIO_REC_DMA
+    /* The Data transfer is performed by DMA and filtered in the DMA interrupt routine */
+    SPI_I2S_DMACmd(SPI2, SPI_I2S_DMAReq_Rx, ENABLE);
+    DMA_Cmd(AUDIO_REC_DMA_STREAM, ENABLE);
+#else
     /* Enable the Rx buffer not empty interrupt */
     SPI_I2S_ITConfig(SPI2, SPI_I2S_IT_RXNE, ENABLE);
     /* The Data transfer is performed in the SPI interrupt routine */
+#endif
     /* Enable the SPI peripheral */
     I2S_Cmd(SPI2, ENABLE); 
    
@@ -174,6 +323,11 @@ uint32_t WaveRecorderStop(void)
     
     /* Stop conversion */
     I2S_Cmd(SPI2, DISABLE); 
+
+#ifdef AUDIO_REC_DMA
+    DMA_Cmd(AUDIO_REC_DMA_STREAM, DISABLE);
+    SPI_I2S_DMACmd(SPI2, SPI_I2S_DMAReq_Rx, DISABLE);
+#endif
     
     /* Return 0 if all operations are OK */
     return 0;
@@ -191,32 +345,40 @@ uint32_t WaveRecorderStop(void)
   * @retval None
 */
 
-void WaveRecorderCallback (int16_t *buffer, int num_samples);
-
 void AUDIO_REC_SPI_IRQHANDLER(void)
 {  
-   u16 volume;
-   u16 app;
-
   /* Check if data are available in SPI Data register */
   if (SPI_GetITStatus(SPI2, SPI_I2S_IT_RXNE) != RESET)
   {
-    app = SPI_I2S_ReceiveData(SPI2);
-    InternalBuffer[InternalBufferSize++] = HTONS(app);
-    
-    /* Check to prevent overflow condition */
-    if (InternalBufferSize >= INTERNAL_BUFF_SIZE)
-    {
-      InternalBufferSize = 0;
-     
-      volume = 50;
-      
-      PDM_Filter_64_LSB((uint8_t *)InternalBuffer, (uint16_t *)pAudioRecBuf, volume , (PDMFilter_InitStruct *)&Filter);
-      WaveRecorderCallback ((int16_t *) pAudioRecBuf, PCM_OUT_SIZE);
-    }
+    WaveRecorder_PutWord(SPI_I2S_ReceiveData(SPI2));
   }
 }
 
+#ifdef AUDIO_REC_DMA
+
+/**
+  * @brief  This function handles the capture DMA half and full transfer interrupts.
+  *         If we are late enough that both are pending, the first half is done first.
+  * @param  None
+  * @retval None
+*/
+void AUDIO_REC_DMA_IRQHANDLER(void)
+{
+  if (DMA_GetITStatus(AUDIO_REC_DMA_STREAM, AUDIO_REC_DMA_IT_HT) != RESET)
+  {
+    DMA_ClearITPendingBit(AUDIO_REC_DMA_STREAM, AUDIO_REC_DMA_IT_HT);
+    WaveRecorder_ProcessHalf(PdmDmaBuffer);
+  }
+
+  if (DMA_GetITStatus(AUDIO_REC_DMA_STREAM, AUDIO_REC_DMA_IT_TC) != RESET)
+  {
+    DMA_ClearITPendingBit(AUDIO_REC_DMA_STREAM, AUDIO_REC_DMA_IT_TC);
+    WaveRecorder_ProcessHalf(PdmDmaBuffer + AUDIO_REC_DMA_HALF_WORDS / 2);
+  }
+}
+
+#endif /* AUDIO_REC_DMA */
+
 void WaveRecorderBeginSampling (void)
 {
   WaveRecorderInit(32000,16, 1);
@@ -279,10 +441,52 @@ static void WaveRecorder_SPI_Init(uint32_t Freq)
   /* Initialize the I2S peripheral with the structure above */
   I2S_Init(SPI2, &I2S_InitStructure);
 
+#ifndef AUDIO_REC_DMA
   /* Enable the Rx buffer not empty interrupt */
   SPI_I2S_ITConfig(SPI2, SPI_I2S_IT_RXNE, ENABLE);
+#endif
+}
+
+#ifdef AUDIO_REC_DMA
+
+/**
+  * @brief  Initialize the DMA stream for circular capture into the double buffer.
+  * @param  None
+  * @retval None
+  */
+static void WaveRecorder_DMA_Init(void)
+{
+  DMA_InitTypeDef DMA_InitStructure;
+
+  /* Enable the DMA clock */
+  RCC_AHB1PeriphClockCmd(AUDIO_REC_DMA_CLOCK, ENABLE);
+
+  /* Configure the DMA Stream */
+  DMA_Cmd(AUDIO_REC_DMA_STREAM, DISABLE);
+  DMA_DeInit(AUDIO_REC_DMA_STREAM);
+  DMA_InitStructure.DMA_Channel = AUDIO_REC_DMA_CHANNEL;
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&SPI2->DR;
+  DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)PdmDmaBuffer;
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
+  DMA_InitStructure.DMA_BufferSize = (uint32_t)AUDIO_REC_DMA_HALF_WORDS * 2;   /* in 16-bit words */
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+  DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+  DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_1QuarterFull;
+  DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+  DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+  DMA_Init(AUDIO_REC_DMA_STREAM, &DMA_InitStructure);
+
+  /* Enable the half and full transfer interrupts */
+  DMA_ITConfig(AUDIO_REC_DMA_STREAM, DMA_IT_HT | DMA_IT_TC, ENABLE);
 }
 
+#endif /* AUDIO_REC_DMA */
+
 
 /**
   * @brief  Initialize the NVIC.
@@ -294,14 +498,21 @@ static void WaveRecorder_NVIC_Init(void)
   NVIC_InitTypeDef NVIC_InitStructure;
 
   NVIC_PriorityGroupConfig(NVIC_PriorityGroup_3); 
+#ifdef AUDIO_REC_DMA
+  /* Configure the capture DMA interrupt priority */
+  NVIC_InitStructure.NVIC_IRQChannel = AUDIO_REC_DMA_IRQ;
+#else
   /* Configure the SPI interrupt priority */
   NVIC_InitStructure.NVIC_IRQChannel = SPI2_IRQn;
+#endif
   NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1;
   NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
   NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
   NVIC_Init(&NVIC_InitStructure);
 }
 
+#endif /* HOST_SIM */
+
 
 #ifdef  USE_FULL_ASSERT
 
@@ -8,7 +8,9 @@
 #define _USE_IOCTL	1
 
 #include "integer.h"
+#ifdef STM32F4XX
 #include "usbh_msc_core.h"
+#endif
 
 /* Status of Disk Functions */
 typedef BYTE	DSTATUS;
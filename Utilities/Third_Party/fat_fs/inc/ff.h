@@ -362,6 +362,9 @@ typedef struct _FIL_ {
 	DWORD	org_clust;	/* File start cluster */
 	DWORD	curr_clust;	/* Current cluster */
 	DWORD	dsect;		/* Current data sector */
+#if _USE_FASTSEEK
+	DWORD*	cltbl;		/* Pointer to the cluster link map table (set by the application, null on file open) */
+#endif
 #if !_FS_READONLY
 	DWORD	dir_sect;	/* Sector containing the directory entry */
 	BYTE*	dir_ptr;	/* Pointer to the directory entry in the window */
@@ -407,7 +410,8 @@ typedef enum {
 	FR_NOT_ENABLED,		/* 12 */
 	FR_NO_FILESYSTEM,	/* 13 */
 	FR_MKFS_ABORTED,	/* 14 */
-	FR_TIMEOUT			/* 15 */
+	FR_TIMEOUT,			/* 15 */
+	FR_NOT_ENOUGH_CORE	/* 16 */
 } FRESULT;
 
 
@@ -426,6 +430,7 @@ FRESULT f_readdir (DIR*, FILINFO*);					/* Read a directory item */
 FRESULT f_stat (const XCHAR*, FILINFO*);			/* Get file status */
 FRESULT f_getfree (const XCHAR*, DWORD*, FATFS**);	/* Get number of free clusters on the drive */
 FRESULT f_truncate (FIL*);							/* Truncate file */
+FRESULT f_expand (FIL*, DWORD, BYTE);				/* Allocate a contiguous block to the file */
 FRESULT f_sync (FIL*);								/* Flush cached data of a writing file */
 FRESULT f_unlink (const XCHAR*);					/* Delete an existing file or directory */
 FRESULT	f_mkdir (const XCHAR*);						/* Create a new directory */
@@ -491,10 +496,16 @@ void ff_rel_grant(_SYNC_t);
 #define	FA_OPEN_ALWAYS		0x10
 #define FA__WRITTEN			0x20
 #define FA__DIRTY			0x40
+#define FA__CONTIG			0x10	/* Shares the bit with FA_OPEN_ALWAYS (only used by f_open) */
 #endif
 #define FA__ERROR			0x80
 
 
+/* Offset argument of f_lseek to create the cluster link map table */
+
+#define CREATE_LINKMAP		0xFFFFFFFF
+
+
 /* FAT sub type (FATFS.fs_type) */
 
 #define FS_FAT12	1
@@ -48,6 +48,30 @@
 /* To enable f_forward function, set _USE_FORWARD to 1 and set _FS_TINY to 1. */
 
 
+#define	_USE_EXPAND		1	/* 0 or 1 */
+/* To enable f_expand function, set _USE_EXPAND to 1, _FS_READONLY to 0 and
+/  _FS_MINIMIZE to 0. A file expanded with f_expand is written straight to the
+/  disk in multiple sector blocks without following the FAT. */
+
+
+#define	_USE_FASTSEEK	1	/* 0 or 1 */
+/* To enable fast seek, set _USE_FASTSEEK to 1. The application sets FIL.cltbl to
+/  a DWORD array with the array size in the first item and calls f_lseek(fp,
+/  CREATE_LINKMAP) to fill it with the fragments of the cluster chain (2 items per
+/  fragment plus 2). After that, f_lseek and f_read/f_write find the clusters in
+/  the table without reading the FAT, but the file cannot be stretched. */
+
+
+#ifndef _USE_DISKCACHE
+#define	_USE_DISKCACHE	0	/* 0 or 1 */
+#endif
+/* When _USE_DISKCACHE is set to 1, FatFs accesses the disk through a write-back
+/  sector cache (the diskcache_* functions in diskcache.h), which calls the disk_*
+/  functions. Dirty sectors are written on eviction and on CTRL_SYNC (f_sync). The
+/  cache is part of the application (e.g. eDog's diskcache.c), so the application
+/  turns it on from its own project (_USE_DISKCACHE=1 in the preprocessor symbols). */
+
+
 
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
@@ -152,9 +176,14 @@
 /  performance and code size. */
 
 
-#define _FS_REENTRANT	0		/* 0 or 1 */
-#define _FS_TIMEOUT		1000	/* Timeout period in unit of time ticks */
-#define	_SYNC_t			HANDLE	/* O/S dependent type of sync object. e.g. HANDLE, OS_EVENT*, ID and etc.. */
+#define _FS_REENTRANT	1		/* 0 or 1 */
+#define _FS_TIMEOUT		1000	/* Timeout period in unit of time ticks (msec on the host) */
+#ifdef STM32F4XX
+#define	_SYNC_t			BYTE	/* Volume number (lock flags of the cooperative tasks, see option/syncobj.c) */
+#else
+#include <pthread.h>
+#define	_SYNC_t			pthread_mutex_t*	/* Mutex (host simulation and test tools) */
+#endif
 /* The _FS_REENTRANT option switches the reentrancy of the FatFs module.
 /
 /   0: Disable reentrancy. _SYNC_t and _FS_TIMEOUT have no effect.
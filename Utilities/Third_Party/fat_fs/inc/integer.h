@@ -8,7 +8,9 @@
 #include <windows.h>
 #else
 
+#ifdef STM32F4XX
 #include "usb_conf.h"
+#endif
 
 /* These types must be 16-bit, 32-bit or larger integer */
 typedef int				INT;
@@ -26,9 +28,15 @@ typedef unsigned short	WORD;
 typedef unsigned short	WCHAR;
 
 /* These types must be 32-bit integer */
+#ifdef STM32F4XX
 typedef long			LONG;
 typedef unsigned long	ULONG;
 typedef unsigned long	DWORD;
+#else	/* long can be 64 bits on the host (simulation and test tools) */
+typedef int				LONG;
+typedef unsigned int	ULONG;
+typedef unsigned int	DWORD;
+#endif
 
 /* Boolean type */
 // typedef enum { FALSE = 0, TRUE } BOOL;
@@ -78,6 +78,14 @@
 
 #include "ff.h"			/* FatFs configurations and declarations */
 #include "diskio.h"		/* Declarations of low level disk I/O functions */
+#if _USE_DISKCACHE
+#include "diskcache.h"	/* Write-back sector cache in front of the disk I/O functions */
+#define disk_initialize	diskcache_initialize
+#define disk_status		diskcache_status
+#define disk_read		diskcache_read
+#define disk_write		diskcache_write
+#define disk_ioctl		diskcache_ioctl
+#endif
 
 
 /*--------------------------------------------------------------------------
@@ -538,6 +546,35 @@ DWORD clust2sect (	/* !=0: Sector number, 0: Failed - invalid cluster# */
 
 
 
+#if _USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* Get cluster# of the file offset from the cluster link map table       */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD clmt_clust (	/* 0:Out of the table, >=2:Cluster# */
+	FIL *fp,		/* Pointer to the file object */
+	DWORD ofs		/* File offset to be converted to cluster# */
+)
+{
+	DWORD cl, ncl, *tbl;
+
+
+	tbl = fp->cltbl + 1;	/* Top of the CLMT */
+	cl = ofs / SS(fp->fs) / fp->fs->csize;	/* Cluster order from top of the file */
+	for (;;) {
+		ncl = *tbl++;		/* Number of clusters in the fragment */
+		if (!ncl) return 0;	/* End of table? (error) */
+		if (cl < ncl) break;	/* In this fragment? */
+		cl -= ncl; tbl++;	/* Next fragment */
+	}
+	return cl + *tbl;		/* Return the cluster# */
+}
+#endif /* _USE_FASTSEEK */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Seek directory index                             */
 /*-----------------------------------------------------------------------*/
@@ -1743,11 +1780,17 @@ FRESULT f_open (
 	fp->dir_ptr = dj.dir;
 #endif
 	fp->flag = mode;					/* File access mode */
+#if _USE_EXPAND && !_FS_READONLY
+	fp->flag &= ~FA__CONTIG;			/* (FA_OPEN_ALWAYS shares the bit with the contiguous flag) */
+#endif
 	fp->org_clust =						/* File start cluster */
 		((DWORD)LD_WORD(dir+DIR_FstClusHI) << 16) | LD_WORD(dir+DIR_FstClusLO);
 	fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
 	fp->fptr = 0; fp->csect = 255;		/* File pointer */
 	fp->dsect = 0;
+#if _USE_FASTSEEK
+	fp->cltbl = 0;						/* No cluster link map table */
+#endif
 	fp->fs = dj.fs; fp->id = dj.fs->id;	/* Owner file system object of the file */
 
 	LEAVE_FF(dj.fs, FR_OK);
@@ -1788,6 +1831,11 @@ FRESULT f_read (
 		rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {			/* On the sector boundary? */
 			if (fp->csect >= fp->fs->csize) {		/* On the cluster boundary? */
+#if _USE_FASTSEEK
+				if (fp->cltbl && fp->fptr)			/* Get next cluster from the CLMT */
+					clst = clmt_clust(fp, fp->fptr);
+				else
+#endif
 				clst = (fp->fptr == 0) ?			/* On the top of the file? */
 					fp->org_clust : get_fat(fp->fs, fp->curr_clust);
 				if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
@@ -1881,13 +1929,60 @@ FRESULT f_write (
 	for ( ;  btw;									/* Repeat until all data transferred */
 		wbuff += wcnt, fp->fptr += wcnt, *bw += wcnt, btw -= wcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {			/* On the sector boundary? */
+#if _USE_EXPAND
+			cc = ((fp->flag & FA__CONTIG) && fp->fptr < fp->fsize) ? (fp->fsize - fp->fptr) / SS(fp->fs) : 0;
+			if (cc > btw / SS(fp->fs)) cc = btw / SS(fp->fs);
+			if (cc) {								/* Contiguous block (f_expand): write sectors directly without following the FAT */
+				if (cc > 128) cc = 128;				/* Clip at the sector count limit of disk_write */
+#if _FS_TINY
+				if (fp->fs->winsect == fp->dsect && move_window(fp->fs, 0))	/* Write back data buffer prior to following direct transfer */
+					ABORT(fp->fs, FR_DISK_ERR);
+#else
+				if (fp->flag & FA__DIRTY) {		/* Write back data buffer prior to following direct transfer */
+					if (disk_write(fp->fs->drive, fp->buf, fp->dsect, 1) != RES_OK)
+						ABORT(fp->fs, FR_DISK_ERR);
+					fp->flag &= ~FA__DIRTY;
+				}
+#endif
+				sect = clust2sect(fp->fs, fp->org_clust);	/* Get top sector of the block */
+				if (!sect) ABORT(fp->fs, FR_INT_ERR);
+				sect += fp->fptr / SS(fp->fs);
+				if (disk_write(fp->fs->drive, wbuff, sect, (BYTE)cc) != RES_OK)
+					ABORT(fp->fs, FR_DISK_ERR);
+#if _FS_TINY
+				if (fp->fs->winsect - sect < cc) {	/* Refill sector cache if it gets dirty by the direct write */
+					mem_cpy(fp->fs->win, wbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), SS(fp->fs));
+					fp->fs->wflag = 0;
+				}
+#else
+				if (fp->dsect - sect < cc) {		/* Refill sector cache if it gets dirty by the direct write */
+					mem_cpy(fp->buf, wbuff + ((fp->dsect - sect) * SS(fp->fs)), SS(fp->fs));
+					fp->flag &= ~FA__DIRTY;
+				}
+#endif
+				clst = fp->fptr / SS(fp->fs) + cc - 1;	/* Last sector written (file relative) */
+				fp->curr_clust = fp->org_clust + clst / fp->fs->csize;
+				fp->csect = (BYTE)(clst % fp->fs->csize + 1);
+				wcnt = SS(fp->fs) * cc;				/* Number of bytes transferred */
+				continue;
+			}
+#endif
 			if (fp->csect >= fp->fs->csize) {		/* On the cluster boundary? */
 				if (fp->fptr == 0) {				/* On the top of the file? */
 					clst = fp->org_clust;			/* Follow from the origin */
 					if (clst == 0)					/* When there is no cluster chain, */
 						fp->org_clust = clst = create_chain(fp->fs, 0);	/* Create a new cluster chain */
 				} else {							/* Middle or end of the file */
+#if _USE_FASTSEEK
+					if (fp->cltbl)					/* Follow the CLMT (the file cannot be stretched) */
+						clst = clmt_clust(fp, fp->fptr);
+					else
+#endif
 					clst = create_chain(fp->fs, fp->curr_clust);			/* Follow or stretch cluster chain */
+#if _USE_EXPAND
+					if (clst != fp->curr_clust + 1)	/* The file is no longer contiguous */
+						fp->flag &= ~FA__CONTIG;
+#endif
 				}
 				if (clst == 0) break;				/* Could not allocate a new cluster (disk full) */
 				if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
@@ -2112,6 +2207,65 @@ FRESULT f_lseek (
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
 	if (fp->flag & FA__ERROR)			/* Check abort flag */
 		LEAVE_FF(fp->fs, FR_INT_ERR);
+
+#if _USE_FASTSEEK
+	if (fp->cltbl) {					/* Fast seek */
+		DWORD ncl, pcl, tcl, tlen, ulen, *tbl;
+
+		if (ofs == CREATE_LINKMAP) {	/* Create the CLMT */
+			tbl = fp->cltbl;
+			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
+			clst = fp->org_clust;		/* Top of the chain */
+			if (clst) {
+				do {					/* Get a fragment */
+					tcl = clst; ncl = 0; ulen += 2;	/* Top, length and used items */
+					do {
+						pcl = clst; ncl++;
+						clst = get_fat(fp->fs, clst);
+						if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
+						if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+					} while (clst == pcl + 1);
+					if (ulen <= tlen) {	/* Store the length and top of the fragment */
+						*tbl++ = ncl; *tbl++ = tcl;
+					}
+				} while (clst < fp->fs->max_clust);	/* Repeat until end of chain */
+			}
+			*fp->cltbl = ulen;			/* Number of items used */
+			if (ulen <= tlen)
+				*tbl = 0;				/* Terminate the table */
+			else
+				res = FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
+		} else {						/* Seek with the CLMT (no FAT access) */
+			if (ofs > fp->fsize) ofs = fp->fsize;	/* Clip offset with the file size */
+			fp->fptr = ofs; fp->csect = 255; nsect = 0;
+			if (ofs) {
+				clst = clmt_clust(fp, ofs - 1);		/* Cluster containing the byte before the pointer */
+				nsect = clust2sect(fp->fs, clst);
+				if (!nsect) ABORT(fp->fs, FR_INT_ERR);
+				fp->curr_clust = clst;
+				ofs = (ofs - 1) / SS(fp->fs) % fp->fs->csize;	/* Sector offset of that byte in the cluster */
+				nsect += ofs;
+				fp->csect = (BYTE)(ofs + 1);
+			}
+			if (fp->fptr % SS(fp->fs) && nsect != fp->dsect) {
+#if !_FS_TINY
+#if !_FS_READONLY
+				if (fp->flag & FA__DIRTY) {		/* Write-back dirty buffer if needed */
+					if (disk_write(fp->fs->drive, fp->buf, fp->dsect, 1) != RES_OK)
+						ABORT(fp->fs, FR_DISK_ERR);
+					fp->flag &= ~FA__DIRTY;
+				}
+#endif
+				if (disk_read(fp->fs->drive, fp->buf, nsect, 1) != RES_OK)
+					ABORT(fp->fs, FR_DISK_ERR);
+#endif
+				fp->dsect = nsect;
+			}
+		}
+		LEAVE_FF(fp->fs, res);
+	}
+#endif
+
 	if (ofs > fp->fsize					/* In read-only mode, clip offset with the file size */
 #if !_FS_READONLY
 		 && !(fp->flag & FA_WRITE)
@@ -2147,6 +2301,10 @@ FRESULT f_lseek (
 					if (clst == 0) {				/* When disk gets full, clip file size */
 						ofs = bcs; break;
 					}
+#if _USE_EXPAND
+					if (clst != fp->curr_clust + 1)	/* The file is no longer contiguous */
+						fp->flag &= ~FA__CONTIG;
+#endif
 				} else
 #endif
 					clst = get_fat(fp->fs, clst);	/* Follow cluster chain if not in write mode */
@@ -2397,6 +2555,9 @@ FRESULT f_truncate (
 	if (fp->fsize > fp->fptr) {
 		fp->fsize = fp->fptr;	/* Set file size to current R/W point */
 		fp->flag |= FA__WRITTEN;
+#if _USE_FASTSEEK
+		fp->cltbl = 0;			/* The CLMT no longer matches the chain */
+#endif
 		if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
 			res = remove_chain(fp->fs, fp->org_clust);
 			fp->org_clust = 0;
@@ -2419,6 +2580,79 @@ FRESULT f_truncate (
 
 
 
+#if _USE_EXPAND
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Block to the File                               */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_expand (
+	FIL *fp,		/* Pointer to the file object (opened in write mode and empty) */
+	DWORD fsz,		/* File size to be expanded to */
+	BYTE opt		/* 0:Find the block and make it the next allocation point, 1:Allocate it to the file */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD val, clst, stcl, scl, ncl, tcl;
+
+
+	res = validate(fp->fs, fp->id);		/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (fp->flag & FA__ERROR)			/* Check abort flag */
+		LEAVE_FF(fp->fs, FR_INT_ERR);
+	if (!(fp->flag & FA_WRITE) || fp->fsize || fp->org_clust || !fsz)	/* Check access mode and file size */
+		LEAVE_FF(fp->fs, FR_DENIED);
+
+	fs = fp->fs;
+	tcl = (fsz - 1) / ((DWORD)fs->csize * SS(fs)) + 1;	/* Number of clusters required */
+	if (tcl > fs->max_clust - 2) LEAVE_FF(fs, FR_DENIED);
+
+	stcl = fs->last_clust + 1;			/* Search from the cluster next to the last allocated one */
+	if (stcl < 2 || stcl >= fs->max_clust) stcl = 2;
+	scl = clst = stcl; ncl = 0;
+	for (;;) {							/* Find a contiguous run of tcl free clusters */
+		val = get_fat(fs, clst);
+		if (val == 1) { res = FR_INT_ERR; break; }
+		if (val == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+		if (val == 0) {					/* Free cluster, extend the run */
+			if (++ncl == tcl) break;
+		} else {						/* In use, start a new run from the next cluster */
+			scl = clst + 1; ncl = 0;
+		}
+		if (++clst >= fs->max_clust) {	/* Wrap around (a run cannot straddle the end) */
+			scl = clst = 2; ncl = 0;
+		}
+		if (clst == stcl) { res = FR_DENIED; break; }	/* No contiguous space */
+	}
+
+	if (res == FR_OK) {
+		if (opt) {						/* Link the clusters into a chain and give it to the file */
+			for (clst = scl; res == FR_OK && clst < scl + tcl - 1; clst++)
+				res = put_fat(fs, clst, clst + 1);
+			if (res == FR_OK) res = put_fat(fs, clst, 0x0FFFFFFF);
+			if (res == FR_OK) {
+				fs->last_clust = clst;	/* Update FSINFO */
+				if (fs->free_clust != 0xFFFFFFFF) {
+					fs->free_clust -= tcl;
+					fs->fsi_flag = 1;
+				}
+				fp->org_clust = scl;
+				fp->fsize = fsz;
+				fp->flag |= FA__WRITTEN | FA__CONTIG;
+			}
+		} else {						/* Leave it free, but make the next allocation start there */
+			fs->last_clust = scl - 1;
+		}
+	}
+	if (res != FR_OK && res != FR_DENIED) fp->flag |= FA__ERROR;
+
+	LEAVE_FF(fs, res);
+}
+#endif /* _USE_EXPAND */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Delete a File or Directory                                            */
 /*-----------------------------------------------------------------------*/
@@ -1,17 +1,32 @@
 /*------------------------------------------------------------------------*/
-/* Sample code of OS dependent synchronization object controls            */
-/* for FatFs R0.07d  (C)ChaN, 2009                                        */
+/* OS dependent synchronization object controls for FatFs R0.07e          */
+/* (based on the sample code for FatFs R0.07d  (C)ChaN, 2009)             */
 /*------------------------------------------------------------------------*/
+/* On the host (the simulation and test tools) the sync object is a
+/  pthread mutex. On the board there is no preemptive OS, just tasks that
+/  run one step at a time from the main loop (a cooperative scheduler), so
+/  a task never loses the CPU in the middle of a file function. The sync
+/  object is then just a flag, and the only way to find the volume locked
+/  is a file function called from an interrupt handler while the main loop
+/  is in one. That can't wait (the owner can't run until the handler
+/  returns), so it fails right away with FR_TIMEOUT.
+*/
 
-#include <windows.h>	// Win32
-//#include <ucos_ii.h>	// uC/OS-II
-
-#include "../ff.h"
+#include "ff.h"
 
 #if _FS_REENTRANT
 
+#ifdef STM32F4XX
+static volatile BYTE Locked[_DRIVES];	/* Lock flags of the volumes */
+#else
+#include <time.h>
+static pthread_mutex_t Mutex[_DRIVES];	/* Mutexes of the volumes */
+#endif
+
+
+
 /*------------------------------------------------------------------------*/
-/* Create a Synchronization Object for a Volume
+/* Create a Synchronization Object for a Volume                           */
 /*------------------------------------------------------------------------*/
 /* This function is called in f_mount function to create a new
 /  synchronization object, such as semaphore and mutex. When a FALSE is
@@ -23,18 +38,14 @@ BOOL ff_cre_syncobj (	/* TRUE:Function succeeded, FALSE:Could not create due to
 	_SYNC_t *sobj		/* Pointer to return the created sync object */
 )
 {
-	BOOL ret;
-
-	*sobj = CreateMutex(NULL, FALSE, NULL);					// Win32
-	ret = (*sobj != INVALID_HANDLE_VALUE) ? TRUE : FALSE;	//
-
-//	*sobj = VolumeSemId[vol];	// uITRON (give a static created sync object)
-//	ret = TRUE;					// The initial value of the semaphore must be 1.
-
-//	*sobj = OSMutexCreate(0, &err);				// uC/OS-II
-//	ret = (err == OS_NO_ERR) ? TRUE : FALSE;	//
-
-	return ret;
+#ifdef STM32F4XX
+	Locked[vol] = 0;
+	*sobj = vol;
+	return TRUE;
+#else
+	*sobj = &Mutex[vol];
+	return pthread_mutex_init(*sobj, NULL) == 0 ? TRUE : FALSE;
+#endif
 }
 
 
@@ -51,16 +62,12 @@ BOOL ff_del_syncobj (	/* TRUE:Function succeeded, FALSE:Could not delete due to
 	_SYNC_t sobj		/* Sync object tied to the logical drive to be deleted */
 )
 {
-	BOOL ret;
-
-	ret = CloseHandle(sobj);	// Win32
-
-//	ret = TRUE;					// uITRON (nothing to do)
-
-//	OSMutexDel(sobj, OS_DEL_ALWAYS, &err);		// uC/OS-II
-//	ret = (err == OS_NO_ERR) ? TRUE : FALSE;	//
-
-	return ret;
+#ifdef STM32F4XX
+	Locked[sobj] = 0;
+	return TRUE;
+#else
+	return pthread_mutex_destroy(sobj) == 0 ? TRUE : FALSE;
+#endif
 }
 
 
@@ -76,16 +83,22 @@ BOOL ff_req_grant (	/* TRUE:Got a grant to access the volume, FALSE:Could not ge
 	_SYNC_t sobj	/* Sync object to wait */
 )
 {
-	BOOL ret;
-
-	ret = (WaitForSingleObject(sobj, _FS_TIMEOUT) == WAIT_OBJECT_0) ? TRUE : FALSE;	// Win32
-
-//	ret = (wai_sem(sobj) == E_OK) ? TRUE : FALSE;	// uITRON
-
-//	OSMutexPend(sobj, _FS_TIMEOUT, &err));				// uC/OS-II
-//	ret = (err == OS_NO_ERR) ? TRUE : FALSE;		//
-
-	return ret;
+#ifdef STM32F4XX
+	if (Locked[sobj]) return FALSE;	/* Called from an interrupt while the volume is in use */
+	Locked[sobj] = 1;
+	return TRUE;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);		/* Wait up to _FS_TIMEOUT msec */
+	ts.tv_sec += _FS_TIMEOUT / 1000;
+	ts.tv_nsec += (_FS_TIMEOUT % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return pthread_mutex_timedlock(sobj, &ts) == 0 ? TRUE : FALSE;
+#endif
 }
 
 
@@ -100,11 +113,11 @@ void ff_rel_grant (
 	_SYNC_t sobj	/* Sync object to be signaled */
 )
 {
-	ReleaseMutex(sobj);	// Win32
-
-//	sig_sem(sobj);		// uITRON
-
-//	OSMutexPost(sobj);	// uC/OS-II
+#ifdef STM32F4XX
+	Locked[sobj] = 0;
+#else
+	pthread_mutex_unlock(sobj);
+#endif
 }
 
 